@@ -97,15 +97,28 @@ def main():
         lines = fp.readlines()
 
     pd = PreprocessorData()
+    # locations of the invocations recorded for each macro so far
+    invocation_locations: dict[Macro, set[str]] = {}
 
     # src directory, to be initialized during the analysis
     src_dir = ''
+    # whether the current file's arguments were not aligned, e.g. because
+    # it was analyzed again with no_argument_alignment after timing out
+    unaligned = False
+    # invocations whose argument properties are imprecise
+    unaligned_invocations = 0
 
     for line in lines:
         line = line.rstrip()
 
         if line.startswith('Src'):
             _, src_dir = line.split(DELIM)
+            unaligned = False
+
+        elif line.startswith('Option'):
+            _, Option = line.split(DELIM)
+            if Option == 'no_argument_alignment':
+                unaligned = True
 
         elif line.startswith('Define'):
             _, Name, IsObjectLike, IsDefLocValid, DefLocOrError = line.split(
@@ -133,7 +146,11 @@ def main():
                       i.DefinitionLocation)
             # Only record unique invocations - two invocations may have the same
             # location if they are the same nested invocation
-            if all([j.InvocationLocation != i.InvocationLocation for j in pd.mm[m]]):
+            locations = invocation_locations.setdefault(m, set())
+            if i.InvocationLocation not in locations:
+                locations.add(i.InvocationLocation)
+                if unaligned:
+                    unaligned_invocations += 1
                 pd.mm[m].add(i)
 
     # src_pd only records preprocessor data about source macros
@@ -444,6 +461,11 @@ def main():
             ])),
     )
 
+    if unaligned_invocations:
+        print(f'warning: {unaligned_invocations} invocations were analyzed '
+              'without argument alignment, so their argument properties are '
+              'imprecise', file=sys.stderr)
+
     if args.output_file:
         with open(args.output_file, 'w', encoding='utf-8') as ofp:
             json.dump(asdict(a), ofp, indent=4)
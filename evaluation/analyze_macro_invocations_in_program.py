@@ -1,14 +1,24 @@
 #!/usr/bin/python3
 
 import argparse
+import glob
+import hashlib
 import json
 import os
+import shutil
+import signal
 import subprocess
 import sys
+import threading
+import time
 from dataclasses import dataclass
 from itertools import repeat
 from multiprocessing.pool import ThreadPool
-from typing import List
+from typing import List, Sequence
+
+from run_journal import RunJournal
+from scheduling import (ProgressReporter, TimingLog, estimate_costs,
+                        longest_first, partition)
 
 # Import CMake-generated configuration
 try:
@@ -35,6 +45,57 @@ class CompileCommand:
 DELIM = "\t"
 
 
+@dataclass
+class RunLimits:
+    '''Limits on each run of cpp2c on a single file'''
+    # wall-clock time limit in seconds
+    timeout: float | None = None
+    # address space limit in MiB
+    memory_limit: int | None = None
+    # whether to retry a file that timed out without aligning macro arguments
+    retry_without_argument_alignment: bool = False
+
+
+@dataclass
+class Failure:
+    '''A file whose analysis failed'''
+    file: str
+    # 'timeout' or 'failed'
+    status: str
+    returncode: int | None
+    # name and location of the macro invocation being analyzed, if known
+    last_invocation: str
+    # status of the retry without argument alignment, or '' if not retried
+    retry_status: str = ''
+
+
+def run_limited(cmd: str, ofp, limits: RunLimits) -> tuple[str, int | None]:
+    '''
+    Runs a shell command in its own process group within the given limits,
+    and returns its status ('ok', 'timeout', or 'failed') and return code
+    '''
+    if limits.memory_limit is not None:
+        cmd = f'ulimit -v {limits.memory_limit * 1024} && {cmd}'
+    p = subprocess.Popen(cmd, shell=True, text=True, stdout=ofp,
+                         start_new_session=True)
+    try:
+        returncode = p.wait(timeout=limits.timeout)
+    except subprocess.TimeoutExpired:
+        # kill the compiler too, not just the shell
+        os.killpg(p.pid, signal.SIGKILL)
+        p.wait()
+        return 'timeout', None
+    return ('ok' if returncode == 0 else 'failed'), returncode
+
+
+def drop_partial_line(path: str) -> None:
+    '''Removes a line that a killed process did not finish writing'''
+    with open(path, 'rb+') as fp:
+        data = fp.read()
+        if data and not data.endswith(b'\n'):
+            fp.truncate(data.rfind(b'\n') + 1)
+
+
 def removeprefix(s: str, t: str):
     '''Custom removeprefix function for Python 3.8.10 support'''
     i = s.find(t)
@@ -43,13 +104,42 @@ def removeprefix(s: str, t: str):
     return s[i+len(t):]
 
 
+def snapshot_paths(cc: CompileCommand, snapshot_dir: str) -> tuple[str, str]:
+    '''
+    Returns the paths of the serialized AST and of the macro snapshot of the
+    given compile command in snapshot_dir
+    '''
+    key = hashlib.sha256(json.dumps(
+        [cc.directory, cc.file, cc.arguments]).encode()).hexdigest()[:32]
+    return (os.path.join(snapshot_dir, key + '.ast'),
+            os.path.join(snapshot_dir, key + '.macros'))
+
+
+def is_snapshot_fresh(ast_path: str, macros_path: str) -> bool:
+    '''
+    Returns true if both parts of a snapshot exist, and no file that the
+    translation unit comprised has changed since they were written
+    '''
+    try:
+        written = min(os.path.getmtime(ast_path), os.path.getmtime(macros_path))
+        with open(macros_path) as fp:
+            files = json.load(fp)['Files']
+        return all(os.path.getmtime(f) <= written for f in files)
+    except (OSError, ValueError, KeyError):
+        return False
+
+
 def cpp2c(cpp2c_so_path: str,
           cc: CompileCommand,
           src_dir: str,
           dst_path: str,
           i: List[int], n: int,
-          code_range_analysis_tasks_json_path: str | None = None
-          ) -> None:
+          code_range_analysis_tasks_json_path: str | None = None,
+          pp_only: bool = False,
+          plugin_args: Sequence[str] = (),
+          limits: RunLimits | None = None,
+          snapshot_dir: str | None = None
+          ) -> Failure | None:
     '''
     Runs Cpp2C on the program that the given compile_commands.json file
     comprises in the given src_dir, and prints the results to the outdir
@@ -62,6 +152,17 @@ def cpp2c(cpp2c_so_path: str,
         i:              a list containing a single integer, the current number of
                         files processed so far
         n:              the total number of files to process
+        pp_only:        only run the preprocessor, and only emit facts about
+                        definitions and includes
+        plugin_args:    extra arguments to pass to the cpp2c plugin, such as
+                        'skip_unexpanded_bodies'
+        limits:         limits on the run; by default there are none
+        snapshot_dir:   directory of snapshots of parsed translation units;
+                        a fresh snapshot is analyzed instead of parsing the
+                        file again, and one is written otherwise
+
+    Returns a description of the failure if cpp2c did not finish, in which
+    case the results it printed before failing are kept.
     '''
 
     clang_unknown_args = {
@@ -128,6 +229,9 @@ def cpp2c(cpp2c_so_path: str,
     # at the very end, specify that we are only doing syntactic analysis
     # so as to not waste time compiling
     args.append('-fsyntax-only')
+    if pp_only:
+        # replace the syntax-only action with cpp2c's preprocessor-only action
+        args.extend(['-Xclang', '-plugin', '-Xclang', 'cpp2c-pp-only'])
     # also add ignore these specific types of warning in order to be able to
     # compile Linux with Clang
     # FIXME: Perhaps it would be better to simply remove "-Werror"?
@@ -142,24 +246,90 @@ def cpp2c(cpp2c_so_path: str,
         # if we are doing code range analysis, pass the path to the task
         # json file to the plugin
         args.append(f'-fplugin-arg-cpp2c-code_range_analysis_tasks_json_path={code_range_analysis_tasks_json_path}')
+    for plugin_arg in plugin_args:
+        args.append(f'-fplugin-arg-cpp2c-{plugin_arg}')
+
+    if limits is None:
+        limits = RunLimits()
+    # the plugin writes the macro invocation it is analyzing here
+    progress_path = dst_path + '.progress'
+    args.append(f'-fplugin-arg-cpp2c-progress_file={progress_path}')
+
+    written_snapshot: tuple[str, str] | None = None
+    if snapshot_dir is not None and not pp_only:
+        ast_path, macros_path = snapshot_paths(cc, snapshot_dir)
+        if is_snapshot_fresh(ast_path, macros_path):
+            # the AST holds the compile command's options, so only the
+            # plugin's arguments still apply
+            args = ([CLANG_EXE, '-fsyntax-only', ast_path] +
+                    [arg for arg in args if arg.startswith('-fplugin')] +
+                    [f'-fplugin-arg-cpp2c-read_snapshot={macros_path}'])
+        else:
+            args = ([arg for arg in args if arg != '-fsyntax-only'] +
+                    ['-emit-ast', '-o', ast_path,
+                     f'-fplugin-arg-cpp2c-write_snapshot={macros_path}'])
+            written_snapshot = (ast_path, macros_path)
+
+    def run(args: List[str]) -> tuple[str, int | None]:
+        with open(dst_path, 'w') as ofp:
+            # print header information about the analysis file
+            print(f'Src{DELIM}{src_dir}', file=ofp)
+            ofp.flush()
+            # change to the directory, then run cpp2c
+            cmd = f"cd \"{cc.directory}\" && {' '.join(args)}"
+            print(cmd)
+            return run_limited(cmd, ofp, limits)
+
+    def progress_paths() -> List[str]:
+        # with jobs, each forked worker writes to a file of its own
+        workers = [p for p in glob.glob(glob.escape(progress_path) + '.*')
+                   if p.rpartition('.')[2].isdigit()]
+        return [progress_path] + sorted(
+            workers, key=lambda p: int(p.rpartition('.')[2]))
+
+    def last_invocation() -> str:
+        # the main process's invocation, or else the first worker's
+        for path in progress_paths():
+            try:
+                with open(path) as fp:
+                    invocation = fp.read().strip()
+            except OSError:
+                continue
+            if invocation:
+                return invocation
+        return ''
 
     fullpath = os.path.realpath(os.path.join(cc.directory, cc.file))
-    with open(dst_path, 'w') as ofp:
-        print(f'Analyzing macros in {fullpath} ({os.path.getsize(fullpath)} bytes)')
-        print(dst_path)
-        # print header information about the analysis file
-        print(f'Src{DELIM}{src_dir}', file=ofp)
-        ofp.flush()
-        # change to the directory, then run cpp2c
-        cmd = f"cd \"{cc.directory}\" && {' '.join(args)}"
-        print(cmd)
-        p = subprocess.run(cmd, shell=True, text=True, stdout=ofp)
-        if p.stderr:
-            print(p.stderr)
-        p.check_returncode()
+    print(f'Analyzing macros in {fullpath} ({os.path.getsize(fullpath)} bytes)')
+    print(dst_path)
+    failure = None
+    status, returncode = run(args)
+    if status != 'ok':
+        drop_partial_line(dst_path)
+        failure = Failure(cc.file, status, returncode, last_invocation())
+        print(f'error: analysis of {fullpath} {"timed out" if status == "timeout" else "failed"}'
+              f' while analyzing {failure.last_invocation or "unknown invocation"}',
+              file=sys.stderr)
+        if status == 'timeout' and limits.retry_without_argument_alignment:
+            # a cheaper analysis that skips the matcher passes over each
+            # argument; its argument properties are less precise
+            status, _ = run(args + ['-fplugin-arg-cpp2c-no_argument_alignment'])
+            if status != 'ok':
+                drop_partial_line(dst_path)
+            failure.retry_status = status
+    if (written_snapshot is not None and failure is not None and
+            failure.retry_status != 'ok'):
+        # the two parts of the snapshot may not match
+        for path in written_snapshot:
+            if os.path.exists(path):
+                os.remove(path)
+    for path in progress_paths():
+        if os.path.exists(path):
+            os.remove(path)
 
     i[0] += 1
     print(f'macro invocations in {i[0]} / {n} files analyzed', file=sys.stderr)
+    return failure
 
 
 def main():
@@ -172,6 +342,41 @@ def main():
     ap.add_argument('num_processes', type=int)
     # optional arguments
     ap.add_argument('code_range_analysis_tasks_json_path', type=str, nargs='?')
+    ap.add_argument('--pp-only', action='store_true',
+                    help='only emit definition, inspection, and include facts, '
+                         'without parsing')
+    ap.add_argument('--plugin-arg', action='append', default=[],
+                    dest='plugin_args', metavar='ARG',
+                    help='pass ARG to the cpp2c plugin, e.g. '
+                         'skip_unexpanded_bodies (may be repeated)')
+    ap.add_argument('--timeout', type=float,
+                    help='wall-clock time limit in seconds for each file')
+    ap.add_argument('--memory-limit', type=int, metavar='MIB',
+                    help='address space limit in MiB for each file')
+    ap.add_argument('--retry-without-argument-alignment', action='store_true',
+                    help='retry files that time out without aligning macro '
+                         'arguments with AST nodes')
+    ap.add_argument('--dedup-header-invocations', action='store_true',
+                    help='only analyze each invocation in a header in the '
+                         'first file that claims it')
+    ap.add_argument('--snapshot-dir', type=str, metavar='DIR',
+                    help='keep a snapshot of each parsed file in DIR, and '
+                         'analyze unchanged files from their snapshots '
+                         'instead of parsing them again')
+    ap.add_argument('--restart', action='store_true',
+                    help='analyze every file again, instead of resuming an '
+                         'interrupted run with the same compile commands '
+                         'and options')
+    ap.add_argument('--shard', type=str, metavar='I/N',
+                    help='only analyze the I-th of N shards of the files '
+                         '(1 <= I <= N), e.g. to split a run across machines')
+    ap.add_argument('--cost-file', type=str, metavar='TIMINGS_TSV',
+                    help='timings.tsv of an earlier run to balance shards by; '
+                         'by default shards are balanced by file size')
+    ap.add_argument('--fsync-interval', type=float, default=10.0,
+                    metavar='SECONDS',
+                    help='how often to sync the journal and combined results '
+                         'to disk')
     args = ap.parse_args()
 
     cpp2c_so_path: str = os.path.abspath(args.cpp2c_so_path)
@@ -189,9 +394,9 @@ def main():
         exit(1)
 
     # load compile commands.json
-    fp = open(compile_commands_json_path)
-    ccs = [CompileCommand(**cc) for cc in json.load(fp)]
-    fp.close()
+    with open(compile_commands_json_path, 'rb') as fp:
+        compile_commands = fp.read()
+    ccs = [CompileCommand(**cc) for cc in json.loads(compile_commands)]
 
     # only analyze src files
     ccs = [
@@ -213,6 +418,23 @@ def main():
               paths_with_delim_or_double_quote, file=sys.stderr)
         exit(1)
 
+    if args.shard:
+        # every shard must compute the same partition, so it is based only
+        # on the compile commands, the sources, and the given cost file
+        try:
+            shard, num_shards = map(int, args.shard.split('/'))
+            if not 1 <= shard <= num_shards:
+                raise ValueError
+        except ValueError:
+            print(f'error: invalid shard {args.shard}, expected I/N with '
+                  f'1 <= I <= N', file=sys.stderr)
+            exit(1)
+        shard_timings = TimingLog(args.cost_file).timings if args.cost_file else {}
+        shards = partition(estimate_costs(fullpaths, shard_timings), num_shards)
+        ccs = [cc for cc, k in zip(ccs, shards) if k == shard - 1]
+        fullpaths = [fp for fp, k in zip(fullpaths, shards) if k == shard - 1]
+        print(f'Analyzing shard {shard} / {num_shards}: {len(ccs)} files')
+
     # analyze every compiled src file in the program
     # we can use multiprocessing because the order in which the facts are
     # emitted does not matter
@@ -233,17 +455,93 @@ def main():
     for d in dst_dirs:
         os.makedirs(d, exist_ok=True)
 
+    plugin_args: List[str] = list(args.plugin_args)
+    limits = RunLimits(args.timeout, args.memory_limit,
+                       args.retry_without_argument_alignment)
+
+    # a run resumes from the journal of an earlier run only if it analyzes
+    # the same files in the same way
+    run_key = hashlib.sha256(compile_commands + json.dumps([
+        src_dir, code_range_analysis_tasks_json_path, args.pp_only,
+        plugin_args, args.dedup_header_invocations, limits.__dict__,
+        args.shard
+    ]).encode()).hexdigest()
+    journal_path = os.path.join(dst_dir, 'journal.tsv')
+    if args.restart and os.path.exists(journal_path):
+        os.remove(journal_path)
+    journal = RunJournal(journal_path,
+                         os.path.join(dst_dir, 'all_results.cpp2c'),
+                         run_key, args.fsync_interval)
+    # start the most expensive files first, so that the last files to
+    # finish are cheap ones and no process idles long at the end of the run
+    timing_log = TimingLog(os.path.join(dst_dir, 'timings.tsv'))
+    costs = estimate_costs(fullpaths, timing_log.timings)
+    pending = [j for j in longest_first(costs) if j not in journal.finished]
+    i[0] = n - len(pending)
+    if journal.resumed:
+        print(f'Resuming: {i[0]} / {n} files were already analyzed')
+    progress = ProgressReporter(sum(costs[j] for j in pending), n, i[0])
+
+    if args.dedup_header_invocations:
+        # the plugin records the header invocations claimed by each file
+        # here once the file's facts are printed, so files that time out or
+        # crash, and their retries, do not hide any invocations.
+        # a file whose facts were printed but not yet saved when this
+        # script was interrupted still has its claims recorded, so the
+        # claims are reset when resuming too. Files that finished may then
+        # report some invocations again, which loaders deduplicate by
+        # location.
+        dedup_dir = os.path.join(dst_dir, '.dedup')
+        shutil.rmtree(dedup_dir, ignore_errors=True)
+        os.makedirs(dedup_dir)
+        plugin_args.append(f'dedup_dir={dedup_dir}')
+
+    snapshot_dir = None
+    if args.snapshot_dir:
+        snapshot_dir = os.path.abspath(args.snapshot_dir)
+        os.makedirs(snapshot_dir, exist_ok=True)
+
+    # files whose analyses failed, and how far they got
+    failures_path = os.path.join(dst_dir, 'failures.tsv')
+    failures_lock = threading.Lock()
+    if not journal.resumed or not os.path.exists(failures_path):
+        with open(failures_path, 'w') as ofp:
+            print(DELIM.join(['File', 'Status', 'ReturnCode', 'LastInvocation',
+                              'LastInvocationLocation', 'RetryStatus']),
+                  file=ofp)
+
+    def analyze(j: int) -> Failure | None:
+        t0 = time.monotonic()
+        failure = cpp2c(cpp2c_so_path, ccs[j], src_dir, dst_paths[j], i, n,
+                        code_range_analysis_tasks_json_path, args.pp_only,
+                        plugin_args, limits, snapshot_dir)
+        timing_log.record(fullpaths[j], time.monotonic() - t0)
+        progress.file_done(costs[j])
+        if failure is not None:
+            name, _, location = failure.last_invocation.partition(DELIM)
+            with failures_lock, open(failures_path, 'a') as ofp:
+                print(DELIM.join([failure.file, failure.status,
+                                  str(failure.returncode), name, location,
+                                  failure.retry_status]), file=ofp)
+        # the results are combined as soon as each file is done
+        journal.record(j, 'ok' if failure is None else failure.status,
+                       fullpaths[j], dst_paths[j])
+        return failure
+
     # run cpp2c on all files
-    with ThreadPool(args.num_processes) as pool:
-        pool.starmap(cpp2c, zip(repeat(cpp2c_so_path), ccs, repeat(src_dir),
-                                dst_paths, repeat(i), repeat(n),
-                                repeat(code_range_analysis_tasks_json_path)))
-
-    # combine all results into a single file
-    with open(os.path.join(dst_dir, 'all_results.cpp2c'), 'w') as ofp:
-        for dp in dst_paths:
-            with open(dp) as ifp:
-                ofp.write(ifp.read())
+    # each file is analyzed by its own compiler process, so one that
+    # crashes or hangs does not affect the others.
+    # each thread takes the next file in order as soon as it is free
+    try:
+        with ThreadPool(args.num_processes) as pool:
+            failures = [f for f in pool.imap_unordered(analyze, pending)
+                        if f is not None]
+    finally:
+        journal.close()
+
+    if failures:
+        print(f'warning: {len(failures)} / {len(pending)} files failed, see '
+              f'{failures_path}', file=sys.stderr)
 
 
 if __name__ == '__main__':
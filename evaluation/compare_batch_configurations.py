@@ -0,0 +1,113 @@
+#!/usr/bin/python3
+
+'''
+Checks that cpp2c-batch --configurations writes the same facts as analyzing
+each configuration in a separate batch run.
+The given C files are analyzed once with all configurations, and once per
+configuration with its options added to their compile commands, and the
+output files of the two runs are compared byte for byte.
+'''
+
+import argparse
+import filecmp
+import glob
+import json
+import os
+import subprocess
+import sys
+import tempfile
+from typing import Dict, List
+
+
+def write_compile_commands(path: str, files: List[str],
+                           options: List[str]) -> None:
+    '''
+    Writes a compilation database that compiles each file in its directory
+    with the given options
+    '''
+    ccs = [{'directory': os.path.dirname(f),
+            'arguments': ['clang', '-c', os.path.basename(f)] + options,
+            'file': os.path.basename(f)}
+           for f in files]
+    with open(path, 'w') as fp:
+        json.dump(ccs, fp, indent=2)
+
+
+def run_batch(cpp2c_batch_path: str, args: List[str]) -> bool:
+    cmd = [cpp2c_batch_path] + args
+    result = subprocess.run(cmd, stdout=subprocess.DEVNULL,
+                            stderr=subprocess.PIPE, text=True)
+    if result.returncode != 0:
+        print(f'warning: {" ".join(cmd)} failed:\n{result.stderr}',
+              file=sys.stderr)
+    return result.returncode == 0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__)
+    ap.add_argument('cpp2c_batch_path', type=str)
+    ap.add_argument('configurations', type=str,
+                    help='JSON object mapping configuration names to lists '
+                         'of -D and -U options, e.g. '
+                         '\'{"default": [], "debug": ["-DDEBUG"]}\'')
+    ap.add_argument('files', type=str, nargs='*',
+                    help='C files to analyze (default: ../tests/*.c)')
+    ap.add_argument('--threads', type=int, default=os.cpu_count() or 1)
+    ap.add_argument('--dst-dir', type=str, default=None,
+                    help='directory to keep the outputs in (default: a '
+                         'temporary directory)')
+    ap.epilog = 'Plugin options for cpp2c-batch may follow --.'
+    argv = sys.argv[1:]
+    plugin_args = argv[argv.index('--') + 1:] if '--' in argv else []
+    args = ap.parse_args(argv[:len(argv) - len(plugin_args)])
+
+    configs: Dict[str, List[str]] = json.loads(args.configurations)
+    files = args.files or sorted(glob.glob(os.path.join(
+        os.path.dirname(os.path.abspath(__file__)), '..', 'tests', '*.c')))
+    files = [os.path.realpath(f) for f in files]
+    batch_path = os.path.abspath(args.cpp2c_batch_path)
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        dst_dir = os.path.abspath(args.dst_dir or tmp_dir)
+        os.makedirs(dst_dir, exist_ok=True)
+
+        configs_path = os.path.join(dst_dir, 'configurations.json')
+        with open(configs_path, 'w') as fp:
+            json.dump(configs, fp)
+        ccs_path = os.path.join(dst_dir, 'compile_commands.json')
+        write_compile_commands(ccs_path, files, [])
+        together_dir = os.path.join(dst_dir, 'together')
+        ok = run_batch(batch_path,
+                       ['--configurations', configs_path, ccs_path,
+                        together_dir, str(args.threads), '--'] + plugin_args)
+
+        print('Configuration,Files,Mismatches')
+        mismatches = 0
+        for name, options in configs.items():
+            separate_dir = os.path.join(dst_dir, 'separate', name)
+            os.makedirs(separate_dir, exist_ok=True)
+            ccs_path = os.path.join(separate_dir, 'compile_commands.json')
+            write_compile_commands(ccs_path, files, options)
+            ok = run_batch(batch_path,
+                           [ccs_path, os.path.join(separate_dir, 'out'),
+                            str(args.threads), '--'] + plugin_args) and ok
+
+            n = 0
+            for f in files:
+                relative = os.path.relpath(f, '/') + '.cpp2c'
+                together = os.path.join(together_dir, name, relative)
+                separate = os.path.join(separate_dir, 'out', relative)
+                if (os.path.isfile(together) != os.path.isfile(separate) or
+                        (os.path.isfile(together) and
+                         not filecmp.cmp(together, separate, shallow=False))):
+                    print(f'  {f}: output of configuration {name} differs',
+                          file=sys.stderr)
+                    n += 1
+            print(f'{name},{len(files)},{n}')
+            mismatches += n
+
+    exit(0 if ok and mismatches == 0 else 1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,142 @@
+#!/usr/bin/python3
+
+'''
+Measures how much time an option of the cpp2c plugin saves, and checks that
+it does not change cpp2c's results.
+Every translation unit of each program is analyzed twice, once without and
+once with the given plugin arguments, and the facts that the two runs emit
+are compared.
+'''
+
+import argparse
+import json
+import os
+import sys
+import time
+from collections import Counter
+from typing import Dict, List, Sequence, Tuple
+
+from analyze_macro_invocations_in_program import DELIM, CompileCommand, cpp2c
+from constants import EXTRACTED_PROGRAMS_DIR
+from evaluation_programs import PROGRAMS
+
+
+def load_facts(path: str, main_file: str | None) -> Counter:
+    '''
+    Returns the multiset of facts in the given cpp2c output file.
+    If main_file is given, only invocations in that file are kept.
+    '''
+    facts: Counter = Counter()
+    with open(path) as fp:
+        for line in fp:
+            kind, _, rest = line.rstrip('\n').partition(DELIM)
+            if kind == 'Src':
+                continue
+            if kind == 'Invocation':
+                invocation = json.loads(rest)
+                location = invocation.get('InvocationLocation', '')
+                if (main_file is not None and
+                        not location.startswith(main_file + ':')):
+                    continue
+                rest = json.dumps(invocation, sort_keys=True)
+            facts[(kind, rest)] += 1
+    return facts
+
+
+def analyze(cpp2c_so_path: str,
+            ccs: List[CompileCommand],
+            src_dir: str,
+            dst_dir: str,
+            plugin_args: Sequence[str]) -> Tuple[List[str], List[float]]:
+    '''
+    Runs cpp2c on each compile command one at a time, and returns the paths
+    of the output files and the time each run took in seconds
+    '''
+    os.makedirs(dst_dir, exist_ok=True)
+    dst_paths = [os.path.join(dst_dir, f'{j}.cpp2c') for j in range(len(ccs))]
+    times = []
+    i = [0]
+    for cc, dst_path in zip(ccs, dst_paths):
+        t0 = time.perf_counter()
+        failure = cpp2c(cpp2c_so_path, cc, src_dir, dst_path, i, len(ccs),
+                        plugin_args=plugin_args)
+        if failure is not None:
+            print(f'warning: analysis of {cc.file} failed', file=sys.stderr)
+        times.append(time.perf_counter() - t0)
+    return dst_paths, times
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__)
+    ap.add_argument('cpp2c_so_path', type=str)
+    ap.add_argument('plugin_args', type=str, nargs='+', metavar='plugin_arg',
+                    help='argument to pass to the cpp2c plugin, e.g. '
+                         'skip_unexpanded_bodies')
+    ap.add_argument('--program', action='append', default=[],
+                    dest='programs', metavar='NAME',
+                    help='only compare programs whose name contains NAME '
+                         '(may be repeated)')
+    ap.add_argument('--main-file-only', action='store_true',
+                    help='only compare invocations in the main file of each '
+                         'translation unit')
+    ap.add_argument('--dst-dir', type=str,
+                    default='./plugin_option_comparisons/')
+    args = ap.parse_args()
+
+    cpp2c_so_path = os.path.abspath(args.cpp2c_so_path)
+    dst_root = os.path.abspath(args.dst_dir)
+    extracted_programs_dir = os.path.abspath(EXTRACTED_PROGRAMS_DIR)
+
+    print('Program,TUs,BaselineTime,OptionTime,Speedup,Mismatches')
+    any_mismatch = False
+    for p in PROGRAMS:
+        if args.programs and not any(n in p.name for n in args.programs):
+            continue
+        p_extracted_path = os.path.join(extracted_programs_dir, p.name)
+        compile_commands_json_path = os.path.join(
+            p_extracted_path, 'compile_commands.json')
+        if not os.path.isfile(compile_commands_json_path):
+            print(f'warning: skipping {p.name}, compile_commands.json not found',
+                  file=sys.stderr)
+            continue
+        src_dir = os.path.join(p_extracted_path, p.src_dir)
+
+        with open(compile_commands_json_path) as fp:
+            ccs = [CompileCommand(**cc) for cc in json.load(fp)]
+        ccs = [cc for cc in ccs
+               if os.path.join(cc.directory, cc.file).startswith(src_dir)]
+
+        dst_dir = os.path.join(dst_root, p.name)
+        base_paths, base_times = analyze(
+            cpp2c_so_path, ccs, src_dir,
+            os.path.join(dst_dir, 'baseline'), [])
+        option_paths, option_times = analyze(
+            cpp2c_so_path, ccs, src_dir,
+            os.path.join(dst_dir, 'option'), args.plugin_args)
+
+        mismatches: Dict[str, int] = {}
+        for cc, base_path, option_path in zip(ccs, base_paths, option_paths):
+            main_file = (os.path.realpath(os.path.join(cc.directory, cc.file))
+                         if args.main_file_only else None)
+            base_facts = load_facts(base_path, main_file)
+            option_facts = load_facts(option_path, main_file)
+            n = sum(((base_facts - option_facts) +
+                     (option_facts - base_facts)).values())
+            if n:
+                mismatches[cc.file] = n
+
+        base_time = sum(base_times)
+        option_time = sum(option_times)
+        speedup = base_time / option_time if option_time else float('nan')
+        print(f'{p.name},{len(ccs)},{base_time:.3f},{option_time:.3f},'
+              f'{speedup:.2f},{sum(mismatches.values())}')
+        for file, n in mismatches.items():
+            print(f'  {file}: {n} facts differ', file=sys.stderr)
+        any_mismatch = any_mismatch or bool(mismatches)
+        sys.stdout.flush()
+
+    exit(1 if any_mismatch else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,129 @@
+#!/usr/bin/python3
+
+'''
+Merges the results of the shards of a program run, made with
+analyze_macro_invocations_in_program.py --shard=I/N, into one result as if
+the program had been analyzed by one run, and reports how long each shard
+took.
+Facts that several shards emit, such as the definitions of macros in
+headers that files of several shards include, are kept once.
+'''
+
+import argparse
+import hashlib
+import os
+import sys
+from typing import List
+
+from scheduling import DELIM, TimingLog
+
+RESULTS = 'all_results.cpp2c'
+TIMINGS = 'timings.tsv'
+FAILURES = 'failures.tsv'
+
+
+def merge_results(shard_dirs: List[str], dst_path: str) -> tuple[int, int]:
+    '''
+    Writes the distinct lines of the shards' combined results to dst_path,
+    each where it first occurs.
+    Since each definition precedes the invocations of its macro in each
+    shard, it still does so in the merged results.
+    Returns how many lines were read and how many were written.
+    '''
+    seen: set[bytes] = set()
+    read = written = 0
+    with open(dst_path, 'wb') as ofp:
+        for d in shard_dirs:
+            with open(os.path.join(d, RESULTS), 'rb') as fp:
+                for line in fp:
+                    read += 1
+                    digest = hashlib.blake2b(line, digest_size=16).digest()
+                    if digest in seen:
+                        continue
+                    seen.add(digest)
+                    ofp.write(line)
+                    written += 1
+    return read, written
+
+
+def merge_failures(shard_dirs: List[str], dst_path: str) -> List[int]:
+    '''
+    Writes the failures of all shards to dst_path under one header, and
+    returns how many files of each shard failed
+    '''
+    counts = []
+    header_written = False
+    with open(dst_path, 'w') as ofp:
+        for d in shard_dirs:
+            path = os.path.join(d, FAILURES)
+            count = 0
+            if os.path.isfile(path):
+                with open(path) as fp:
+                    header = fp.readline()
+                    if not header_written and header:
+                        ofp.write(header)
+                        header_written = True
+                    for line in fp:
+                        ofp.write(line)
+                        count += 1
+            counts.append(count)
+    return counts
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__)
+    ap.add_argument('shard_dirs', type=str, nargs='+', metavar='shard_dir',
+                    help='dst_dir of a shard run')
+    ap.add_argument('-o', '--output', type=str, required=True,
+                    dest='dst_dir', metavar='DST_DIR',
+                    help='directory to write the merged results to')
+    args = ap.parse_args()
+
+    missing = [d for d in args.shard_dirs
+               if not os.path.isfile(os.path.join(d, RESULTS))]
+    if missing:
+        print(f'error: no {RESULTS} in:', *missing, file=sys.stderr)
+        exit(1)
+
+    os.makedirs(args.dst_dir, exist_ok=True)
+    read, written = merge_results(
+        args.shard_dirs, os.path.join(args.dst_dir, RESULTS))
+    failures = merge_failures(
+        args.shard_dirs, os.path.join(args.dst_dir, FAILURES))
+
+    # a file analyzed by several shards, or several times by one, counts
+    # once with its last time
+    shard_timings = [TimingLog(os.path.join(d, TIMINGS)).timings
+                     for d in args.shard_dirs]
+    merged: dict[str, float] = {}
+    for timings in shard_timings:
+        merged.update(timings)
+    with open(os.path.join(args.dst_dir, TIMINGS), 'w') as ofp:
+        for file, seconds in merged.items():
+            print(f'{file}{DELIM}{seconds:.3f}', file=ofp)
+
+    print(DELIM.join(['Shard', 'Files', 'Failures', 'Seconds',
+                      'LongestFileSeconds']))
+    totals = []
+    for d, timings, n_failures in zip(args.shard_dirs, shard_timings, failures):
+        total = sum(timings.values())
+        longest = max(timings.values(), default=0.0)
+        totals.append(total)
+        print(DELIM.join([d, str(len(timings)), str(n_failures),
+                          f'{total:.3f}', f'{longest:.3f}']))
+    print(DELIM.join(['all', str(len(merged)), str(sum(failures)),
+                      f'{sum(merged.values()):.3f}',
+                      f'{max(merged.values(), default=0.0):.3f}']))
+
+    # the slowest shard bounds the run, so the shards are balanced when it
+    # takes about as long as the average one
+    mean = sum(totals) / len(totals)
+    imbalance = max(totals) / mean if mean > 0 else 1.0
+    print(f'slowest shard took {imbalance:.2f}x the mean shard time',
+          file=sys.stderr)
+    print(f'{written} / {read} result lines kept after removing duplicates',
+          file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,119 @@
+import os
+import threading
+import time
+
+DELIM = '\t'
+
+
+class RunJournal:
+    '''
+    Append-only journal of the files of a program run whose analyses have
+    finished, and of where their results are in the combined results file.
+
+    Each finished file's results are appended to the combined results file
+    as soon as it finishes, so the combined file never has to be rebuilt by
+    rereading every file. Both files are fsync'd periodically. A later run
+    with the same key resumes from the journal and skips the files it lists.
+
+    The journal's first line holds the key of the run, and every other line
+    holds, for one finished file, its index among the run's compile
+    commands, its status, the offset and length of its results in the
+    combined results file, and its path.
+    '''
+
+    def __init__(self,
+                 journal_path: str,
+                 results_path: str,
+                 key: str,
+                 fsync_interval: float = 10.0):
+        self.journal_path = journal_path
+        self.results_path = results_path
+        self.fsync_interval = fsync_interval
+        self.lock = threading.Lock()
+        # index of each finished file -> its status
+        self.finished: dict[int, str] = {}
+
+        lines = self._load(key)
+        self.resumed = lines is not None
+        if lines is None:
+            lines = [f'CompileCommands{DELIM}{key}\n']
+            open(results_path, 'w').close()
+
+        # rewrite the journal without entries whose results were lost, then
+        # append to it from now on
+        tmp_path = journal_path + '.tmp'
+        with open(tmp_path, 'w') as fp:
+            fp.writelines(lines)
+            fp.flush()
+            os.fsync(fp.fileno())
+        os.replace(tmp_path, journal_path)
+
+        self.journal = open(journal_path, 'a')
+        self.results = open(results_path, 'ab')
+        self.last_fsync = time.monotonic()
+
+    def _load(self, key: str) -> list[str] | None:
+        '''
+        Reads the entries of an existing journal with the given key, and
+        truncates the combined results file after the last entry whose
+        results were fully written.
+        Returns the journal lines to keep, or None if there is no journal
+        for this run.
+        '''
+        if not (os.path.isfile(self.journal_path) and
+                os.path.isfile(self.results_path)):
+            return None
+        with open(self.journal_path) as fp:
+            lines = fp.readlines()
+        if not lines or lines[0] != f'CompileCommands{DELIM}{key}\n':
+            return None
+
+        results_size = os.path.getsize(self.results_path)
+        end = 0
+        kept = lines[:1]
+        for line in lines[1:]:
+            fields = line.rstrip('\n').split(DELIM, 5)
+            if not line.endswith('\n') or len(fields) != 6:
+                break
+            _, index, status, offset, length, _ = fields
+            # results are appended in the same order as the entries
+            if int(offset) != end or end + int(length) > results_size:
+                break
+            end += int(length)
+            self.finished[int(index)] = status
+            kept.append(line)
+
+        with open(self.results_path, 'ab') as fp:
+            fp.truncate(end)
+        return kept
+
+    def record(self, index: int, status: str, file: str, dst_path: str) -> None:
+        '''
+        Appends the results of a finished file to the combined results file,
+        and records it in the journal
+        '''
+        with open(dst_path, 'rb') as fp:
+            data = fp.read()
+        with self.lock:
+            offset = self.results.tell()
+            self.results.write(data)
+            self.results.flush()
+            print(DELIM.join(['Done', str(index), status, str(offset),
+                              str(len(data)), file]),
+                  file=self.journal, flush=True)
+            self.finished[index] = status
+            if time.monotonic() - self.last_fsync >= self.fsync_interval:
+                self._fsync()
+
+    def _fsync(self) -> None:
+        # results first, so that the journal never lists results that
+        # could be lost
+        os.fsync(self.results.fileno())
+        os.fsync(self.journal.fileno())
+        self.last_fsync = time.monotonic()
+
+    def close(self) -> None:
+        with self.lock:
+            self._fsync()
+            self.results.close()
+            self.journal.close()
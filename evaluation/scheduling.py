@@ -0,0 +1,102 @@
+import os
+import sys
+import threading
+import time
+from datetime import timedelta
+from statistics import median
+
+DELIM = '\t'
+
+
+class TimingLog:
+    '''
+    Append-only log of how long the analysis of each file took, kept
+    alongside a program's results so that later runs can estimate costs.
+    When a file appears several times, its last time counts.
+    '''
+
+    def __init__(self, path: str):
+        self.path = path
+        self.lock = threading.Lock()
+        self.timings: dict[str, float] = {}
+        if os.path.isfile(path):
+            with open(path) as fp:
+                for line in fp:
+                    file, _, seconds = line.rstrip('\n').rpartition(DELIM)
+                    try:
+                        self.timings[file] = float(seconds)
+                    except ValueError:
+                        # e.g., a line cut short by an interruption
+                        continue
+
+    def record(self, file: str, seconds: float) -> None:
+        with self.lock:
+            self.timings[file] = seconds
+            with open(self.path, 'a') as fp:
+                print(f'{file}{DELIM}{seconds:.3f}', file=fp)
+
+
+def estimate_costs(files: list[str], timings: dict[str, float]) -> list[float]:
+    '''
+    Estimates how many seconds analyzing each file takes.
+    Files analyzed before cost as much as they did then. Other files cost in
+    proportion to their size, at the median rate of the files analyzed
+    before, or one second per megabyte if there are none.
+    '''
+    sizes = [os.path.getsize(f) if os.path.isfile(f) else 0 for f in files]
+    rates = [timings[f] / size
+             for f, size in zip(files, sizes)
+             if f in timings and size > 0]
+    seconds_per_byte = median(rates) if rates else 1e-6
+    return [timings[f] if f in timings else size * seconds_per_byte
+            for f, size in zip(files, sizes)]
+
+
+def longest_first(costs: list[float]) -> list[int]:
+    '''Returns the indices of the given costs from largest to smallest'''
+    return sorted(range(len(costs)), key=lambda j: (-costs[j], j))
+
+
+def partition(costs: list[float], num_shards: int) -> list[int]:
+    '''
+    Deterministically assigns each cost to one of num_shards shards, such
+    that the shards' total costs are balanced, and returns the shard of each.
+    Costs are assigned from largest to smallest to the shard with the least
+    total cost so far, preferring lower shards on ties.
+    '''
+    totals = [0.0] * num_shards
+    shards = [0] * len(costs)
+    for j in longest_first(costs):
+        shard = min(range(num_shards), key=lambda k: (totals[k], k))
+        shards[j] = shard
+        totals[shard] += costs[j]
+    return shards
+
+
+class ProgressReporter:
+    '''
+    Reports how many files have been analyzed, and estimates when all will
+    be, from the estimated cost of the files done so far
+    '''
+
+    def __init__(self, total_cost: float, n: int, done: int = 0):
+        self.total_cost = total_cost
+        self.n = n
+        self.done = done
+        self.done_cost = 0.0
+        self.start = time.monotonic()
+        self.lock = threading.Lock()
+
+    def file_done(self, cost: float) -> None:
+        with self.lock:
+            self.done += 1
+            self.done_cost += cost
+            elapsed = time.monotonic() - self.start
+            remaining = max(self.total_cost - self.done_cost, 0.0)
+            eta = (timedelta(seconds=round(remaining * elapsed / self.done_cost))
+                   if self.done_cost > 0 else 'unknown')
+            percent = (100 * self.done_cost / self.total_cost
+                       if self.total_cost > 0 else 100)
+            print(f'progress: {self.done} / {self.n} files, '
+                  f'{percent:.0f}% of estimated work, ETA {eta}',
+                  file=sys.stderr)
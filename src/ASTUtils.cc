@@ -1,5 +1,11 @@
 #include "ASTUtils.hh"
 
+#include "clang/AST/DeclCXX.h"
+
+#include "llvm/ADT/SmallPtrSet.h"
+
+#include <algorithm>
+
 namespace cpp2c
 {
     bool isInTree(
@@ -18,4 +24,114 @@ namespace cpp2c
 
         return false;
     }
+
+    std::vector<const clang::Decl *> collectDeclsOverlapping(
+        const TUOrder &TUO,
+        llvm::ArrayRef<const clang::Decl *> Decls,
+        const std::vector<clang::SourceRange> &Ranges)
+    {
+        auto &SM = TUO.getSourceManager();
+
+        // Key intervals of the ranges, sorted by their beginnings
+        std::vector<std::pair<uint64_t, uint64_t>> Intervals;
+        Intervals.reserve(Ranges.size());
+        bool AllOrdered = true;
+        for (auto &&R : Ranges)
+        {
+            auto B = TUO.getKey(SM.getExpansionLoc(R.getBegin()));
+            auto E = TUO.getKey(SM.getExpansionLoc(R.getEnd()));
+            if (!B || !E)
+            {
+                AllOrdered = false;
+                break;
+            }
+            Intervals.push_back({*B, *E});
+        }
+        std::sort(Intervals.begin(), Intervals.end());
+
+        // Running maximum of the interval ends
+        std::vector<uint64_t> MaxEnds;
+        MaxEnds.reserve(Intervals.size());
+        for (auto &&I : Intervals)
+            MaxEnds.push_back(MaxEnds.empty()
+                                  ? I.second
+                                  : std::max(MaxEnds.back(), I.second));
+
+        std::vector<const clang::Decl *> Result;
+        for (auto D : Decls)
+        {
+            if (!AllOrdered)
+            {
+                Result.push_back(D);
+                continue;
+            }
+
+            auto DR = D->getSourceRange();
+            auto B = TUO.getKey(SM.getExpansionLoc(DR.getBegin()));
+            auto E = TUO.getKey(SM.getExpansionLoc(DR.getEnd()));
+            if (!B || !E)
+            {
+                Result.push_back(D);
+                continue;
+            }
+
+            // Among the intervals beginning no later than this declaration
+            // ends, check if any ends no earlier than it begins
+            auto It = std::upper_bound(
+                Intervals.begin(), Intervals.end(), *E,
+                [](uint64_t K, const std::pair<uint64_t, uint64_t> &I)
+                { return K < I.first; });
+            auto N = It - Intervals.begin();
+            if (N > 0 && MaxEnds[N - 1] >= *B)
+                Result.push_back(D);
+        }
+        return Result;
+    }
+
+    // Returns the declarations directly inside the translation unit that
+    // clang's traversal of declaration contexts visits
+    static std::vector<const clang::Decl *> collectTopLevelDecls(
+        clang::ASTContext &Ctx)
+    {
+        std::vector<const clang::Decl *> Decls;
+        for (auto D : Ctx.getTranslationUnitDecl()->decls())
+        {
+            // Skip the same declarations that clang's traversal of
+            // declaration contexts skips
+            if (llvm::isa<clang::BlockDecl, clang::CapturedDecl>(D))
+                continue;
+            if (auto RD = llvm::dyn_cast<clang::CXXRecordDecl>(D))
+                if (RD->isLambda())
+                    continue;
+            Decls.push_back(D);
+        }
+        return Decls;
+    }
+
+    std::vector<const clang::Decl *> collectTopLevelDeclsOverlapping(
+        clang::ASTContext &Ctx,
+        const TUOrder &TUO,
+        const std::vector<clang::SourceRange> &Ranges)
+    {
+        return collectDeclsOverlapping(TUO, collectTopLevelDecls(Ctx), Ranges);
+    }
+
+    std::vector<const clang::Decl *> collectMainFileTopLevelDecls(
+        clang::ASTContext &Ctx,
+        const TUOrder &TUO,
+        const std::vector<clang::SourceRange> &Ranges)
+    {
+        auto &SM = Ctx.getSourceManager();
+        auto Decls = collectTopLevelDecls(Ctx);
+        auto Overlapping = collectDeclsOverlapping(TUO, Decls, Ranges);
+        llvm::SmallPtrSet<const clang::Decl *, 32> OverlappingSet(
+            Overlapping.begin(), Overlapping.end());
+
+        std::vector<const clang::Decl *> Result;
+        for (auto D : Decls)
+            if (OverlappingSet.count(D) ||
+                SM.isInMainFile(SM.getExpansionLoc(D->getBeginLoc())))
+                Result.push_back(D);
+        return Result;
+    }
 } // namespace cpp2c
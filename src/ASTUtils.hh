@@ -1,12 +1,44 @@
 #pragma once
 
+#include "TUOrder.hh"
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
 #include "clang/AST/Stmt.h"
 
+#include "llvm/ADT/ArrayRef.h"
+
 #include <functional>
+#include <vector>
 
 namespace cpp2c
 {
     bool isInTree(
         const clang::Stmt *ST,
         std::function<bool(const clang::Stmt *)> pred);
+
+    // Returns the given declarations, in order, whose expanded ranges
+    // overlap at least one of the given file ranges.
+    // Declarations and ranges that can not be ordered are conservatively
+    // treated as overlapping.
+    std::vector<const clang::Decl *> collectDeclsOverlapping(
+        const TUOrder &TUO,
+        llvm::ArrayRef<const clang::Decl *> Decls,
+        const std::vector<clang::SourceRange> &Ranges);
+
+    // Returns the declarations directly inside the translation unit, in
+    // traversal order, whose expanded ranges overlap at least one of the
+    // given file ranges
+    std::vector<const clang::Decl *> collectTopLevelDeclsOverlapping(
+        clang::ASTContext &Ctx,
+        const TUOrder &TUO,
+        const std::vector<clang::SourceRange> &Ranges);
+
+    // Returns the declarations directly inside the translation unit, in
+    // traversal order, which begin in the main file or whose expanded
+    // ranges overlap at least one of the given file ranges
+    std::vector<const clang::Decl *> collectMainFileTopLevelDecls(
+        clang::ASTContext &Ctx,
+        const TUOrder &TUO,
+        const std::vector<clang::SourceRange> &Ranges);
 } // namespace cpp2c
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Stmt.h"
+#include "clang/AST/TypeLoc.h"
+
+#include <cstddef>
+#include <set>
+#include <vector>
+
+namespace cpp2c
+{
+    // Nodes that an alignment matcher has aligned, so that it does not
+    // align their subtrees as well
+    struct MatchedNodes
+    {
+        std::set<const clang::Stmt *> Stmts; // Also includes Exprs
+        std::set<const clang::Decl *> Decls;
+        std::set<const clang::TypeLoc *> TypeLocs;
+
+        // If RecordRoots is set, the nodes whose subtrees are added to the
+        // sets are also appended here, so that the same subtrees can be
+        // added to another copy of the sets
+        bool RecordRoots = false;
+        std::vector<const clang::Stmt *> StmtRoots;
+        std::vector<const clang::Decl *> DeclRoots;
+
+        void clear()
+        {
+            Stmts.clear();
+            Decls.clear();
+            TypeLocs.clear();
+            StmtRoots.clear();
+            DeclRoots.clear();
+        }
+    };
+
+    // Nodes claimed by the alignment matchers while analyzing one
+    // translation unit, or one batch of code ranges.
+    // Each matcher keeps separate sets for each kind of node it matches.
+    // The sets hold pointers into the AST they were filled from, so they
+    // must be cleared or destroyed along with it.
+    struct AlignmentClaims
+    {
+        // Indexed by nodeKind
+        MatchedNodes Expansions[3];
+        MatchedNodes Arguments[3];
+        MatchedNodes Ranges[3];
+
+        static std::size_t nodeKind(const clang::Stmt *) { return 0; }
+        static std::size_t nodeKind(const clang::Decl *) { return 1; }
+        static std::size_t nodeKind(const clang::TypeLoc *) { return 2; }
+
+        // The sets of the expansion (0), argument (1) and range (2) matcher
+        MatchedNodes *matcherSets(std::size_t Matcher)
+        {
+            return Matcher == 0 ? Expansions
+                                : Matcher == 1 ? Arguments : Ranges;
+        }
+        const MatchedNodes *matcherSets(std::size_t Matcher) const
+        {
+            return const_cast<AlignmentClaims *>(this)->matcherSets(Matcher);
+        }
+
+        void recordRoots(bool Record)
+        {
+            for (auto *Sets : {Expansions, Arguments, Ranges})
+                for (std::size_t I = 0; I < 3; ++I)
+                    Sets[I].RecordRoots = Record;
+        }
+
+        void clear()
+        {
+            for (auto *Sets : {Expansions, Arguments, Ranges})
+                for (std::size_t I = 0; I < 3; ++I)
+                    Sets[I].clear();
+        }
+    };
+} // namespace cpp2c
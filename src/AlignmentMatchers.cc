@@ -1,6 +1,7 @@
 #include "AlignmentMatchers.hh"
 #include "ExpansionMatchHandler.hh"
 #include "Cpp2CASTConsumer.hh"
+#include "TriviaScanner.hh"
 #include <stack>
 
 namespace cpp2c
@@ -11,6 +12,7 @@ namespace cpp2c
         clang::SourceLocation A,
         clang::SourceLocation B,
         clang::ASTContext &Ctx,
+        FileTokenIndex &Tokens,
         bool useFileLoc = false)
     {
         const static bool debug = false;
@@ -49,6 +51,15 @@ namespace cpp2c
         if (Invalid)
             return false;
 
+        // Most gaps are only whitespace and comments
+        if (scanTrivia(Buffer.substr(OffsetA, OffsetB - OffsetA),
+                       LO.LineComment) == TriviaScanResult::OnlyTrivia)
+            return false;
+
+        // Answer from the file's token index if A is a token boundary
+        if (auto Res = Tokens.hasTokenIn(FileIDA, OffsetA, OffsetB))
+            return *Res;
+
         const char *BufBegin = Buffer.begin();
         const char *TokStart = BufBegin + OffsetA;
         const char *TokEnd = BufBegin + OffsetB;
@@ -98,7 +109,8 @@ namespace cpp2c
     static bool swallowSingleTrailingSemicolon(
         clang::SourceLocation &Pos,
         clang::SourceLocation Limit,
-        clang::ASTContext &Ctx)
+        clang::ASTContext &Ctx,
+        FileTokenIndex &Tokens)
     {
         auto &SM = Ctx.getSourceManager();
         auto &LO = Ctx.getLangOpts();
@@ -115,6 +127,15 @@ namespace cpp2c
         if (FileIDA != FileIDB || OffsetA >= OffsetB)
             return false;
 
+        // Answer from the file's token index if Pos is a token boundary
+        uint32_t SemiEnd;
+        if (auto Res = Tokens.findSemicolonAt(FileIDA, OffsetA, OffsetB, SemiEnd))
+        {
+            if (*Res)
+                Pos = SM.getComposedLoc(FileIDA, SemiEnd);
+            return *Res;
+        }
+
         bool Invalid = false;
         llvm::StringRef Buffer = SM.getBufferData(FileIDA, &Invalid);
         if (Invalid)
@@ -147,11 +168,13 @@ namespace cpp2c
         return false;
     }
 
-    void storeChildren(cpp2c::DeclStmtTypeLoc DSTL,
-                       std::set<const clang::Stmt *> &MatchedStmts,
-                       std::set<const clang::Decl *> &MatchedDecls,
-                       std::set<const clang::TypeLoc *> &MatchedTypeLocs)
+    void storeChildren(cpp2c::DeclStmtTypeLoc DSTL, MatchedNodes &Matched)
     {
+        if (Matched.RecordRoots && DSTL.ST)
+            Matched.StmtRoots.push_back(DSTL.ST);
+        else if (Matched.RecordRoots && DSTL.D)
+            Matched.DeclRoots.push_back(DSTL.D);
+
         if (DSTL.ST)
         {
             std::stack<const clang::Stmt *> Descendants;
@@ -165,7 +188,7 @@ namespace cpp2c
 
                 // llvm::errs() << "Inserting:\n";
                 // Cur->dumpColor();
-                MatchedStmts.insert(Cur);
+                Matched.Stmts.insert(Cur);
                 for (auto &&child : Cur->children())
                     if (child)
                         Descendants.push(child);
@@ -175,7 +198,7 @@ namespace cpp2c
         {
             // llvm::errs() << "Inserting:\n";
             // DSTL.D->dump();
-            MatchedDecls.insert(DSTL.D);
+            Matched.Decls.insert(DSTL.D);
         }
         // else if (DSTL.TL)
         // {
@@ -189,30 +212,23 @@ namespace cpp2c
         //     else
         //         llvm::errs() << "<Null type>\n";
         // }
-        //     MatchedTypeLocs.insert(DSTL.TL);
+        //     Matched.TypeLocs.insert(DSTL.TL);
         // }
     }
 
-    template <typename NodeT>
-    static std::vector<clang::DynTypedNode>
-    collectAncestors(const NodeT &Start, clang::ASTContext &Ctx)
-    {
-        std::vector<clang::DynTypedNode> Chain;
-        clang::DynTypedNodeList Parents = Ctx.getParents(Start);
-        while (!Parents.empty()) {
-            clang::DynTypedNode Parent = Parents[0];
-            Chain.push_back(Parent);
-            Parents = Ctx.getParents(Parent);
-        }
-        return Chain;
-    }
-
     void findAlignedASTNodesForExpansion(
         cpp2c::MacroExpansionNode *Exp,
-        clang::ASTContext &Ctx)
+        clang::ASTContext &Ctx,
+        const TUOrder &TUO,
+        const ParentTable &Parents,
+        FileTokenIndex &Tokens,
+        AlignmentClaims &Claims,
+        bool AlignArguments)
     {
         const static bool debug = false;
 
+        AlignmentContext Align{&Ctx, &Parents, &Claims};
+
         using namespace clang::ast_matchers;
         // Find AST nodes aligned with the entire invocation
 
@@ -223,7 +239,7 @@ namespace cpp2c
             auto Matcher = stmt(unless(anyOf(implicitCastExpr(),
                                              implicitValueInitExpr(),
                                              designatedInitExpr())),
-                                alignsWithExpansion(&Ctx, Exp))
+                                alignsWithExpansion(Align, Exp))
                                .bind("root");
             Finder.addMatcher(Matcher, &Handler);
             Finder.matchAST(Ctx);
@@ -235,7 +251,7 @@ namespace cpp2c
         {
             MatchFinder Finder;
             ExpansionMatchHandler Handler;
-            auto Matcher = decl(alignsWithExpansion(&Ctx, Exp))
+            auto Matcher = decl(alignsWithExpansion(Align, Exp))
                                .bind("root");
             Finder.addMatcher(Matcher, &Handler);
             Finder.matchAST(Ctx);
@@ -247,7 +263,7 @@ namespace cpp2c
         {
             MatchFinder Finder;
             ExpansionMatchHandler Handler;
-            auto Matcher = typeLoc(alignsWithExpansion(&Ctx, (Exp)))
+            auto Matcher = typeLoc(alignsWithExpansion(Align, Exp))
                                .bind("root");
             Finder.addMatcher(Matcher, &Handler);
             Finder.matchAST(Ctx);
@@ -282,41 +298,38 @@ namespace cpp2c
             bool IsDescendant = false;
             for (auto && PossibleAncestor : Exp->ASTRoots)
             {
-                for (auto Ancestor : collectAncestors(Child.getDynTypedNode(), Ctx))
+                if (Parents.isAncestor(PossibleAncestor.getDynTypedNode(),
+                                       Child.getDynTypedNode()))
                 {
-                    if (Ancestor == PossibleAncestor.getDynTypedNode())
+                    IsDescendant = true;
+                    if (debug)
                     {
-                        IsDescendant = true;
-                        if (debug)
-                        {
-                            llvm::errs() << "Descendant removed:\n";
-                            // Category
-                            if (Child.ST)
-                                llvm::errs() << "  Stmt: ";
-                            else if (Child.D)
-                                llvm::errs() << "  Decl: ";
-                            else if (Child.TL)
-                                llvm::errs() << "  TypeLoc: ";
-                            else
-                                llvm::errs() << "  Unknown: ";
-                            llvm::errs() << "  ";
-                            clang::PrintingPolicy Policy(Ctx.getLangOpts());
-                            Child.getDynTypedNode().print(llvm::errs(), Policy);
-                            llvm::errs() << "  is a descendant of:\n";
-                            // Category
-                            if (PossibleAncestor.ST)
-                                llvm::errs() << "  Stmt: ";
-                            else if (PossibleAncestor.D)
-                                llvm::errs() << "  Decl: ";
-                            else if (PossibleAncestor.TL)
-                                llvm::errs() << "  TypeLoc: ";
-                            else
-                                llvm::errs() << "  Unknown: ";
-                            llvm::errs() << "  ";
-                            PossibleAncestor.getDynTypedNode().print(llvm::errs(), Policy);
-                            llvm::errs() << "\n";
-                        }
-                        break;
+                        llvm::errs() << "Descendant removed:\n";
+                        // Category
+                        if (Child.ST)
+                            llvm::errs() << "  Stmt: ";
+                        else if (Child.D)
+                            llvm::errs() << "  Decl: ";
+                        else if (Child.TL)
+                            llvm::errs() << "  TypeLoc: ";
+                        else
+                            llvm::errs() << "  Unknown: ";
+                        llvm::errs() << "  ";
+                        clang::PrintingPolicy Policy(Ctx.getLangOpts());
+                        Child.getDynTypedNode().print(llvm::errs(), Policy);
+                        llvm::errs() << "  is a descendant of:\n";
+                        // Category
+                        if (PossibleAncestor.ST)
+                            llvm::errs() << "  Stmt: ";
+                        else if (PossibleAncestor.D)
+                            llvm::errs() << "  Decl: ";
+                        else if (PossibleAncestor.TL)
+                            llvm::errs() << "  TypeLoc: ";
+                        else
+                            llvm::errs() << "  Unknown: ";
+                        llvm::errs() << "  ";
+                        PossibleAncestor.getDynTypedNode().print(llvm::errs(), Policy);
+                        llvm::errs() << "\n";
                     }
                 }
             }
@@ -369,9 +382,9 @@ namespace cpp2c
                 }
                 else
                 {
-                    if (SM.isBeforeInTranslationUnit(B, MinBegin))
+                    if (TUO.isBefore(B, MinBegin))
                         MinBegin = B;
-                    if (SM.isBeforeInTranslationUnit(MaxEnd, E))
+                    if (TUO.isBefore(MaxEnd, E))
                         MaxEnd = E;
                 }
             }
@@ -379,8 +392,8 @@ namespace cpp2c
             // Convert MaxEnd to end-of-token
             clang::SourceLocation MaxEndEndTok = clang::Lexer::getLocForEndOfToken(MaxEnd, 0, SM, LO);
 
-            bool leadingExtra = hasNonCommentTokensBetween(MacroDefB, MinBegin, Ctx);
-            bool trailingExtra = hasNonCommentTokensBetween(MaxEndEndTok, MacroDefEEndTok, Ctx);
+            bool leadingExtra = hasNonCommentTokensBetween(MacroDefB, MinBegin, Ctx, Tokens);
+            bool trailingExtra = hasNonCommentTokensBetween(MaxEndEndTok, MacroDefEEndTok, Ctx, Tokens);
 
             if (leadingExtra || trailingExtra)
             {
@@ -445,6 +458,9 @@ namespace cpp2c
 
         //// Find AST nodes aligned with each of the expansion's arguments
 
+        if (!AlignArguments)
+            return;
+
         for (auto &&Arg : Exp->Arguments)
         {
             // Match stmts
@@ -453,7 +469,7 @@ namespace cpp2c
                 ExpansionMatchHandler Handler;
                 auto Matcher = stmt(unless(anyOf(implicitCastExpr(),
                                                  implicitValueInitExpr())),
-                                    isSpelledFromTokens(&Ctx, Arg.Tokens))
+                                    isSpelledFromTokens(Align, Arg.Tokens))
                                    .bind("root");
                 Finder.addMatcher(Matcher, &Handler);
                 Finder.matchAST(Ctx);
@@ -465,7 +481,7 @@ namespace cpp2c
             {
                 MatchFinder Finder;
                 ExpansionMatchHandler Handler;
-                auto Matcher = decl(isSpelledFromTokens(&Ctx, Arg.Tokens))
+                auto Matcher = decl(isSpelledFromTokens(Align, Arg.Tokens))
                                    .bind("root");
                 Finder.addMatcher(Matcher, &Handler);
                 Finder.matchAST(Ctx);
@@ -478,7 +494,7 @@ namespace cpp2c
                 MatchFinder Finder;
                 ExpansionMatchHandler Handler;
                 auto Matcher =
-                    typeLoc(isSpelledFromTokens(&Ctx, Arg.Tokens))
+                    typeLoc(isSpelledFromTokens(Align, Arg.Tokens))
                         .bind("root");
                 Finder.addMatcher(Matcher, &Handler);
                 Finder.matchAST(Ctx);
@@ -491,11 +507,17 @@ namespace cpp2c
     std::vector<DeclStmtTypeLoc> findAlignedASTNodesForCodeRange
     (
         const CodeRangeAnalysisTask & Task,
-        clang::ASTContext & Ctx
+        clang::ASTContext & Ctx,
+        const TUOrder & TUO,
+        const ParentTable & Parents,
+        FileTokenIndex & Tokens,
+        AlignmentClaims & Claims
     )
     {
         const static bool debug = false;
 
+        AlignmentContext Align{&Ctx, &Parents, &Claims};
+
         clang::SourceManager & SM = Ctx.getSourceManager();
 
         clang::SourceRange Range = Task.getSourceRange(SM);
@@ -511,7 +533,7 @@ namespace cpp2c
             auto Matcher = stmt(unless(anyOf(implicitCastExpr(),
                                              implicitValueInitExpr(),
                                              designatedInitExpr())),
-                                alignsWithRange(&Ctx, Range))
+                                alignsWithRange(Align, Range))
                                .bind("root");
             Finder.addMatcher(Matcher, &Handler);
             Finder.matchAST(Ctx);
@@ -523,7 +545,7 @@ namespace cpp2c
         {
             MatchFinder Finder;
             ExpansionMatchHandler Handler;
-            auto Matcher = decl(alignsWithRange(&Ctx, Range))
+            auto Matcher = decl(alignsWithRange(Align, Range))
                                .bind("root");
             Finder.addMatcher(Matcher, &Handler);
             Finder.matchAST(Ctx);
@@ -535,7 +557,7 @@ namespace cpp2c
         {
             MatchFinder Finder;
             ExpansionMatchHandler Handler;
-            auto Matcher = typeLoc(alignsWithRange(&Ctx, Range))
+            auto Matcher = typeLoc(alignsWithRange(Align, Range))
                                .bind("root");
             Finder.addMatcher(Matcher, &Handler);
             Finder.matchAST(Ctx);
@@ -551,41 +573,38 @@ namespace cpp2c
             bool IsDescendant = false;
             for (auto && PossibleAncestor : AlignedASTNodes)
             {
-                for (auto Ancestor : collectAncestors(Child.getDynTypedNode(), Ctx))
+                if (Parents.isAncestor(PossibleAncestor.getDynTypedNode(),
+                                       Child.getDynTypedNode()))
                 {
-                    if (Ancestor == PossibleAncestor.getDynTypedNode())
+                    IsDescendant = true;
+                    if (debug)
                     {
-                        IsDescendant = true;
-                        if (debug)
-                        {
-                            llvm::errs() << "Descendant removed:\n";
-                            // Category
-                            if (Child.ST)
-                                llvm::errs() << "  Stmt: ";
-                            else if (Child.D)
-                                llvm::errs() << "  Decl: ";
-                            else if (Child.TL)
-                                llvm::errs() << "  TypeLoc: ";
-                            else
-                                llvm::errs() << "  Unknown: ";
-                            llvm::errs() << "  ";
-                            clang::PrintingPolicy Policy(Ctx.getLangOpts());
-                            Child.getDynTypedNode().print(llvm::errs(), Policy);
-                            llvm::errs() << "  is a descendant of:\n";
-                            // Category
-                            if (PossibleAncestor.ST)
-                                llvm::errs() << "  Stmt: ";
-                            else if (PossibleAncestor.D)
-                                llvm::errs() << "  Decl: ";
-                            else if (PossibleAncestor.TL)
-                                llvm::errs() << "  TypeLoc: ";
-                            else
-                                llvm::errs() << "  Unknown: ";
-                            llvm::errs() << "  ";
-                            PossibleAncestor.getDynTypedNode().print(llvm::errs(), Policy);
-                            llvm::errs() << "\n";
-                        }
-                        break;
+                        llvm::errs() << "Descendant removed:\n";
+                        // Category
+                        if (Child.ST)
+                            llvm::errs() << "  Stmt: ";
+                        else if (Child.D)
+                            llvm::errs() << "  Decl: ";
+                        else if (Child.TL)
+                            llvm::errs() << "  TypeLoc: ";
+                        else
+                            llvm::errs() << "  Unknown: ";
+                        llvm::errs() << "  ";
+                        clang::PrintingPolicy Policy(Ctx.getLangOpts());
+                        Child.getDynTypedNode().print(llvm::errs(), Policy);
+                        llvm::errs() << "  is a descendant of:\n";
+                        // Category
+                        if (PossibleAncestor.ST)
+                            llvm::errs() << "  Stmt: ";
+                        else if (PossibleAncestor.D)
+                            llvm::errs() << "  Decl: ";
+                        else if (PossibleAncestor.TL)
+                            llvm::errs() << "  TypeLoc: ";
+                        else
+                            llvm::errs() << "  Unknown: ";
+                        llvm::errs() << "  ";
+                        PossibleAncestor.getDynTypedNode().print(llvm::errs(), Policy);
+                        llvm::errs() << "\n";
                     }
                 }
             }
@@ -627,9 +646,9 @@ namespace cpp2c
                 }
                 else
                 {
-                    if (SM.isBeforeInTranslationUnit(B, MinBegin))
+                    if (TUO.isBefore(B, MinBegin))
                         MinBegin = B;
-                    if (SM.isBeforeInTranslationUnit(MaxEnd, E))
+                    if (TUO.isBefore(MaxEnd, E))
                         MaxEnd = E;
                 }
             }
@@ -637,10 +656,10 @@ namespace cpp2c
             clang::SourceLocation MaxEndEndTok = clang::Lexer::getLocForEndOfToken(MaxEnd, 0, SM, LO);
             // Swallow a single trailing semicolon immediately following the
             // top-level node(s), if it exists within the range's end.
-            swallowSingleTrailingSemicolon(MaxEndEndTok, RangeEEndTok, Ctx);
+            swallowSingleTrailingSemicolon(MaxEndEndTok, RangeEEndTok, Ctx, Tokens);
 
-            bool leadingExtra = hasNonCommentTokensBetween(RangeB, MinBegin, Ctx, /*useFileLoc=*/true);
-            bool trailingExtra = hasNonCommentTokensBetween(MaxEndEndTok, RangeEEndTok, Ctx, /*useFileLoc=*/true);
+            bool leadingExtra = hasNonCommentTokensBetween(RangeB, MinBegin, Ctx, Tokens, /*useFileLoc=*/true);
+            bool trailingExtra = hasNonCommentTokensBetween(MaxEndEndTok, RangeEEndTok, Ctx, Tokens, /*useFileLoc=*/true);
 
             if (leadingExtra || trailingExtra)
             {
@@ -1,8 +1,12 @@
 #pragma once
 
+#include "AlignmentClaims.hh"
 #include "DeclStmtTypeLoc.hh"
 #include "MacroExpansionNode.hh"
 #include "Cpp2CASTConsumer.hh"
+#include "FileTokenIndex.hh"
+#include "ParentTable.hh"
+#include "TUOrder.hh"
 
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/Lex/Lexer.h"
@@ -14,10 +18,17 @@ namespace cpp2c
 {
     using namespace clang::ast_matchers;
 
-    void storeChildren(cpp2c::DeclStmtTypeLoc DSTL,
-                       std::set<const clang::Stmt *> &MatchedStmts,
-                       std::set<const clang::Decl *> &MatchedDecls,
-                       std::set<const clang::TypeLoc *> &MatchedTypeLocs);
+    void storeChildren(cpp2c::DeclStmtTypeLoc DSTL, MatchedNodes &Matched);
+
+    // What the alignment matchers look up nodes in, and the nodes they have
+    // claimed so far
+    struct AlignmentContext
+    {
+        clang::ASTContext *Ctx = nullptr;
+        // Only used by alignsWithExpansion
+        const cpp2c::ParentTable *Parents = nullptr;
+        cpp2c::AlignmentClaims *Claims = nullptr;
+    };
 
     // Matches all AST nodes that align perfectly with the body of the given
     // macro expansion.
@@ -28,9 +39,11 @@ namespace cpp2c
         AST_POLYMORPHIC_SUPPORTED_TYPES(clang::Decl,
                                         clang::Stmt,
                                         clang::TypeLoc),
-        clang::ASTContext *, Ctx,
+        cpp2c::AlignmentContext, Align,
         cpp2c::MacroExpansionNode *, Expansion)
     {
+        clang::ASTContext *Ctx = Align.Ctx;
+
         // Can't match an expansion with no tokens
         if (Expansion->DefinitionTokens.empty())
             return false;
@@ -46,11 +59,10 @@ namespace cpp2c
 
         // These sets keep track of nodes we have already matched,
         // so that we do not match their subtrees as well
-        static std::set<const clang::Stmt *> MatchedStmts; // Also includes Exprs, can be casted
-        static std::set<const clang::Decl *> MatchedDecls;
-        static std::set<const clang::TypeLoc *> MatchedTypeLocs;
-        // Note these are STATIC, so they will persist between invocations
-        // This matcher cannot be used twice in the same translation unit
+        auto &Matched = Align.Claims->Expansions[AlignmentClaims::nodeKind(&Node)];
+        auto &MatchedStmts = Matched.Stmts;
+        auto &MatchedDecls = Matched.Decls;
+        auto &MatchedTypeLocs = Matched.TypeLocs;
 
         // Collect a bunch of SourceLocation information up front that may be
         // useful later
@@ -339,7 +351,7 @@ namespace cpp2c
         // Check that this node is not a proper subtree of an aligned node
         // that we already found.
         bool foundParentBefore = false;
-        for (auto P : Ctx->getParents(Node))
+        for (auto P : Align.Parents->getParents(clang::DynTypedNode::create(Node)))
         {
             if (auto PST = P.template get<clang::Stmt>())
             {
@@ -368,7 +380,7 @@ namespace cpp2c
 
         // Store this node and its children in the set of aligned subtrees
         // we've found
-        storeChildren(DSTL, MatchedStmts, MatchedDecls, MatchedTypeLocs);
+        storeChildren(DSTL, Matched);
 
         if (debug)
         {
@@ -434,9 +446,11 @@ namespace cpp2c
         AST_POLYMORPHIC_SUPPORTED_TYPES(clang::Decl,
                                         clang::Stmt,
                                         clang::TypeLoc),
-        clang::ASTContext *, Ctx,
+        cpp2c::AlignmentContext, Align,
         std::vector<clang::Token>, Tokens)
     {
+        clang::ASTContext *Ctx = Align.Ctx;
+
         // First ensure that the token list is not empty, because if it is,
         // then of course it is impossible for a node to be spelled from an
         // empty token list.
@@ -464,9 +478,10 @@ namespace cpp2c
 
         // These sets keep track of nodes we have already matched,
         // so that we do not match their subtrees as well
-        static std::set<const clang::Stmt *> MatchedStmts;
-        static std::set<const clang::Decl *> MatchedDecls;
-        static std::set<const clang::TypeLoc *> MatchedTypeLocs;
+        auto &Matched = Align.Claims->Arguments[AlignmentClaims::nodeKind(&Node)];
+        auto &MatchedStmts = Matched.Stmts;
+        auto &MatchedDecls = Matched.Decls;
+        auto &MatchedTypeLocs = Matched.TypeLocs;
 
         static const constexpr bool debug = false;
 
@@ -616,7 +631,7 @@ namespace cpp2c
 
         // Store this node and its children in the set of aligned subtrees
         // we've found
-        storeChildren(DSTL, MatchedStmts, MatchedDecls, MatchedTypeLocs);
+        storeChildren(DSTL, Matched);
 
         return true;
     }
@@ -640,11 +655,7 @@ namespace cpp2c
 
         // These sets keep track of nodes we have already matched,
         // so that we do not match their subtrees as well
-        static std::set<const clang::Stmt *> MatchedStmts; // Also includes Exprs, can be casted
-        static std::set<const clang::Decl *> MatchedDecls;
-        static std::set<const clang::TypeLoc *> MatchedTypeLocs;
-        // Note these are STATIC, so they will persist between invocations
-        // This matcher cannot be used twice in the same translation unit
+        auto &Matched = Align.Claims->Ranges[AlignmentClaims::nodeKind(&Node)];
 
         // Collect a bunch of SourceLocation information up front that may be
         // useful later
@@ -691,18 +702,33 @@ namespace cpp2c
 
         // Store this node and its children in the set of aligned subtrees
         // we've found
-        storeChildren(DSTL, MatchedStmts, MatchedDecls, MatchedTypeLocs);
+        storeChildren(DSTL, Matched);
 
         return true;
     }
 
+    // Finds the AST nodes aligned with Exp and, if AlignArguments is
+    // true, with each of its arguments.
+    // Nodes aligned with earlier expansions of the translation unit, as
+    // recorded in Claims, are not aligned again.
     void findAlignedASTNodesForExpansion(
         cpp2c::MacroExpansionNode *Exp,
-        clang::ASTContext &Ctx);
-
+        clang::ASTContext &Ctx,
+        const TUOrder &TUO,
+        const ParentTable &Parents,
+        FileTokenIndex &Tokens,
+        AlignmentClaims &Claims,
+        bool AlignArguments = true);
+
+    // Finds the AST nodes aligned with the range of Task, other than those
+    // aligned with earlier ranges of the batch, as recorded in Claims
     std::vector<DeclStmtTypeLoc> findAlignedASTNodesForCodeRange
     (
         const CodeRangeAnalysisTask & Task,
-        clang::ASTContext & Ctx
+        clang::ASTContext & Ctx,
+        const TUOrder & TUO,
+        const ParentTable & Parents,
+        FileTokenIndex & Tokens,
+        AlignmentClaims & Claims
     );
 }
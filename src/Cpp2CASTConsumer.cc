@@ -1,19 +1,36 @@
 #include "Cpp2CASTConsumer.hh"
 #include "ASTUtils.hh"
+#include "DeclRangeIndex.hh"
 #include "DeclStmtTypeLoc.hh"
 #include "DeclCollectorMatchHandler.hh"
 #include "ExpansionMatchHandler.hh"
+#include "FileTokenIndex.hh"
+#include "FunctionBodyScanner.hh"
 #include "AlignmentMatchers.hh"
 #include "IncludeCollector.hh"
+#include "InvocationDedup.hh"
+#include "MacroSnapshot.hh"
 #include "Logging.hh"
+#include "NameIndex.hh"
+#include "ParentTable.hh"
+#include "PreprocessorFacts.hh"
+#include "ProgressFile.hh"
 #include "StmtCollectorMatchHandler.hh"
+#include "TUOrder.hh"
+#include "TypeInfoCache.hh"
+#include "WorkerPool.hh"
 
 #include "clang/Lex/Lexer.h"
 #include "clang/Lex/Preprocessor.h"
 #include "clang/ASTMatchers/ASTMatchers.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/FileSystem.h"
+
 #include <algorithm>
+#include <cstdint>
 #include <functional>
 #include <set>
 #include <queue>
@@ -64,29 +81,6 @@ namespace cpp2c
         return E;
     }
 
-    // Determine whether an expression is used as a standalone statement
-    // (e.g., "x++;" or "a = b;") rather than as an operand (e.g., return x;).
-    static bool isExprUsedAsStmt(const clang::Expr* E, clang::ASTContext& Ctx)
-    {
-        if (!E) return false;
-        auto parents = Ctx.getParents(*E);
-        if (parents.empty()) return false;
-
-        const clang::Stmt* P = parents[0].get<clang::Stmt>();
-        // Jump out of possible ExprWithCleanups
-        while (P && llvm::isa<clang::ExprWithCleanups>(P))
-        {
-            auto pp = Ctx.getParents(*P);
-            if (pp.empty()) break;
-            P = pp[0].get<clang::Stmt>();
-        }
-        if (!P) return false;
-
-        return llvm::isa<clang::CompoundStmt>(P)
-            || llvm::isa<clang::LabelStmt>(P)
-            || llvm::isa<clang::AttributedStmt>(P);
-    }
-
     // Returns true if LHS is a subtree of RHS via BFS
     bool inTree(const clang::Stmt *LHS, const clang::Stmt *RHS)
     {
@@ -112,155 +106,6 @@ namespace cpp2c
         return false;
     }
 
-    // Returns true if the given predicate returns true for any type
-    // contained in the given type
-    bool isInType(
-        const clang::Type *T,
-        clang::ASTContext &Ctx,
-        std::function<bool(const clang::Type *)> pred)
-    {
-        debug("Checking if T is a pointer type");
-        while (T && (T->isAnyPointerType() || T->isArrayType()))
-            if (T->isAnyPointerType())
-                T = T->getPointeeType().getTypePtrOrNull();
-            else if (T->isArrayType())
-                T = T->getBaseElementTypeUnsafe();
-
-        return pred(T);
-    }
-
-    clang::Decl *getTypeDeclOrNull(const clang::Type *T)
-    {
-        if (!T)
-            return nullptr;
-
-        if (auto TD = clang::dyn_cast<clang::TypedefType>(T))
-            return TD->getDecl();
-        else if (auto TD = clang::dyn_cast<clang::TagType>(T))
-            return TD->getDecl();
-        else if (auto ET = clang::dyn_cast<clang::ElaboratedType>(T))
-            return getTypeDeclOrNull(ET->desugar().getTypePtrOrNull());
-        else
-            return nullptr;
-    }
-
-    // Returns true if any type in T was defined after L
-    bool hasTypeDefinedAfter(
-        const clang::Type *T,
-        clang::ASTContext &Ctx,
-        clang::SourceLocation L)
-    {
-        auto &SM = Ctx.getSourceManager();
-        return isInType(
-            T,
-            Ctx,
-            [&SM, L](const clang::Type *T)
-            {
-                if (!T)
-                    return false;
-
-                auto *D = getTypeDeclOrNull(T);
-
-                if (!D)
-                    return false;
-
-                auto DLoc = D->getLocation();
-                if (DLoc.isInvalid())
-                    return false;
-
-                auto DFLoc = SM.getFileLoc(DLoc);
-                if (DFLoc.isInvalid())
-                    return false;
-
-                return SM.isBeforeInTranslationUnit(L, DFLoc);
-            });
-    }
-
-    // Returns true if any type in T is an anonymous type
-    bool hasAnonymousType(const clang::Type *T, clang::ASTContext &Ctx)
-    {
-        return isInType(
-            T,
-            Ctx,
-            [](const clang::Type *T)
-            {
-                if (!T)
-                    return false;
-
-                auto D = getTypeDeclOrNull(T);
-                if (!D)
-                    return false;
-
-                auto ND = clang::dyn_cast<clang::NamedDecl>(D);
-                if (!ND)
-                    return false;
-
-                return ND->getIdentifier() == nullptr || ND->getName().empty();
-            });
-    }
-
-    // Returns true if any type in T is a local type
-    bool hasLocalType(const clang::Type *T, clang::ASTContext &Ctx)
-    {
-        return isInType(
-            T,
-            Ctx,
-            [](const clang::Type *T)
-            {
-                if (!T)
-                    return false;
-
-                auto D = getTypeDeclOrNull(T);
-                if (!D)
-                    return false;
-
-                auto DCtx = D->getDeclContext();
-
-                return !DCtx->isTranslationUnit();
-            });
-    }
-
-    // Returns true if ST is a descendant of a Stmt which can only have
-    // subexpressions that are integral constants expressions
-    bool isDescendantOfStmtRequiringICE(clang::ASTContext &Ctx,
-                                        const clang::Stmt *ST)
-    {
-        if (!ST)
-            return false;
-
-        std::queue<clang::DynTypedNode> Q;
-        for (auto P : Ctx.getParents(*ST))
-            Q.push(P);
-        while (!Q.empty())
-        {
-            auto Cur = Q.front();
-            Q.pop();
-
-            if (Cur.get<clang::CaseStmt>() ||
-                Cur.get<clang::EnumDecl>())
-                return true;
-
-            if (auto FD = Cur.get<clang::FieldDecl>())
-                if (FD->isBitField())
-                    return true;
-
-            if (auto VD = Cur.get<clang::VarDecl>())
-            {
-                auto QT = VD->getType();
-                if (!QT.isNull())
-                {
-                    if (auto T = QT.getTypePtrOrNull())
-                        if (T->isArrayType())
-                            return true;
-                }
-            }
-
-            for (auto P : Ctx.getParents(Cur))
-                Q.push(P);
-        }
-        return false;
-    }
-
     std::pair<bool, std::string> tryGetLineColumn(clang::SourceManager &SM, clang::SourceLocation L)
     {
         auto FLoc = SM.getFileLoc(L);
@@ -297,145 +142,33 @@ namespace cpp2c
         return {false, "Invalid SLoc"};
     }
 
-    // Tries to get the full real path and line + column number for a given
-    // source location.
-    // First element is whether the operation was successful, the second
-    // is the error if not and the full path if successful.
-    std::pair<bool, std::string> tryGetFullSourceLoc(
-        clang::SourceManager &SM,
-        clang::SourceLocation L)
-    {
-        if (L.isValid())
-        {
-            auto FID = SM.getFileID(L);
-            if (FID.isValid())
-            {
-                if (auto FE = SM.getFileEntryForID(FID))
-                {
-                    auto Name = FE->tryGetRealPathName();
-                    if (!Name.empty())
-                    {
-                        auto FLoc = SM.getFileLoc(L);
-                        if (FLoc.isValid())
-                        {
-                            auto s = FLoc.printToString(SM);
-                            // Find second-to-last colon
-                            auto i = s.rfind(':', s.rfind(':') - 1);
-                            return {true, Name.str() + ":" + s.substr(i + 1)};
-                        }
-                        return {false, "Invalid File SLoc"};
-                    }
-                    return {false, "Nameless file"};
-                }
-                return {false, "File without FileEntry"};
-            }
-            return {false, "Invalid file ID"};
-        }
-        return {false, "Invalid SLoc"};
-    }
-
-    // Checks if the included file is a globally included file.
-    // The first element of the return result if false if not;
-    // true otherwise.
-    // The second element is the name of the included file.
-    std::pair<bool, llvm::StringRef> isGlobalInclude(
-        clang::SourceManager &SM,
-        const clang::LangOptions &LO,
-        std::pair<const clang::FileEntry *, clang::SourceLocation> &IEL,
-        std::set<llvm::StringRef> &LocalIncludes,
-        std::vector<const clang::Decl *> &Decls)
-    {
-        auto FE = IEL.first;
-        auto HashLoc = IEL.second;
-
-        // Check that the included file is not null
-        if (!FE)
-            return {false, "<null>"};
-
-        // Check that the included file actually has a name
-        auto IncludedFileRealpath = FE->tryGetRealPathName();
-        if (IncludedFileRealpath.empty())
-            return {false, IncludedFileRealpath};
-
-        // Check that the hash location is valid
-        if (HashLoc.isInvalid())
-            return {false, IncludedFileRealpath};
-
-        // Check that the file the file is included in is valid
-        auto IncludedInFID = SM.getFileID(HashLoc);
-        if (IncludedInFID.isInvalid())
-            return {false, IncludedFileRealpath};
-
-        // Check that a file entry exists for the  file the file is included in
-        auto IncludedInFE = SM.getFileEntryForID(IncludedInFID);
-        if (!IncludedInFE)
-            return {false, IncludedFileRealpath};
-
-        // Check that a real path exists for the file the file is included in
-        auto IncludedInRealpath = IncludedInFE->tryGetRealPathName();
-        if (IncludedInRealpath.empty())
-            return {false, IncludedFileRealpath};
-
-        // Check that the file the file is included in is not in turn included
-        // in a file included in a non-global scope
-        if (LocalIncludes.find(IncludedInRealpath) != LocalIncludes.end())
-            return {false, IncludedFileRealpath};
-
-        auto HashFLoc = SM.getFileLoc(HashLoc);
-        // Check that the file location is valid
-        if (HashFLoc.isInvalid())
-            return {false, IncludedFileRealpath};
-
-        // Check that the include does not appear within the range of any
-        // declaration in the file
-        if (std::any_of(
-                Decls.begin(),
-                Decls.end(),
-                [&SM, &LO, &HashFLoc](const clang::Decl *D)
-                {
-                    auto B = SM.getFileLoc(D->getBeginLoc());
-                    auto E = SM.getFileLoc(D->getEndLoc());
-
-                    if (B.isInvalid() || E.isInvalid())
-                        return false;
-
-                    // Include the location just after the declaration
-                    // to account for semicolons.
-                    // If the decl does not have semicolon after it,
-                    // that's fine since it would be a non-global
-                    // location anyway
-                    if (auto Tok = clang::Lexer::findNextToken(E, SM, LO))
-                        if (Tok.has_value())
-                            E = SM.getFileLoc(Tok.value().getEndLoc());
-
-                    if (E.isInvalid())
-                        return false;
-
-                    return clang::SourceRange(B, E).fullyContains(HashFLoc);
-                }))
-            return {false, IncludedFileRealpath};
-
-        // Success
-        return {true, IncludedFileRealpath};
-    }
-
     Cpp2CASTConsumer::Cpp2CASTConsumer
     (
         clang::CompilerInstance &CI,
-        std::vector<CodeRangeAnalysisTask> codeRangeAnalysisTasks
+        std::vector<CodeRangeAnalysisTask> codeRangeAnalysisTasks,
+        Cpp2COptions options
     )
+        : Context(CI.getASTContext()), options(options)
     {
         clang::Preprocessor &PP = CI.getPreprocessor();
         clang::ASTContext &Ctx = CI.getASTContext();
 
         MF = new cpp2c::MacroForest(PP, Ctx);
         IC = new cpp2c::IncludeCollector();
-        DC = new cpp2c::DefinitionInfoCollector(Ctx);
+        DC = new cpp2c::DefinitionInfoCollector();
 
         PP.addPPCallbacks(std::unique_ptr<cpp2c::MacroForest>(MF));
         PP.addPPCallbacks(std::unique_ptr<cpp2c::IncludeCollector>(IC));
         PP.addPPCallbacks(std::unique_ptr<cpp2c::DefinitionInfoCollector>(DC));
 
+        if (!options.dedupDir.empty())
+            Dedup = std::make_unique<InvocationDedup>(
+                CI.getSourceManager(), options.dedupDir);
+        if (!options.progressFile.empty())
+            Progress = std::make_unique<ProgressFile>(options.progressFile);
+        if (options.skipUnexpandedBodies)
+            BodyScanner = std::make_unique<FunctionBodyScanner>(PP);
+
         this->codeRangeAnalysisTasks = std::move(codeRangeAnalysisTasks);
     }
 
@@ -455,88 +188,184 @@ namespace cpp2c
         NLOHMANN_DEFINE_TYPE_INTRUSIVE(ArgInfo, Name, ASTKind, Type, ActualArgLocBegin, ActualArgLocEnd, IsLValue, ExpandedWhereModifiableValueRequired, ExpandedWhereAddressableValueRequired);
     };
 
-    void Cpp2CASTConsumer::HandleTranslationUnit(clang::ASTContext &Ctx)
-    {
-        using namespace nlohmann;
+    Cpp2CASTConsumer::~Cpp2CASTConsumer() = default;
 
-        auto &SM = Ctx.getSourceManager();
-        auto &LO = Ctx.getLangOpts();
+    // Returns the declarations in the current traversal scope
+    static std::vector<const clang::Decl *> collectDecls(clang::ASTContext &Ctx)
+    {
+        MatchFinder Finder;
+        DeclCollectorMatchHandler Handler;
+        auto Matcher = decl(unless(anyOf(
+                                isImplicit(),
+                                translationUnitDecl())))
+                           .bind("root");
+        Finder.addMatcher(Matcher, &Handler);
+        Finder.matchAST(Ctx);
+        return Handler.Decls;
+    }
 
-        // Print definition information
-        for (auto &&Entry : DC->MacroNamesDefinitions)
-        {
-            std::string Name = Entry.first,
-                        DefLocOrError;
-            bool Valid;
+    // Serializes the properties of an invocation
+    static std::string dumpFact(const nlohmann::ordered_json &Properties)
+    {
+        if (Debug)
+            return Properties.dump(4);
+        return Properties.dump();
+    }
 
-            auto MD = Entry.second;
-            auto DefLoc = MD ? SM.getFileLoc(MD->getDefinition().getLocation())
-                             : clang::SourceLocation();
-            Valid = DefLoc.isValid();
+    // Key of the type ordering checks that analyzeExpansion could not
+    // complete in incremental mode, because they involve tag types that
+    // were not defined yet. They are kept with the invocation's properties
+    // until the translation unit is complete.
+    static const char *const PendingTypeChecksKey = "PendingTypeChecks";
 
-            // Try to get the full path to the DefLoc
-            auto Res = tryGetFullSourceLoc(SM, DefLoc);
-            Valid &= Res.first;
-            DefLocOrError = Res.second;
+    // Redoes the pending type ordering checks of an invocation, now that
+    // the tag types are defined if they ever are, and removes them
+    static void redoPendingTypeChecks(nlohmann::ordered_json &Invocation,
+                                      TypeInfoCache &Types)
+    {
+        auto It = Invocation.find(PendingTypeChecksKey);
+        if (It == Invocation.end())
+            return;
+        auto DefLoc = clang::SourceLocation::getFromRawEncoding(
+            (*It)["DefinitionLocation"]
+                .get<clang::SourceLocation::UIntTy>());
+        for (auto &&Check : (*It)["Types"].items())
+            for (auto &&T : Check.value())
+                if (Types.hasTypeDefinedAfter(
+                        reinterpret_cast<const clang::Type *>(
+                            T.get<uintptr_t>()),
+                        DefLoc))
+                    Invocation[Check.key()] = true;
+        Invocation.erase(It);
+    }
 
-            auto MI = MD->getMacroInfo();
-            assert(MI);
+    // Returns the roots of the subtrees that Claims recorded since the last
+    // call, as [matcher, node kind, is declaration, node] arrays, and
+    // forgets them
+    static nlohmann::ordered_json takeClaimedRoots(AlignmentClaims &Claims)
+    {
+        auto Roots = nlohmann::ordered_json::array();
+        for (size_t M = 0; M < 3; ++M)
+            for (size_t K = 0; K < 3; ++K)
+            {
+                auto &Matched = Claims.matcherSets(M)[K];
+                for (auto ST : Matched.StmtRoots)
+                    Roots.push_back(nlohmann::ordered_json::array(
+                        {M, K, false, reinterpret_cast<uintptr_t>(ST)}));
+                for (auto D : Matched.DeclRoots)
+                    Roots.push_back(nlohmann::ordered_json::array(
+                        {M, K, true, reinterpret_cast<uintptr_t>(D)}));
+                Matched.StmtRoots.clear();
+                Matched.DeclRoots.clear();
+            }
+        return Roots;
+    }
 
-            print("Definition", Name, MI->isObjectLike(), Valid, DefLocOrError);
+    // Returns whether the matcher that claimed Root would have rejected it
+    // given Claims: Claims hold Root itself, or, for the expansion matcher,
+    // one of its parents
+    static bool isClaimRejected(const AlignmentClaims &Claims,
+                                const ParentTable &Parents,
+                                const nlohmann::ordered_json &Root)
+    {
+        auto M = Root[0].get<size_t>(), K = Root[1].get<size_t>();
+        auto &Matched = Claims.matcherSets(M)[K];
+        auto Address = Root[3].get<uintptr_t>();
+        clang::DynTypedNode Node;
+        if (Root[2].get<bool>())
+        {
+            auto D = reinterpret_cast<const clang::Decl *>(Address);
+            if (Matched.Decls.count(D))
+                return true;
+            Node = clang::DynTypedNode::create(*D);
         }
+        else
+        {
+            auto ST = reinterpret_cast<const clang::Stmt *>(Address);
+            if (Matched.Stmts.count(ST))
+                return true;
+            Node = clang::DynTypedNode::create(*ST);
+        }
+        if (M != 0)
+            return false;
+        for (auto P : Parents.getParents(Node))
+            if (auto PST = P.get<clang::Stmt>())
+            {
+                if (Matched.Stmts.count(PST))
+                    return true;
+            }
+            else if (auto PD = P.get<clang::Decl>())
+            {
+                if (Matched.Decls.count(PD))
+                    return true;
+            }
+        return false;
+    }
 
-        // Collect declaration ranges
-        std::vector<const clang::Decl *> TopLevelDecls =
-            ({
-                MatchFinder Finder;
-                DeclCollectorMatchHandler Handler;
-                auto Matcher = decl(unless(anyOf(
-                                        isImplicit(),
-                                        translationUnitDecl())))
-                                   .bind("root");
-                Finder.addMatcher(Matcher, &Handler);
-                Finder.matchAST(Ctx);
-                Handler.Decls;
-            });
+    // Adds the subtree of Root to the set that it was claimed in
+    static void addClaimedRoot(AlignmentClaims &Claims,
+                               const nlohmann::ordered_json &Root)
+    {
+        auto M = Root[0].get<size_t>(), K = Root[1].get<size_t>();
+        auto Address = Root[3].get<uintptr_t>();
+        if (Root[2].get<bool>())
+            storeChildren(reinterpret_cast<const clang::Decl *>(Address),
+                          Claims.matcherSets(M)[K]);
+        else
+            storeChildren(reinterpret_cast<const clang::Stmt *>(Address),
+                          Claims.matcherSets(M)[K]);
+    }
 
-        // Print names of macros inspected by the preprocessor
-        for (auto &&Name : DC->InspectedMacroNames)
-            print("InspectedByCPP", Name);
-        // Print include-directive information
+    void Cpp2CASTConsumer::prepareAnalysis()
+    {
+        auto &SM = Context.getSourceManager();
+        if (!Order)
         {
-            std::set<llvm::StringRef> LocalIncludes;
-            for (auto &&IEL : IC->IncludeEntriesLocs)
-            {
-                // Facts for includes
-                bool Valid = false;
-                std::string IncludeName = "";
+            // Order of file locations in this translation unit
+            Order = std::make_unique<TUOrder>(SM);
+            // Memoized type predicates
+            TypeInfo = std::make_unique<TypeInfoCache>(*Order);
+            // Raw tokens of files, for checking the edges of aligned nodes
+            FileTokens = std::make_unique<FileTokenIndex>(
+                SM, Context.getLangOpts());
+        }
+        else
+            Order->update();
+    }
 
-                // Check if included at global scope or not
-                auto Res = isGlobalInclude(SM, LO, IEL, LocalIncludes,
-                                           TopLevelDecls);
-                if (!Res.first)
-                    LocalIncludes.insert(Res.second);
+    void Cpp2CASTConsumer::addSkippedBodyNames()
+    {
+        for (auto &&[II, L] : SkippedBodyNames)
+            Names->addDeclarationName(II->getName(), L);
+        SkippedBodyNames.clear();
+    }
 
-                Valid = Res.first;
-                IncludeName = Res.second.empty() ? "" : Res.second.str();
+    void Cpp2CASTConsumer::printDefinitions()
+    {
+        // Options that make the facts less precise are printed once, after
+        // the first definitions, which batches of configurations move to
+        // the front of the facts they copy
+        NumPrintedDefinitions = cpp2c::printDefinitions(
+            Context.getSourceManager(), *DC, NumPrintedDefinitions);
+        if (!PrintedOptions && !options.alignArguments)
+            print("Option", "no_argument_alignment");
+        PrintedOptions = true;
+    }
 
-                print("Include", Valid, IncludeName);
-            }
-        }
-        debug("Finished checking includes");
+    void Cpp2CASTConsumer::analyzeExpansions(
+        size_t Begin,
+        size_t End,
+        const ParentTable &Parents,
+        llvm::function_ref<void(MacroExpansionNode *, nlohmann::ordered_json)>
+            Emit)
+    {
+        using namespace nlohmann;
 
-        if (IC->IncludeEntriesLocs.size() > 0 && codeRangeAnalysisTasks.size() > 0)
-        {
-            // Error and exit
-            llvm::errs() << "Code range analysis tasks should only be used on compilation"
-                          << " unit files without includes. Otherwise the line and column"
-                          << " numbers are ambiguous. Found "
-                          << IC->IncludeEntriesLocs.size()
-                          << " includes and "
-                          << codeRangeAnalysisTasks.size()
-                          << " code range analysis tasks.";
-            exit(1);
-        }
+        auto &Ctx = Context;
+        auto &SM = Ctx.getSourceManager();
+        auto &TUO = *Order;
+        auto &Types = *TypeInfo;
+        auto &Tokens = *FileTokens;
 
         // Collect certain sets of AST nodes that will be used for checking
         // whether properties are satisfied
@@ -672,13 +501,62 @@ namespace cpp2c
             {
                 auto E = clang::dyn_cast<clang::Expr>(ST);
                 auto QT = E->getType();
-                if (hasLocalType(QT.getTypePtrOrNull(), Ctx))
+                if (Types.hasLocalType(QT.getTypePtrOrNull()))
                     ExprsWithLocallyDefinedTypes.insert(E);
             }
         }
 
-        // Print macro expansion information
-        for (MacroExpansionNode * Exp : MF->Expansions)
+        // Latest definition of any macro expanded under each expansion,
+        // aggregated bottom-up.
+        // Parents are added to the forest before their children, so
+        // visiting expansions in reverse visits children first.
+        struct LatestDefinition
+        {
+            uint64_t MaxKey = 0;
+            // Whether any descendant has an ordered definition
+            bool Any = false;
+            // Whether some descendant's definition has no key
+            bool Unordered = false;
+        };
+        llvm::DenseMap<const MacroExpansionNode *, LatestDefinition>
+            LatestDescendantDefs;
+        LatestDescendantDefs.reserve(End - Begin);
+        for (auto It = MF->Expansions.rend() - End;
+             It != MF->Expansions.rend() - Begin;
+             ++It)
+        {
+            LatestDefinition Latest;
+            for (auto &&Child : (*It)->Children)
+            {
+                auto ChildLatest = LatestDescendantDefs.lookup(Child);
+                Latest.Unordered |= ChildLatest.Unordered;
+                if (ChildLatest.Any)
+                {
+                    Latest.MaxKey = Latest.Any
+                                        ? std::max(Latest.MaxKey,
+                                                   ChildLatest.MaxKey)
+                                        : ChildLatest.MaxKey;
+                    Latest.Any = true;
+                }
+
+                auto Key = TUO.getKey(
+                    SM.getFileLoc(Child->MI->getDefinitionLoc()));
+                if (!Key)
+                    Latest.Unordered = true;
+                else
+                {
+                    Latest.MaxKey = Latest.Any
+                                        ? std::max(Latest.MaxKey, *Key)
+                                        : *Key;
+                    Latest.Any = true;
+                }
+            }
+            LatestDescendantDefs[*It] = Latest;
+        }
+
+        // Computes the properties of an expansion and returns them as a
+        // JSON object
+        auto analyzeExpansion = [&](MacroExpansionNode *Exp) -> ordered_json
         {
             assert(Exp);
             assert(Exp->MI);
@@ -759,52 +637,11 @@ namespace cpp2c
             HasTokenPasting = Exp->HasTokenPasting;
 
             HasSameNameAsOtherDeclaration =
-                // First check if any macro defined before this macro has the
-                // same name as any of this macro's parameters
-                std::any_of(
-                    DC->MacroNamesDefinitions.begin(),
-                    DC->MacroNamesDefinitions.end(),
-                    [&SM, &Exp](std::pair<std::string,
-                                          const clang::MacroDirective *>
-                                    Entry)
-                    {
-                        return SM.isBeforeInTranslationUnit(
-                                   SM.getFileLoc(Entry.second
-                                                     ->getDefinition()
-                                                     .getLocation()),
-                                   SM.getFileLoc(Exp->MI
-                                                     ->getDefinitionLoc())) &&
-                               std::any_of(
-                                   Exp->Arguments.begin(),
-                                   Exp->Arguments.end(),
-                                   [&Entry](MacroExpansionArgument Arg)
-                                   {
-                                       return Arg.Name.str() == Entry.first;
-                                   });
-                    }) ||
-                // Also check if any global declarations defined before this macro
-                // have the same name as this macro
-                std::any_of(
-                    TopLevelDecls.begin(),
-                    TopLevelDecls.end(),
-                    [&SM, &Exp](const clang::Decl *D)
-                    {
-                        auto ND = clang::dyn_cast_or_null<clang::NamedDecl>(D);
-                        if (!ND)
-                            return false;
-                        auto II = ND->getIdentifier();
-                        if (!II)
-                            return false;
-                        return II->getName().str() == Exp->Name.str() &&
-                               SM.isBeforeInTranslationUnit(
-                                   SM.getFileLoc(D->getBeginLoc()),
-                                   SM.getFileLoc(Exp->MI->getDefinitionLoc()));
-                    });
+                Names->hasSameNameAsOtherDeclaration(Exp);
             IsObjectLike = Exp->MI->isObjectLike();
             IsInvokedInMacroArgument = Exp->InMacroArg;
             IsNamePresentInCPPConditional =
-                DC->InspectedMacroNames.find(Exp->Name.str()) !=
-                DC->InspectedMacroNames.end();
+                DC->InspectedMacroNames.count(Exp->II) > 0;
 
             // Definition location
             auto Res = tryGetFullSourceLoc(SM, Exp->MI->getDefinitionLoc());
@@ -834,23 +671,47 @@ namespace cpp2c
 
             auto DefLoc = SM.getFileLoc(Exp->MI->getDefinitionLoc());
 
+            // In incremental mode, a tag type that is not defined yet may
+            // still be defined after the macro. Such types are checked again
+            // once the translation unit is complete.
+            auto PendingTypes = ordered_json::object();
+            auto isTypeDefinedAfterMacro =
+                [&](const char *Property, const clang::Type *T)
+            {
+                if (options.incremental && Types.hasIncompleteTagType(T))
+                    PendingTypes[Property].push_back(
+                        reinterpret_cast<uintptr_t>(T));
+                return Types.hasTypeDefinedAfter(T, DefLoc);
+            };
+
             // Check if any macro this macro invokes were defined after
             // this macro was
-            auto Descendants = Exp->getDescendants();
-
-            DoesBodyReferenceMacroDefinedAfterMacro = std::any_of(
-                Descendants.begin(),
-                Descendants.end(),
-                [&SM, &Exp](MacroExpansionNode *Desc)
-                { return SM.isBeforeInTranslationUnit(
-                      SM.getFileLoc(Exp->MI->getDefinitionLoc()),
-                      SM.getFileLoc(Desc->MI->getDefinitionLoc())); });
+            {
+                auto Latest = LatestDescendantDefs.lookup(Exp);
+                auto Key = TUO.getKey(DefLoc);
+                if (Key && !Latest.Unordered)
+                    DoesBodyReferenceMacroDefinedAfterMacro =
+                        Latest.Any && *Key < Latest.MaxKey;
+                else
+                {
+                    auto Descendants = Exp->getDescendants();
+                    DoesBodyReferenceMacroDefinedAfterMacro = std::any_of(
+                        Descendants.begin(),
+                        Descendants.end(),
+                        [&SM, &TUO, &DefLoc](MacroExpansionNode *Desc)
+                        { return TUO.isBefore(
+                              DefLoc,
+                              SM.getFileLoc(Desc->MI->getDefinitionLoc())); });
+                }
+            }
 
             // Next get AST information for top level invocations
             if (Exp->Depth == 0 && !Exp->InMacroArg)
             {
                 debug("Top level invocation: ", Exp->Name.str());
-                cpp2c::findAlignedASTNodesForExpansion(Exp, Ctx);
+                cpp2c::findAlignedASTNodesForExpansion(Exp, Ctx, TUO, Parents, Tokens,
+                                                       ExpansionClaims,
+                                                       options.alignArguments);
 
                 //// Print macro info
 
@@ -878,7 +739,7 @@ namespace cpp2c
                         // Distinguish expression-statements from pure expressions
                         if (auto *E = clang::dyn_cast<clang::Expr>(ST))
                         {
-                            bool stmtLike = isExprUsedAsStmt(E, Ctx);
+                            bool stmtLike = Parents.isExprUsedAsStmt(E);
                             ASTKind = stmtLike ? "Stmt" : "Expr";
                         }
                         else
@@ -891,7 +752,7 @@ namespace cpp2c
                     {
                         // Allow only top-level decls
                         // Also requires parent being a TranslationUnitDecl
-                        clang::DynTypedNode Parent = Ctx.getParents(*D)[0];
+                        clang::DynTypedNode Parent = Parents.getParent(clang::DynTypedNode::create(*D));
                         if (Parent.get<clang::TranslationUnitDecl>())
                         {
                             ASTKind = "Decl";
@@ -916,7 +777,7 @@ namespace cpp2c
                         // full data on TypeLocs.
                         // debug("Checking hasTypeDefinedAfter");
                         // IsExpansionTypeDefinedAfterMacro = (!TL->isNull()) &&
-                        //     hasTypeDefinedAfter(TL->getTypePtr(), Ctx, DefLoc);
+                        //     Types.hasTypeDefinedAfter(TL->getTypePtr(), DefLoc);
                         // debug("Finished checking hasTypeDefinedAfter");
                     }
                     else
@@ -942,10 +803,10 @@ namespace cpp2c
                     {
                         assert(PossibleSTs.size() == NumASTRoots);
                         // All possible STs should share the same parent
-                        clang::DynTypedNode Parent = Ctx.getParents(*PossibleSTs[0])[0];
+                        clang::DynTypedNode Parent = Parents.getParent(clang::DynTypedNode::create(*PossibleSTs[0]));
                         for (const auto &ST : PossibleSTs)
                         {
-                            clang::DynTypedNode P = Ctx.getParents(*ST)[0];
+                            clang::DynTypedNode P = Parents.getParent(clang::DynTypedNode::create(*ST));
                             if (P != Parent)
                             {
                                 givenUpSTs = true;
@@ -976,7 +837,7 @@ namespace cpp2c
                     {
                         assert(PossibleDs.size() == NumASTRoots);
                         // All possible Ds should share the same parent (TranslationUnitDecl)
-                        clang::DynTypedNode Parent = Ctx.getParents(*PossibleDs[0])[0];
+                        clang::DynTypedNode Parent = Parents.getParent(clang::DynTypedNode::create(*PossibleDs[0]));
                         // Break if Parent is not a TranslationUnitDecl
                         if (!Parent.get<clang::TranslationUnitDecl>())
                         {
@@ -984,7 +845,7 @@ namespace cpp2c
                         }
                         for (const auto &D : PossibleDs)
                         {
-                            clang::DynTypedNode P = Ctx.getParents(*D)[0];
+                            clang::DynTypedNode P = Parents.getParent(clang::DynTypedNode::create(*D));
                             if (P != Parent)
                             {
                                 givenUpDs = true;
@@ -1001,30 +862,8 @@ namespace cpp2c
                 }
 
                 if (ASTKind == "Stmt" && !STs.empty())
-                {
-                    // Walk up the AST to see whether the statement lives inside a compound block
-                    const clang::Stmt *InvokedStmt = STs.front();
-                    const clang::Stmt *ParentStmt = nullptr;
-                    auto Parents = Ctx.getParents(*InvokedStmt);
-                    if (!Parents.empty())
-                        ParentStmt = Parents[0].get<clang::Stmt>();
-
-                    while (ParentStmt &&
-                           (llvm::isa<clang::ExprWithCleanups>(ParentStmt) ||
-                            llvm::isa<clang::AttributedStmt>(ParentStmt) ||
-                            llvm::isa<clang::LabelStmt>(ParentStmt)))
-                    {
-                        auto NextParents = Ctx.getParents(*ParentStmt);
-                        if (NextParents.empty())
-                        {
-                            ParentStmt = nullptr;
-                            break;
-                        }
-                        ParentStmt = NextParents[0].get<clang::Stmt>();
-                    }
-
-                    IsInvokedInStmtBlock = ParentStmt && llvm::isa<clang::CompoundStmt>(ParentStmt);
-                }
+                    // Check whether the statement lives inside a compound block
+                    IsInvokedInStmtBlock = Parents.isInStmtBlock(STs.front());
 
                 // Check that the number of AST nodes aligned with each argument
                 // equals the number of times that argument was expanded
@@ -1157,6 +996,7 @@ namespace cpp2c
                         AllDeclRefExprs.begin(),
                         AllDeclRefExprs.end(),
                         [&SM,
+                         &TUO,
                          &DefLoc,
                          &ExpandedFromBody](const clang::DeclRefExpr *DRE)
                         {
@@ -1165,8 +1005,7 @@ namespace cpp2c
                                 auto D = DRE->getDecl();
                                 auto DeclLoc = SM.getFileLoc(D->getLocation());
 
-                                return SM.isBeforeInTranslationUnit(DefLoc,
-                                                                    DeclLoc);
+                                return TUO.isBefore(DefLoc, DeclLoc);
                             }
                             return false;
                         });
@@ -1185,12 +1024,14 @@ namespace cpp2c
                         std::any_of(
                             StmtsExpandedFromBody.begin(),
                             StmtsExpandedFromBody.end(),
-                            [&Ctx, &DefLoc](const clang::Stmt *St)
+                            [&isTypeDefinedAfterMacro](const clang::Stmt *St)
                             {
                                 if (auto E = clang::dyn_cast<clang::Expr>(St))
                                 {
                                     auto QT = E->getType();
-                                    return hasTypeDefinedAfter(QT.getTypePtrOrNull(), Ctx, DefLoc);
+                                    return isTypeDefinedAfterMacro(
+                                        "DoesSubexpressionExpandedFromBodyHaveTypeDefinedAfterMacro",
+                                        QT.getTypePtrOrNull());
                                 }
                                 return false;
                             });
@@ -1200,7 +1041,7 @@ namespace cpp2c
                     IsHygienic = std::none_of(
                         DeclRefExprsOfLocallyDefinedDecls.begin(),
                         DeclRefExprsOfLocallyDefinedDecls.end(),
-                        [&STs, &SM, &ExpandedFromBody](const clang::DeclRefExpr *DRE)
+                        [&STs, &SM, &TUO, &ExpandedFromBody](const clang::DeclRefExpr *DRE)
                         {
                             // References that don't come from the macro's body
                             // are fine
@@ -1223,8 +1064,8 @@ namespace cpp2c
                                     }
                                     else
                                     {
-                                        if (SM.isBeforeInTranslationUnit(beginLoc, B)) B = beginLoc;
-                                        if (SM.isBeforeInTranslationUnit(E, endLoc)) E = endLoc;
+                                        if (TUO.isBefore(beginLoc, B)) B = beginLoc;
+                                        if (TUO.isBefore(E, endLoc)) E = endLoc;
                                     }
                                 }
                             }
@@ -1277,11 +1118,9 @@ namespace cpp2c
                             return false;
                         });
 
-                    // IsInvokedWhereICERequired =
-                    //     isDescendantOfStmtRequiringICE(Ctx, ST);
                     for (const auto & st : STs)
                     {
-                        if (isDescendantOfStmtRequiringICE(Ctx, st))
+                        if (Parents.isInICEContext(st))
                         {
                             IsInvokedWhereICERequired = true;
                             break;
@@ -1304,15 +1143,17 @@ namespace cpp2c
                         if (T)
                         {
                             IsExpansionTypeVoid = T->isVoidType();
-                            IsExpansionTypeAnonymous = hasAnonymousType(T, Ctx);
-                            IsExpansionTypeLocalType = hasLocalType(T, Ctx);
+                            IsExpansionTypeAnonymous = Types.hasAnonymousType(T);
+                            IsExpansionTypeLocalType = Types.hasLocalType(T);
                             auto CT = QT.getDesugaredType(Ctx)
                                           .getUnqualifiedType()
                                           .getCanonicalType();
                             TypeSignature = CT.getAsString();
                         }
                         IsExpansionTypeDefinedAfterMacro =
-                            hasTypeDefinedAfter(QT.getTypePtrOrNull(), Ctx, DefLoc);
+                            isTypeDefinedAfterMacro(
+                                "IsExpansionTypeDefinedAfterMacro",
+                                QT.getTypePtrOrNull());
 
                         // Whether this expression is an integral
                         // constant expression
@@ -1372,15 +1213,17 @@ namespace cpp2c
                         if (T)
                         {
                             IsAnyArgumentTypeVoid = T->isVoidType();
-                            IsAnyArgumentTypeAnonymous = hasAnonymousType(T, Ctx);
-                            IsAnyArgumentTypeLocalType = hasLocalType(T, Ctx);
+                            IsAnyArgumentTypeAnonymous = Types.hasAnonymousType(T);
+                            IsAnyArgumentTypeLocalType = Types.hasLocalType(T);
                             auto CT = QT.getDesugaredType(Ctx)
                                           .getUnqualifiedType()
                                           .getCanonicalType();
                             ArgTypeStr = CT.getAsString();
                         }
                         IsAnyArgumentTypeDefinedAfterMacro |=
-                            hasTypeDefinedAfter(QT.getTypePtrOrNull(), Ctx, DefLoc);
+                            isTypeDefinedAfterMacro(
+                                "IsAnyArgumentTypeDefinedAfterMacro",
+                                QT.getTypePtrOrNull());
 
                         TypeSignature += ArgTypeStr;
 
@@ -1526,15 +1369,304 @@ namespace cpp2c
 
             #undef ADD_PROPERTY
 
-            // Output the JSON object
-            if (Debug) {
-                print("Invocation", properties.dump(4));
-            } else {
-                print("Invocation", properties.dump());
+            if (!PendingTypes.empty())
+                properties[PendingTypeChecksKey] = {
+                    {"DefinitionLocation", DefLoc.getRawEncoding()},
+                    {"Types", std::move(PendingTypes)}};
+
+            return properties;
+        };
+
+        // Top-level expansions claimed by another translation unit are
+        // skipped along with their descendants, which directly follow them
+        std::vector<size_t> Analyzed;
+        if (Dedup)
+        {
+            std::vector<clang::SourceLocation> Locs;
+            for (size_t I = Begin; I < End; ++I)
+                if (MF->Expansions[I]->Depth == 0)
+                    Locs.push_back(
+                        MF->Expansions[I]->SpellingRange.getBegin());
+            auto Own = Dedup->claim(Locs);
+            size_t J = 0;
+            bool IsOwn = true;
+            for (size_t I = Begin; I < End; ++I)
+            {
+                if (MF->Expansions[I]->Depth == 0)
+                    IsOwn = Own[J++];
+                if (IsOwn)
+                    Analyzed.push_back(I);
+            }
+        }
+        else
+            for (size_t I = Begin; I < End; ++I)
+                Analyzed.push_back(I);
+
+        bool InWorker = false;
+        auto analyzeAndReport = [&](MacroExpansionNode *Exp)
+        {
+            if (Progress && Exp->Depth == 0)
+                Progress->update(
+                    Exp->Name.str() + "\t" +
+                    Exp->SpellingRange.getBegin().printToString(SM) + "\n");
+            auto Result = analyzeExpansion(Exp);
+            // A worker that has exited must not seem to be analyzing its
+            // last invocation
+            if (Progress && Exp->Depth == 0 && InWorker)
+                Progress->update("");
+            return Result;
+        };
+
+        // With several jobs, expansions are analyzed by forked copies of this
+        // process, and their results are emitted in the original order.
+        // Each worker reports its progress to a file of its own,
+        // <progress file>.<worker>.
+        // A worker only sees the nodes claimed by the alignment matchers for
+        // the expansions it analyzed itself, so it also sends back the nodes
+        // it claimed for each expansion. This process adds them to its own
+        // claims in the original order. An expansion for which a matcher
+        // claimed a node that it would have rejected given the claims of all
+        // earlier expansions is analyzed again here, so the results are those
+        // of a single process.
+        if (options.jobs > 1)
+        {
+            auto workerProgressFile = [&](unsigned W)
+            { return options.progressFile + "." + std::to_string(W); };
+            if (Progress)
+                Progress->update("");
+            auto Results = runInWorkers(
+                Analyzed.size(), options.jobs,
+                [&](size_t I)
+                {
+                    ordered_json Result;
+                    Result["Properties"] =
+                        analyzeAndReport(MF->Expansions[Analyzed[I]]);
+                    Result["Claims"] = takeClaimedRoots(ExpansionClaims);
+                    return Result.dump();
+                },
+                [&](unsigned W)
+                {
+                    InWorker = true;
+                    ExpansionClaims.recordRoots(true);
+                    if (Progress)
+                        Progress->reopen(workerProgressFile(W));
+                });
+            if (Progress)
+                for (unsigned W = 1; W <= options.jobs; ++W)
+                    llvm::sys::fs::remove(workerProgressFile(W));
+            for (size_t I = 0; I < Results.size(); ++I)
+            {
+                auto Exp = MF->Expansions[Analyzed[I]];
+                if (!Results[I])
+                {
+                    Emit(Exp, analyzeAndReport(Exp));
+                    continue;
+                }
+                // Workers send back serialized properties, which are read
+                // again so that deferred invocations can still be updated
+                auto Result = ordered_json::parse(*Results[I]);
+                auto &Claims = Result["Claims"];
+                if (std::any_of(Claims.begin(), Claims.end(),
+                                [&](const ordered_json &Root)
+                                {
+                                    return isClaimRejected(ExpansionClaims,
+                                                           Parents, Root);
+                                }))
+                {
+                    debug("Analyzing again:", Exp->Name.str());
+                    Emit(Exp, analyzeAndReport(Exp));
+                    continue;
+                }
+                for (auto &Root : Claims)
+                    addClaimedRoot(ExpansionClaims, Root);
+                Emit(Exp, std::move(Result["Properties"]));
             }
         }
+        else
+            for (auto I : Analyzed)
+                Emit(MF->Expansions[I], analyzeAndReport(MF->Expansions[I]));
+    }
+
+    void Cpp2CASTConsumer::analyzeCompleteExpansions(
+        clang::SourceLocation Limit)
+    {
+        auto &TUO = *Order;
+
+        // Expansions are complete once the parser is past them.
+        // Descendants directly follow their top-level expansion.
+        size_t End = NextExpansion;
+        std::vector<clang::SourceRange> Ranges;
+        for (; End < MF->Expansions.size(); ++End)
+        {
+            auto Exp = MF->Expansions[End];
+            if (Exp->Depth != 0)
+                continue;
+            if (Limit.isValid() &&
+                !TUO.isBefore(Exp->SpellingRange.getEnd(), Limit))
+                break;
+            Ranges.push_back(Exp->SpellingRange);
+        }
+        if (End == NextExpansion)
+            return;
+
+        // Analyze the expansions within the declarations they overlap
+        auto Scope = collectDeclsOverlapping(TUO, OpenDecls, Ranges);
+        std::vector<clang::Decl *> ScopeDecls;
+        for (auto D : Scope)
+            ScopeDecls.push_back(const_cast<clang::Decl *>(D));
+        Context.setTraversalScope(ScopeDecls);
+        ParentTable Parents(Context, Scope);
+
+        printDefinitions();
+        analyzeExpansions(
+            NextExpansion, End, Parents,
+            [this](MacroExpansionNode *Exp, nlohmann::ordered_json Invocation)
+            {
+                if (DC->InspectedMacroNames.count(Exp->II) &&
+                    !Invocation.contains(PendingTypeChecksKey))
+                    print("Invocation", dumpFact(Invocation));
+                else
+                    DeferredInvocations.push_back(
+                        {Exp->II, std::move(Invocation)});
+            });
+
+        MF->releaseExpansions(NextExpansion, End);
+        NextExpansion = End;
+
+        // Later expansions can only overlap the declarations which end
+        // after the next expansion begins
+        if (NextExpansion < MF->Expansions.size())
+        {
+            auto Next = MF->Expansions[NextExpansion]->SpellingRange.getBegin();
+            auto &SM = Context.getSourceManager();
+            llvm::erase_if(
+                OpenDecls,
+                [&](const clang::Decl *D)
+                { return TUO.isBefore(SM.getExpansionLoc(D->getEndLoc()),
+                                      Next); });
+        }
+        else
+            OpenDecls.clear();
+    }
+
+    bool Cpp2CASTConsumer::shouldSkipFunctionBody(clang::Decl *D)
+    {
+        if (!BodyScanner)
+            return false;
+
+        FunctionBodyScanner::Identifiers Ids;
+        auto Body = BodyScanner->findUnexpandedBody(D, Ids);
+        if (!Body)
+            return false;
+
+        // The parser may have cached the tokens of the body, and expanded
+        // macros in it that have been undefined since
+        auto &SM = Context.getSourceManager();
+        for (auto It = MF->Expansions.rbegin(); It != MF->Expansions.rend();
+             ++It)
+        {
+            auto Exp = *It;
+            if (!Exp)
+                break;
+            if (Exp->Depth != 0)
+                continue;
+            auto B = Exp->SpellingRange.getBegin();
+            if (B.isInvalid())
+                continue;
+            if (SM.isBeforeInTranslationUnit(B, Body->getBegin()))
+                break;
+            if (!SM.isBeforeInTranslationUnit(Body->getEnd(), B))
+                return false;
+        }
+
+        // Code ranges must still be aligned with the nodes in them
+        for (auto &&Task : codeRangeAnalysisTasks)
+        {
+            auto R = Task.getSourceRange(SM);
+            if (!SM.isBeforeInTranslationUnit(R.getEnd(), Body->getBegin()) &&
+                !SM.isBeforeInTranslationUnit(Body->getEnd(), R.getBegin()))
+                return false;
+        }
+
+        for (auto &&[II, L] : Ids)
+            SkippedBodyNames.try_emplace(II, L);
+        return true;
+    }
+
+    void Cpp2CASTConsumer::Initialize(clang::ASTContext &Ctx)
+    {
+        if (options.preambleSnapshot.empty())
+            return;
+
+        // The preprocessor skips the preamble, so load what it recorded
+        // when the preamble was built, before it records the rest of the
+        // main file
+        std::string Error;
+        auto &Reader = *static_cast<clang::ASTReader *>(Ctx.getExternalSource());
+        if (!readMacroSnapshot(options.preambleSnapshot, MF->PP, Reader,
+                               *MF, *DC, *IC, Error))
+        {
+            auto &Diags = Ctx.getDiagnostics();
+            Diags.Report(Diags.getCustomDiagID(
+                clang::DiagnosticsEngine::Error, "cpp2c: %0"))
+                << Error;
+            return;
+        }
+        // Otherwise the includes of the block would be attributed to the
+        // preamble's header, which only exists in memory
+        moveIncludesToMainFile(Ctx.getSourceManager(), Reader, *IC);
+    }
+
+    bool Cpp2CASTConsumer::HandleTopLevelDecl(clang::DeclGroupRef DG)
+    {
+        if (!options.incremental)
+            return true;
+
+        prepareAnalysis();
+        auto &SM = Context.getSourceManager();
+        if (!Names)
+            Names = std::make_unique<NameIndex>(
+                *Order, *DC, std::vector<const clang::Decl *>());
+        Names->addDefinitions(*DC);
+
+        // The expansions before these declarations can not overlap any
+        // declaration that has not been parsed yet
+        clang::SourceLocation Limit;
+        for (auto D : DG)
+        {
+            auto B = SM.getExpansionLoc(D->getBeginLoc());
+            if (B.isValid() &&
+                (Limit.isInvalid() || Order->isBefore(B, Limit)))
+                Limit = B;
+        }
+        if (Limit.isValid())
+            analyzeCompleteExpansions(Limit);
+
+        std::vector<clang::Decl *> Decls(DG.begin(), DG.end());
+        Context.setTraversalScope(Decls);
+        Names->addDecls(collectDecls(Context));
+        addSkippedBodyNames();
+        OpenDecls.insert(OpenDecls.end(), DG.begin(), DG.end());
+
+        Context.setTraversalScope({Context.getTranslationUnitDecl()});
+        return true;
+    }
 
-        for (CodeRangeAnalysisTask & Task : codeRangeAnalysisTasks)
+    void Cpp2CASTConsumer::analyzeCodeRanges(
+        llvm::ArrayRef<CodeRangeAnalysisTask> Tasks,
+        const ParentTable &Parents,
+        llvm::function_ref<void(std::string)> Emit)
+    {
+        using namespace nlohmann;
+
+        auto &Ctx = Context;
+        auto &SM = Ctx.getSourceManager();
+        auto &TUO = *Order;
+        auto &Tokens = *FileTokens;
+        // Each batch of ranges is aligned independently of earlier ones
+        AlignmentClaims RangeClaims;
+
+        for (const CodeRangeAnalysisTask &Task : Tasks)
         {
             llvm::errs() << "Analyzing code range: " << Task.getSourceRange(SM).printToString(SM) << "\n";
 
@@ -1562,7 +1694,7 @@ namespace cpp2c
             }
             else continue;
 
-            std::vector<DeclStmtTypeLoc> ASTRoots = findAlignedASTNodesForCodeRange(Task, Ctx);
+            std::vector<DeclStmtTypeLoc> ASTRoots = findAlignedASTNodesForCodeRange(Task, Ctx, TUO, Parents, Tokens, RangeClaims);
 
             std::vector<const clang::Stmt *> STs;
             std::vector<const clang::Decl *> Ds;
@@ -1605,7 +1737,7 @@ namespace cpp2c
                     // Distinguish expression-statements from pure expressions
                     if (auto *E = clang::dyn_cast<clang::Expr>(ST))
                     {
-                        bool stmtLike = isExprUsedAsStmt(E, Ctx);
+                        bool stmtLike = Parents.isExprUsedAsStmt(E);
                         ASTKind = stmtLike ? "Stmt" : "Expr";
                         // Only meaningful for pure expressions (not used as a statement)
                         if (!stmtLike)
@@ -1620,13 +1752,13 @@ namespace cpp2c
                     STs.push_back(ST);
 
                     // Parent location of this node
-                    auto Parents = Ctx.getParents(*ST);
-                    if (!Parents.empty())
+                    auto Parent = Parents.getParent(clang::DynTypedNode::create(*ST));
+                    if (!Parent.getNodeKind().isNone())
                     {
                         clang::SourceLocation PL;
-                        if (auto PS = Parents[0].get<clang::Stmt>())
+                        if (auto PS = Parent.get<clang::Stmt>())
                             PL = SM.getFileLoc(PS->getBeginLoc());
-                        else if (auto PD = Parents[0].get<clang::Decl>())
+                        else if (auto PD = Parent.get<clang::Decl>())
                             PL = SM.getFileLoc(PD->getBeginLoc());
                         if (PL.isValid())
                             ParentLocation = tryGetFullSourceLoc(SM, PL).second;
@@ -1642,7 +1774,7 @@ namespace cpp2c
                 {
                     // Allow only top-level decls
                     // Also requires parent being a TranslationUnitDecl
-                    clang::DynTypedNode Parent = Ctx.getParents(*D)[0];
+                    clang::DynTypedNode Parent = Parents.getParent(clang::DynTypedNode::create(*D));
                     if (Parent.get<clang::TranslationUnitDecl>())
                     {
                         ASTKind = "Decl";
@@ -1687,10 +1819,10 @@ namespace cpp2c
                 {
                     assert(PossibleSTs.size() == NumASTRoots);
                     // All possible STs should share the same parent
-                    clang::DynTypedNode Parent = Ctx.getParents(*PossibleSTs[0])[0];
+                    clang::DynTypedNode Parent = Parents.getParent(clang::DynTypedNode::create(*PossibleSTs[0]));
                     for (const auto &ST : PossibleSTs)
                     {
-                        clang::DynTypedNode P = Ctx.getParents(*ST)[0];
+                        clang::DynTypedNode P = Parents.getParent(clang::DynTypedNode::create(*ST));
                         if (P != Parent)
                         {
                             givenUpSTs = true;
@@ -1706,7 +1838,7 @@ namespace cpp2c
                     {
                         if (auto *E = clang::dyn_cast<clang::Expr>(S))
                         {
-                            if (!isExprUsedAsStmt(E, Ctx))
+                            if (!Parents.isExprUsedAsStmt(E))
                             {
                                 allAreStmtLike = false;
                                 break;
@@ -1719,7 +1851,7 @@ namespace cpp2c
                         STs = PossibleSTs;
 
                         // Common parent location
-                        auto Parent = Ctx.getParents(*STs[0])[0];
+                        auto Parent = Parents.getParent(clang::DynTypedNode::create(*STs[0]));
                         clang::SourceLocation PL;
                         if (auto PS = Parent.get<clang::Stmt>())
                             PL = SM.getFileLoc(PS->getBeginLoc());
@@ -1752,14 +1884,14 @@ namespace cpp2c
                 {
                     assert(PossibleDs.size() == NumASTRoots);
                     // All possible Ds should share the same parent (TranslationUnitDecl)
-                    clang::DynTypedNode Parent = Ctx.getParents(*PossibleDs[0])[0];
+                    clang::DynTypedNode Parent = Parents.getParent(clang::DynTypedNode::create(*PossibleDs[0]));
                     if (!Parent.get<clang::TranslationUnitDecl>())
                     {
                         givenUpDs = true;
                     }
                     for (const auto &D : PossibleDs)
                     {
-                        clang::DynTypedNode P = Ctx.getParents(*D)[0];
+                        clang::DynTypedNode P = Parents.getParent(clang::DynTypedNode::create(*D));
                         if (P != Parent)
                         {
                             givenUpDs = true;
@@ -1773,7 +1905,7 @@ namespace cpp2c
                     Ds = PossibleDs;
 
                     // Common parent location (likely TU)
-                    auto Parent = Ctx.getParents(*Ds[0])[0];
+                    auto Parent = Parents.getParent(clang::DynTypedNode::create(*Ds[0]));
                     clang::SourceLocation PL;
                     if (auto TU = Parent.get<clang::TranslationUnitDecl>())
                         PL = SM.getFileLoc(TU->getBeginLoc());
@@ -1805,16 +1937,183 @@ namespace cpp2c
 
             // Output the JSON object
             if (Debug) {
-                print("Range", properties.dump(4));
+                Emit(properties.dump(4));
             } else {
-                print("Range", properties.dump());
+                Emit(properties.dump());
+            }
+        }
+    }
+
+    bool Cpp2CASTConsumer::answerCodeRangeTasks(
+        llvm::ArrayRef<CodeRangeAnalysisTask> Tasks,
+        llvm::function_ref<void(std::string)> Emit)
+    {
+        if (!Order || !IC->IncludeEntriesLocs.empty())
+            return false;
+
+        auto &SM = Context.getSourceManager();
+        std::vector<clang::SourceRange> Ranges;
+        for (auto &&Task : Tasks)
+            Ranges.push_back(Task.getSourceRange(SM));
+        ParentTable Parents(
+            Context, collectTopLevelDeclsOverlapping(Context, *Order, Ranges));
+        analyzeCodeRanges(Tasks, Parents, Emit);
+        return true;
+    }
+
+    void Cpp2CASTConsumer::HandleTranslationUnit(clang::ASTContext &Ctx)
+    {
+        using namespace nlohmann;
+
+        auto &SM = Ctx.getSourceManager();
+        auto &LO = Ctx.getLangOpts();
+        auto &Diags = Ctx.getDiagnostics();
+
+        // The preprocessor did not run on a serialized AST, so load what
+        // it recorded when the AST was written
+        if (!options.readSnapshot.empty())
+        {
+            std::string Error;
+            if (!readMacroSnapshot(
+                    options.readSnapshot, MF->PP,
+                    *static_cast<clang::ASTReader *>(Ctx.getExternalSource()),
+                    *MF, *DC, *IC, Error))
+            {
+                Diags.Report(Diags.getCustomDiagID(
+                    clang::DiagnosticsEngine::Error, "cpp2c: %0"))
+                    << Error;
+                return;
             }
         }
 
-        // Only delete top level expansions since deconstructor deletes
-        // nested expansions
-        for (auto &&Exp : MF->Expansions)
-            if (Exp->Depth == 0)
-                delete Exp;
+        // All files have been entered by now
+        prepareAnalysis();
+        auto &TUO = *Order;
+
+        if (!options.writeSnapshot.empty())
+        {
+            std::string Error;
+            if (!writeMacroSnapshot(options.writeSnapshot, SM, *MF, *DC, *IC,
+                                    Error))
+                Diags.Report(Diags.getCustomDiagID(
+                    clang::DiagnosticsEngine::Error, "cpp2c: %0"))
+                    << Error;
+        }
+
+        // Code ranges are analyzed as they are queried, or only the
+        // snapshot was wanted
+        if (!options.analyzeTranslationUnit)
+        {
+            MF->releaseExpansions(0, MF->Expansions.size());
+            return;
+        }
+
+        // Print definition information
+        printDefinitions();
+
+        if (options.incremental)
+        {
+            // Analyze the expansions after the last declaration
+            if (!Names)
+                Names = std::make_unique<NameIndex>(
+                    TUO, *DC, std::vector<const clang::Decl *>());
+            Names->addDefinitions(*DC);
+            analyzeCompleteExpansions(clang::SourceLocation());
+            Ctx.setTraversalScope({Ctx.getTranslationUnitDecl()});
+        }
+
+        // Collect declaration ranges
+        std::vector<const clang::Decl *> TopLevelDecls = collectDecls(Ctx);
+
+        // Index macro and declaration names for name-clash checks
+        if (!Names)
+            Names = std::make_unique<NameIndex>(TUO, *DC, TopLevelDecls);
+        addSkippedBodyNames();
+
+        // Print names of macros inspected by the preprocessor
+        printInspectedMacroNames(*DC);
+        // Print include-directive information
+        {
+            DeclRangeIndex DeclRanges(SM, LO, TopLevelDecls);
+            printIncludes(SM, *IC,
+                          [&DeclRanges](clang::SourceLocation L)
+                          { return DeclRanges.contains(L); });
+        }
+        debug("Finished checking includes");
+
+        if (IC->IncludeEntriesLocs.size() > 0 && codeRangeAnalysisTasks.size() > 0)
+        {
+            // Error and exit
+            llvm::errs() << "Code range analysis tasks should only be used on compilation"
+                          << " unit files without includes. Otherwise the line and column"
+                          << " numbers are ambiguous. Found "
+                          << IC->IncludeEntriesLocs.size()
+                          << " includes and "
+                          << codeRangeAnalysisTasks.size()
+                          << " code range analysis tasks.";
+            exit(1);
+        }
+
+        // Parents and syntactic context of the nodes in top-level
+        // declarations that we may align with expansions or code ranges
+        std::vector<clang::SourceRange> AnalyzedRanges;
+        if (!options.incremental)
+            for (MacroExpansionNode *Exp : MF->Expansions)
+                if (Exp->Depth == 0 && !Exp->InMacroArg)
+                    AnalyzedRanges.push_back(Exp->SpellingRange);
+        for (CodeRangeAnalysisTask &Task : codeRangeAnalysisTasks)
+            AnalyzedRanges.push_back(Task.getSourceRange(SM));
+        ParentTable Parents(
+            Ctx, collectTopLevelDeclsOverlapping(Ctx, TUO, AnalyzedRanges));
+        debug("Parent table nodes:", std::to_string(Parents.size()),
+              "bytes:", std::to_string(Parents.getMemorySize()));
+
+        // Only let the analysis passes traverse the main file and the
+        // declarations that may be aligned with expansions or code ranges.
+        // Incremental analysis already restricts each batch this way.
+        if (options.mainFileScope && !options.incremental)
+        {
+            std::vector<clang::Decl *> ScopeDecls;
+            for (auto D : collectMainFileTopLevelDecls(Ctx, TUO, AnalyzedRanges))
+                ScopeDecls.push_back(const_cast<clang::Decl *>(D));
+            Ctx.setTraversalScope(ScopeDecls);
+            debug("Traversal scope decls:", std::to_string(ScopeDecls.size()));
+        }
+
+        // Print macro expansion information
+        if (options.incremental)
+        {
+            // The names of these macros could have been inspected after
+            // they were invoked
+            for (auto &&[II, Invocation] : DeferredInvocations)
+            {
+                if (DC->InspectedMacroNames.count(II))
+                    Invocation["IsNamePresentInCPPConditional"] = true;
+                redoPendingTypeChecks(Invocation, *TypeInfo);
+                print("Invocation", dumpFact(Invocation));
+            }
+            DeferredInvocations.clear();
+        }
+        else
+            analyzeExpansions(
+                0, MF->Expansions.size(), Parents,
+                [](MacroExpansionNode *, nlohmann::ordered_json Invocation)
+                { print("Invocation", dumpFact(Invocation)); });
+
+        analyzeCodeRanges(codeRangeAnalysisTasks, Parents,
+                          [](std::string Range)
+                          { print("Range", Range); });
+
+        MF->releaseExpansions(0, MF->Expansions.size());
+        if (options.mainFileScope)
+            Ctx.setTraversalScope({Ctx.getTranslationUnitDecl()});
+
+        // Other translation units may only skip the header invocations
+        // claimed here once their facts are out
+        if (Dedup && !Diags.hasErrorOccurred())
+        {
+            output()->flush();
+            Dedup->commit();
+        }
     }
 } // namespace cpp2c
@@ -2,6 +2,7 @@
 
 #include "json.hpp"
 
+#include "AlignmentClaims.hh"
 #include "MacroForest.hh"
 #include "IncludeCollector.hh"
 #include "DefinitionInfoCollector.hh"
@@ -9,6 +10,15 @@
 #include "clang/Frontend/ASTConsumers.h"
 #include "clang/Frontend/CompilerInstance.h"
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 namespace cpp2c
 {
     struct CodeRangeAnalysisTask
@@ -39,22 +49,151 @@ namespace cpp2c
         }
     };
 
+    class FileTokenIndex;
+    class FunctionBodyScanner;
+    class InvocationDedup;
+    class ProgressFile;
+    class NameIndex;
+    class ParentTable;
+    class TUOrder;
+    class TypeInfoCache;
+
+    struct Cpp2COptions
+    {
+        // Number of processes that analyze macro expansions
+        unsigned jobs = 1;
+        // Whether to analyze macro expansions while parsing, as soon as
+        // the top-level declarations they overlap have been parsed
+        bool incremental = false;
+        // Whether to skip parsing the bodies of functions in which no
+        // macro is expanded
+        bool skipUnexpandedBodies = false;
+        // Whether to restrict the traversals of the analyses to the main
+        // file's top-level declarations and the ones overlapping expansions
+        bool mainFileScope = false;
+        // Directory of the invocations in headers that the translation
+        // units of the program have claimed, or empty to analyze all
+        // invocations
+        std::string dedupDir;
+        // Whether to find the AST nodes aligned with macro arguments
+        bool alignArguments = true;
+        // File to write the invocation being analyzed to, or empty
+        std::string progressFile;
+        // File to write the macro snapshot of the translation unit to, to
+        // load along with its serialized AST later, or empty
+        std::string writeSnapshot;
+        // Macro snapshot to load instead of the facts that the preprocessor
+        // would record, when the input is a serialized AST, or empty
+        std::string readSnapshot;
+        // Macro snapshot of the precompiled preamble that the translation
+        // unit is parsed with, which the preprocessor does not run on, or
+        // empty
+        std::string preambleSnapshot;
+        // Whether to print the facts of the translation unit once it has
+        // been parsed, instead of only answering code range queries later
+        bool analyzeTranslationUnit = true;
+    };
+
     class Cpp2CASTConsumer : public clang::ASTConsumer
     {
     public:
         Cpp2CASTConsumer
         (
             clang::CompilerInstance &CI,
-            std::vector<CodeRangeAnalysisTask> codeRangeAnalysisTasks
+            std::vector<CodeRangeAnalysisTask> codeRangeAnalysisTasks,
+            Cpp2COptions options
         );
+        ~Cpp2CASTConsumer();
+        void Initialize(clang::ASTContext &Ctx) override;
+        bool HandleTopLevelDecl(clang::DeclGroupRef DG) override;
+        bool shouldSkipFunctionBody(clang::Decl *D) override;
         void HandleTranslationUnit(clang::ASTContext &Ctx) override;
 
+        // Analyzes the given code ranges of the parsed translation unit, and
+        // passes the properties of each to Emit in order.
+        // Returns false if the translation unit has includes, since the
+        // ranges' line and column numbers are then ambiguous.
+        bool answerCodeRangeTasks(
+            llvm::ArrayRef<CodeRangeAnalysisTask> Tasks,
+            llvm::function_ref<void(std::string)> Emit);
+
     private:
+        clang::ASTContext &Context;
         cpp2c::MacroForest *MF;
         cpp2c::IncludeCollector *IC;
         cpp2c::DefinitionInfoCollector *DC;
 
         std::vector<CodeRangeAnalysisTask> codeRangeAnalysisTasks;
+        Cpp2COptions options;
+
+        // Indices shared by the analyses of all expansions
+        std::unique_ptr<TUOrder> Order;
+        std::unique_ptr<TypeInfoCache> TypeInfo;
+        std::unique_ptr<NameIndex> Names;
+        std::unique_ptr<FileTokenIndex> FileTokens;
+        // Nodes aligned with the expansions analyzed so far
+        AlignmentClaims ExpansionClaims;
+
+        // Invocations in headers that other translation units analyze
+        std::unique_ptr<InvocationDedup> Dedup;
+        // Invocation being analyzed, for drivers to report crashes
+        std::unique_ptr<ProgressFile> Progress;
+        // Finds the function bodies that can be skipped
+        std::unique_ptr<FunctionBodyScanner> BodyScanner;
+        // First location of each identifier in a skipped function body that
+        // may name a declaration. The declarations in skipped bodies are
+        // not in the AST, so these names are taken to be declared there.
+        llvm::DenseMap<const clang::IdentifierInfo *, clang::SourceLocation>
+            SkippedBodyNames;
+
+        // Number of macro definitions printed so far
+        size_t NumPrintedDefinitions = 0;
+        // Whether the facts about the options have been printed
+        bool PrintedOptions = false;
+
+        // State of incremental analysis.
+        // Index of the first expansion that has not been analyzed
+        size_t NextExpansion = 0;
+        // Top-level declarations which may overlap expansions that have
+        // not been analyzed
+        std::vector<const clang::Decl *> OpenDecls;
+        // Invocations of macros whose names may still be inspected by a
+        // later preprocessor conditional
+        std::vector<
+            std::pair<const clang::IdentifierInfo *, nlohmann::ordered_json>>
+            DeferredInvocations;
+
+        // Creates the shared indices, or updates them with the files
+        // entered since
+        void prepareAnalysis();
+
+        // Records the names in the bodies skipped since the last call
+        void addSkippedBodyNames();
+
+        // Prints the macro definitions seen since the last call
+        void printDefinitions();
+
+        // Analyzes MF->Expansions[Begin, End), whose aligned nodes must be
+        // in the current traversal scope, and passes their properties to
+        // Emit in order.
+        // Expansions claimed by another translation unit are skipped.
+        void analyzeExpansions(
+            size_t Begin,
+            size_t End,
+            const ParentTable &Parents,
+            llvm::function_ref<void(MacroExpansionNode *,
+                                    nlohmann::ordered_json)> Emit);
+
+        // Analyzes the given code ranges, whose aligned nodes must be in
+        // Parents, and passes their properties to Emit in order
+        void analyzeCodeRanges(
+            llvm::ArrayRef<CodeRangeAnalysisTask> Tasks,
+            const ParentTable &Parents,
+            llvm::function_ref<void(std::string)> Emit);
+
+        // Analyzes and releases the expansions which end before Limit, or
+        // all remaining expansions if Limit is invalid
+        void analyzeCompleteExpansions(clang::SourceLocation Limit);
     };
 
     template <typename T>
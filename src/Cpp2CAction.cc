@@ -1,10 +1,14 @@
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <string>
+#include <thread>
 
 #include "Cpp2CAction.hh"
 #include "Cpp2CASTConsumer.hh"
 
+#include "clang/Lex/PreprocessorOptions.h"
+
 #include "json.hpp"
 
 namespace cpp2c
@@ -13,7 +17,61 @@ namespace cpp2c
     Cpp2CAction::CreateASTConsumer(clang::CompilerInstance &CI,
                                    llvm::StringRef InFile)
     {
-        return std::make_unique<cpp2c::Cpp2CASTConsumer>(CI, std::move(codeRangeAnalysisTasks));
+        if (options.skipUnexpandedBodies)
+        {
+            // Other consumers, such as code generation, need every body
+            auto &FO = CI.getFrontendOpts();
+            if (FO.ProgramAction == clang::frontend::ParseSyntaxOnly)
+                FO.SkipFunctionBodies = true;
+            else
+            {
+                auto &D = CI.getDiagnostics();
+                D.Report(D.getCustomDiagID(
+                    clang::DiagnosticsEngine::Warning,
+                    "cpp2c option '%0' requires -fsyntax-only; ignoring it"))
+                    << "skip_unexpanded_bodies";
+                options.skipUnexpandedBodies = false;
+            }
+        }
+        if (!options.readSnapshot.empty() &&
+            CI.getFrontendOpts().Inputs[0].getKind().getFormat() !=
+                clang::InputKind::Precompiled)
+        {
+            auto &D = CI.getDiagnostics();
+            D.Report(D.getCustomDiagID(
+                clang::DiagnosticsEngine::Error,
+                "cpp2c option '%0' requires a serialized AST as input"))
+                << "read_snapshot";
+            return std::make_unique<clang::ASTConsumer>();
+        }
+        if (!options.preambleSnapshot.empty() &&
+            (CI.getPreprocessorOpts().ImplicitPCHInclude.empty() ||
+             CI.getPreprocessorOpts().PrecompiledPreambleBytes.first == 0))
+        {
+            auto &D = CI.getDiagnostics();
+            D.Report(D.getCustomDiagID(
+                clang::DiagnosticsEngine::Error,
+                "cpp2c option '%0' requires a precompiled preamble"))
+                << "preamble_snapshot";
+            return std::make_unique<clang::ASTConsumer>();
+        }
+        if ((!options.writeSnapshot.empty() ||
+             !options.readSnapshot.empty() ||
+             !options.preambleSnapshot.empty()) &&
+            options.incremental)
+        {
+            // A snapshot holds every expansion, which incremental analysis
+            // releases as it goes, and the declarations of a serialized AST
+            // or preamble are not parsed incrementally
+            auto &D = CI.getDiagnostics();
+            D.Report(D.getCustomDiagID(
+                clang::DiagnosticsEngine::Warning,
+                "cpp2c option '%0' is incompatible with snapshots; "
+                "ignoring it"))
+                << "incremental";
+            options.incremental = false;
+        }
+        return std::make_unique<cpp2c::Cpp2CASTConsumer>(CI, std::move(codeRangeAnalysisTasks), options);
     }
 
     bool Cpp2CAction::ParseArgs(const clang::CompilerInstance &CI,
@@ -21,9 +79,112 @@ namespace cpp2c
     {
         // Allow an optional argument "<code_range_analysis_tasks_json_path>"
         static std::string optionName = "code_range_analysis_tasks_json_path";
+        // Allow an optional argument "jobs=<N>", where 0 means one job per
+        // hardware thread
+        static std::string jobsOptionName = "jobs";
+        // Allow an optional argument "incremental"
+        static std::string incrementalOptionName = "incremental";
+        // Allow an optional argument "skip_unexpanded_bodies"
+        static std::string skipBodiesOptionName = "skip_unexpanded_bodies";
+        // Allow an optional argument "main_file_scope"
+        static std::string mainFileScopeOptionName = "main_file_scope";
+        // Allow an optional argument "dedup_dir=<path>"
+        static std::string dedupDirOptionName = "dedup_dir";
+        // Allow an optional argument "no_argument_alignment"
+        static std::string noArgAlignmentOptionName = "no_argument_alignment";
+        // Allow an optional argument "progress_file=<path>"
+        static std::string progressFileOptionName = "progress_file";
+        // Allow an optional argument "write_snapshot=<path>"
+        static std::string writeSnapshotOptionName = "write_snapshot";
+        // Allow an optional argument "read_snapshot=<path>"
+        static std::string readSnapshotOptionName = "read_snapshot";
+        // Allow an optional argument "preamble_snapshot=<path>"
+        static std::string preambleSnapshotOptionName = "preamble_snapshot";
+        // Allow an optional argument "snapshot_only"
+        static std::string snapshotOnlyOptionName = "snapshot_only";
         codeRangeAnalysisTasks = {};
+        options = {};
         for (std::size_t i = 0; i < arg.size(); ++i)
         {
+            if (arg[i].find(jobsOptionName + "=") == 0)
+            {
+                llvm::StringRef jobsStr =
+                    llvm::StringRef(arg[i]).substr(jobsOptionName.size() + 1);
+                unsigned jobs;
+                if (jobsStr.getAsInteger(10, jobs))
+                {
+                    auto &D = CI.getDiagnostics();
+                    D.Report(D.getCustomDiagID(
+                        clang::DiagnosticsEngine::Error,
+                        "invalid value '%0' for cpp2c option '%1'"))
+                        << jobsStr << jobsOptionName;
+                    return false;
+                }
+                if (jobs == 0)
+                    jobs = std::max(1u, std::thread::hardware_concurrency());
+                options.jobs = jobs;
+                continue;
+            }
+            if (arg[i] == incrementalOptionName)
+            {
+                options.incremental = true;
+                continue;
+            }
+            if (arg[i] == skipBodiesOptionName)
+            {
+                options.skipUnexpandedBodies = true;
+                continue;
+            }
+            if (arg[i] == mainFileScopeOptionName)
+            {
+                options.mainFileScope = true;
+                continue;
+            }
+            if (arg[i] == noArgAlignmentOptionName)
+            {
+                options.alignArguments = false;
+                continue;
+            }
+            if (arg[i].find(progressFileOptionName + "=") == 0)
+            {
+                options.progressFile =
+                    arg[i].substr(progressFileOptionName.size() + 1);
+                continue;
+            }
+            if (arg[i].find(writeSnapshotOptionName + "=") == 0)
+            {
+                options.writeSnapshot =
+                    arg[i].substr(writeSnapshotOptionName.size() + 1);
+                continue;
+            }
+            if (arg[i].find(readSnapshotOptionName + "=") == 0)
+            {
+                options.readSnapshot =
+                    arg[i].substr(readSnapshotOptionName.size() + 1);
+                continue;
+            }
+            if (arg[i].find(preambleSnapshotOptionName + "=") == 0)
+            {
+                options.preambleSnapshot =
+                    arg[i].substr(preambleSnapshotOptionName.size() + 1);
+                continue;
+            }
+            if (arg[i] == snapshotOnlyOptionName)
+            {
+                options.analyzeTranslationUnit = false;
+                continue;
+            }
+            if (arg[i].find(dedupDirOptionName + "=") == 0)
+            {
+                options.dedupDir = arg[i].substr(dedupDirOptionName.size() + 1);
+                if (options.dedupDir.empty())
+                {
+                    CI.getDiagnostics().Report(clang::diag::err_cannot_open_file)
+                        << "Empty path provided for " << dedupDirOptionName;
+                    return false;
+                }
+                continue;
+            }
             if (arg[i].find(optionName + "=") != 0)
                 continue; // Not the option we are looking for
             // Extract the path from the argument
@@ -57,7 +218,6 @@ namespace cpp2c
                     << "Error reading JSON file: " << e.what();
                 return false;
             }
-            break;
         }
         return true;
     }
@@ -22,6 +22,7 @@ namespace cpp2c
         clang::PluginASTAction::ActionType getActionType() override;
 
         std::vector<CodeRangeAnalysisTask> codeRangeAnalysisTasks;
+        Cpp2COptions options;
     };
 
 } // namespace cpp2c
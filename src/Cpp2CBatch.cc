@@ -0,0 +1,1006 @@
+// Analyzes the translation units of a compilation database in one process,
+// on several threads, which share a cache of the statuses and contents of
+// the files they read, so that headers included by many translation units
+// are looked up and read once.
+// Built only when CPP2C_BUILD_BATCH is enabled.
+//
+// The facts of each translation unit are written to
+// <output_dir>/<absolute path of its file>.cpp2c, and how long each one
+// took to <output_dir>/timings.tsv, in the format that the Python driver's
+// --cost-file option reads.
+// Plugin options are given after "--", as they would be given to
+// -fplugin-arg-cpp2c-.
+//
+// With --share-preambles, translation units whose main files start with
+// the same block of #include directives, and that are compiled in the same
+// directory with the same options, are parsed with a precompiled preamble
+// of the block that is built once. The macro expansions, definitions and
+// includes that the preprocessor records in the preamble are loaded from a
+// snapshot written along with it, so the facts are those of a full parse.
+// A translation unit whose analysis with a preamble fails is analyzed
+// again without one. The header holding the block is not written to disk,
+// but added to the file systems of the translation units in their main
+// file's directory, so that its directives are looked up as they are in
+// the main file.
+// With --check-preambles <N>, up to N of the translation units parsed with
+// a preamble, spread across the batch, are also analyzed without one, and
+// the facts of the full parse are kept if they differ.
+//
+// With --configurations, each translation unit is analyzed once per
+// configuration, a list of -D and -U options appended to its command, and
+// the facts of each configuration are written under <output_dir>/<name>.
+// The translation unit is first preprocessed in each configuration, and
+// configurations whose preprocessed translation units have the same
+// fingerprint share one analysis, whose facts are copied with their own
+// definitions. The invocations whose facts differ between configurations
+// are written to <output_dir>/config_diff.cpp2c.
+
+#include "Logging.hh"
+#include "PreambleCache.hh"
+#include "SharedFileCache.hh"
+#include "TUFingerprint.hh"
+#include "json.hpp"
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/Lex/HeaderSearchOptions.h"
+#include "clang/Lex/PreprocessorOptions.h"
+#include "clang/Tooling/JSONCompilationDatabase.h"
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+    // Plugin options that name one file for the whole run, which the
+    // translation units of a batch can not share, that fork processes,
+    // which a multithreaded process must not do, or that the batch passes
+    // itself
+    const char *UnsupportedOptions[] = {
+        "jobs=",
+        "progress_file=",
+        "write_snapshot=",
+        "read_snapshot=",
+        "preamble_snapshot=",
+        "snapshot_only",
+        "code_range_analysis_tasks_json_path=",
+    };
+
+    // Warnings that Clang raises for code written for GCC, as the Python
+    // driver ignores them
+    const char *IgnoredWarnings[] = {
+        "-Wno-gnu-variable-sized-type-not-at-end",
+        "-Wno-tautological-constant-out-of-range-compare",
+        "-Wno-unused-but-set-variable",
+        "-Wno-initializer-overrides",
+    };
+
+    // Names that configurations can not have, as the files of the batch
+    // are written next to their directories
+    const char *ReservedNames[] = {
+        "preambles",
+        "timings.tsv",
+        "config_diff.cpp2c",
+    };
+
+    struct Result
+    {
+        bool Succeeded = false;
+        double Seconds = 0;
+    };
+
+    // Options that a translation unit is analyzed with in addition to those
+    // of its compile command
+    struct Configuration
+    {
+        std::string Name;
+        std::vector<std::string> Options;
+    };
+
+    // What analyzing a translation unit in one configuration depends on
+    struct Fingerprint
+    {
+        // Empty if the translation unit could not be preprocessed
+        std::string Digest;
+        std::string Definitions;
+        double Seconds = 0;
+    };
+
+    // Reads the configurations of a file holding a JSON object that maps
+    // each name to its options, in order, or returns false after writing an
+    // error
+    bool readConfigurations(llvm::StringRef Path,
+                            std::vector<Configuration> &Configs)
+    {
+        auto Buffer = llvm::MemoryBuffer::getFile(Path, /*IsText=*/true);
+        if (!Buffer)
+        {
+            llvm::errs() << "could not read " << Path << ": "
+                         << Buffer.getError().message() << "\n";
+            return false;
+        }
+        llvm::StringRef Text = (*Buffer)->getBuffer();
+        auto JSON = nlohmann::ordered_json::parse(Text.begin(), Text.end(),
+                                                  nullptr, false);
+        if (!JSON.is_object() || JSON.empty())
+        {
+            llvm::errs() << Path << ": configurations must be a non-empty "
+                                    "JSON object\n";
+            return false;
+        }
+        for (auto &&Item : JSON.items())
+        {
+            Configuration Config{Item.key(), {}};
+            llvm::StringRef Name(Config.Name);
+            if (Name.empty() || Name == "." || Name == ".." ||
+                Name.contains('/') ||
+                llvm::is_contained(ReservedNames, Name))
+            {
+                llvm::errs() << Path << ": invalid configuration name \""
+                             << Name << "\"\n";
+                return false;
+            }
+            if (!Item.value().is_array())
+            {
+                llvm::errs() << Path << ": the options of configuration "
+                             << Name << " must be an array\n";
+                return false;
+            }
+            // Only options that define macros are allowed, so that the
+            // configurations of a translation unit differ in nothing else
+            for (auto &&Option : Item.value())
+            {
+                if (!Option.is_string())
+                {
+                    llvm::errs() << Path << ": the options of configuration "
+                                 << Name << " must be strings\n";
+                    return false;
+                }
+                llvm::StringRef O = Option.get_ref<const std::string &>();
+                if (O.size() < 3 || !(O.startswith("-D") || O.startswith("-U")))
+                {
+                    llvm::errs() << Path << ": configuration " << Name
+                                 << " has option \"" << O
+                                 << "\", which is not of the form -D<macro> "
+                                    "or -U<macro>\n";
+                    return false;
+                }
+                Config.Options.push_back(O.str());
+            }
+            Configs.push_back(std::move(Config));
+        }
+        return true;
+    }
+
+    std::string outputPath(llvm::StringRef OutputDir, llvm::StringRef File)
+    {
+        llvm::SmallString<256> Path(OutputDir);
+        llvm::sys::path::append(Path, llvm::sys::path::relative_path(File));
+        Path += ".cpp2c";
+        return std::string(Path);
+    }
+
+    std::string absolutePath(const clang::tooling::CompileCommand &CC)
+    {
+        llvm::SmallString<256> File(CC.Filename);
+        llvm::sys::fs::make_absolute(CC.Directory, File);
+        llvm::sys::path::remove_dots(File);
+        return std::string(File);
+    }
+
+    // Returns the file system of a translation unit compiled in Directory
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>
+    createFileSystem(cpp2c::SharedFileCache &Cache,
+                     const std::string &Directory)
+    {
+        llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> Physical(
+            llvm::vfs::createPhysicalFileSystem().release());
+        Physical->setCurrentWorkingDirectory(Directory);
+        return llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>(
+            new cpp2c::CachingFileSystem(Cache, Physical));
+    }
+
+    // Returns the invocation that parses the translation unit of CC, or
+    // null after writing an error to DiagOS
+    std::shared_ptr<clang::CompilerInvocation>
+    createInvocation(const clang::tooling::CompileCommand &CC,
+                     llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS,
+                     llvm::raw_ostream &DiagOS)
+    {
+        std::vector<std::string> Arguments = CC.CommandLine;
+        Arguments.insert(Arguments.end(), std::begin(IgnoredWarnings),
+                         std::end(IgnoredWarnings));
+        Arguments.push_back("-fsyntax-only");
+        std::vector<const char *> Args;
+        for (auto &&A : Arguments)
+            Args.push_back(A.c_str());
+
+        // Arguments that only GCC knows are dropped, as the Python driver
+        // drops them, rather than failing the translation unit
+        clang::CreateInvocationOptions Opts;
+        Opts.VFS = FS;
+        Opts.RecoverOnError = true;
+        Opts.Diags = clang::CompilerInstance::createDiagnostics(
+            new clang::DiagnosticOptions(), new clang::IgnoringDiagConsumer());
+        std::shared_ptr<clang::CompilerInvocation> Invocation =
+            clang::createInvocation(Args, Opts);
+        if (!Invocation || Invocation->getFrontendOpts().Inputs.size() != 1)
+        {
+            DiagOS << "could not create a compiler invocation for one file\n";
+            return nullptr;
+        }
+        Invocation->getFileSystemOpts().WorkingDir = CC.Directory;
+        // The process parses many translation units
+        Invocation->getFrontendOpts().DisableFree = false;
+        return Invocation;
+    }
+
+    // Returns the path that the header of preamble P has in the file systems
+    // of the translation units whose main file is File
+    std::string preambleHeaderPath(llvm::StringRef File,
+                                   const cpp2c::PreambleCache::Preamble &P)
+    {
+        llvm::SmallString<256> Path(llvm::sys::path::parent_path(File));
+        llvm::sys::path::append(Path, P.HeaderName);
+        return std::string(Path);
+    }
+
+    // Returns FS with the header of preamble P, which holds the directives
+    // of Block, added in the directory of the main file File
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>
+    addPreambleHeader(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS,
+                      llvm::StringRef File,
+                      const cpp2c::PreambleCache::Preamble &P,
+                      const cpp2c::IncludeBlock &Block)
+    {
+        auto Path = preambleHeaderPath(File, P);
+        llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> Memory(
+            new llvm::vfs::InMemoryFileSystem());
+        // The same modification time each time, since the precompiled
+        // header records it
+        Memory->addFile(Path, /*ModificationTime=*/0,
+                        llvm::MemoryBuffer::getMemBufferCopy(Block.Directives,
+                                                             Path));
+        auto CWD = FS->getCurrentWorkingDirectory();
+        llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> Overlay(
+            new llvm::vfs::OverlayFileSystem(FS));
+        Overlay->pushOverlay(Memory);
+        if (CWD)
+            Overlay->setCurrentWorkingDirectory(*CWD);
+        return Overlay;
+    }
+
+    // Returns the include block that the main file of CC starts with, if
+    // the translation unit can be parsed with a preamble of it
+    std::optional<cpp2c::IncludeBlock>
+    findSharableBlock(const clang::tooling::CompileCommand &CC,
+                      const std::string &File,
+                      cpp2c::SharedFileCache &Cache)
+    {
+        auto FS = createFileSystem(Cache, CC.Directory);
+        auto Invocation = createInvocation(CC, FS, llvm::nulls());
+        if (!Invocation)
+            return std::nullopt;
+        // Files included with -include would be included again after the
+        // preamble
+        auto &PPOpts = Invocation->getPreprocessorOpts();
+        if (!PPOpts.Includes.empty() || !PPOpts.MacroIncludes.empty())
+            return std::nullopt;
+        auto Buffer = FS->getBufferForFile(File);
+        if (!Buffer)
+            return std::nullopt;
+        return cpp2c::findIncludeBlock((*Buffer)->getBuffer(),
+                                       Invocation->getLangOpts());
+    }
+
+    // Returns the key of the preamble of Block, which the translation units
+    // that have the same key can share
+    std::string preambleKey(const clang::tooling::CompileCommand &CC,
+                            llvm::StringRef File,
+                            const cpp2c::IncludeBlock &Block)
+    {
+        // Quoted includes are looked up in the main file's directory first
+        std::string Key = CC.Directory + '\0' +
+                          llvm::sys::path::parent_path(File).str();
+        // Arguments that name the input and outputs differ between
+        // translation units that share everything else
+        for (size_t I = 0; I < CC.CommandLine.size(); ++I)
+        {
+            llvm::StringRef A = CC.CommandLine[I];
+            if (A == CC.Filename)
+                continue;
+            if (A == "-o" || A == "-MF" || A == "-MT" || A == "-MQ")
+            {
+                ++I;
+                continue;
+            }
+            Key += '\0' + A.str();
+        }
+        Key += '\0' + Block.Directives;
+        return Key;
+    }
+
+    // Builds the precompiled preamble P of Block for the translation units
+    // like that of CC, writing its macro snapshot along with it
+    bool buildPreamble(const clang::tooling::CompileCommand &CC,
+                       llvm::StringRef File,
+                       const cpp2c::IncludeBlock &Block,
+                       const cpp2c::PreambleCache::Preamble &P,
+                       cpp2c::SharedFileCache &Cache,
+                       std::string &Diagnostics)
+    {
+        llvm::raw_string_ostream DiagOS(Diagnostics);
+
+        // Quoted includes in the header are looked up in the main file's
+        // directory, as they are in the main file
+        auto FS = addPreambleHeader(createFileSystem(Cache, CC.Directory),
+                                    File, P, Block);
+        auto Invocation = createInvocation(CC, FS, DiagOS);
+        if (!Invocation)
+            return false;
+        auto &FO = Invocation->getFrontendOpts();
+        FO.Inputs = {clang::FrontendInputFile(
+            preambleHeaderPath(File, P), FO.Inputs[0].getKind().getHeader())};
+        FO.ProgramAction = clang::frontend::GeneratePCH;
+        FO.OutputFile = P.PCHPath;
+        // The plugin only records what the preprocessor sees
+        FO.PluginArgs["cpp2c"] = {"write_snapshot=" + P.SnapshotPath,
+                                  "snapshot_only"};
+
+        clang::CompilerInstance CI;
+        CI.setInvocation(std::move(Invocation));
+        CI.createDiagnostics(
+            new clang::TextDiagnosticPrinter(DiagOS, &CI.getDiagnosticOpts()));
+        CI.createFileManager(FS);
+        clang::GeneratePCHAction Action;
+        return CI.ExecuteAction(Action) &&
+               !CI.getDiagnostics().hasErrorOccurred() &&
+               llvm::sys::fs::exists(P.SnapshotPath);
+    }
+
+    // Analyzes the translation unit of one compile command, writing its
+    // facts to OutputPath and its diagnostics to Diagnostics.
+    // If P is given, the include block Block that the main file starts
+    // with is parsed from it.
+    bool analyze(const clang::tooling::CompileCommand &CC,
+                 std::vector<std::string> PluginArgs,
+                 cpp2c::SharedFileCache &Cache,
+                 const std::string &OutputPath,
+                 const cpp2c::PreambleCache::Preamble *P,
+                 const cpp2c::IncludeBlock *Block,
+                 std::string &Diagnostics)
+    {
+        llvm::raw_string_ostream DiagOS(Diagnostics);
+
+        auto FS = createFileSystem(Cache, CC.Directory);
+        // The precompiled header records the header it was built from
+        if (P)
+            FS = addPreambleHeader(FS, absolutePath(CC), *P, *Block);
+        auto Invocation = createInvocation(CC, FS, DiagOS);
+        if (!Invocation)
+            return false;
+        Invocation->getFrontendOpts().ProgramAction =
+            clang::frontend::ParseSyntaxOnly;
+        if (P)
+        {
+            auto &PPOpts = Invocation->getPreprocessorOpts();
+            PPOpts.ImplicitPCHInclude = P->PCHPath;
+            PPOpts.PrecompiledPreambleBytes = {Block->Size, true};
+            PluginArgs.push_back("preamble_snapshot=" + P->SnapshotPath);
+        }
+        Invocation->getFrontendOpts().PluginArgs["cpp2c"] = PluginArgs;
+
+        std::error_code EC;
+        llvm::sys::fs::create_directories(
+            llvm::sys::path::parent_path(OutputPath));
+        llvm::raw_fd_ostream Out(OutputPath, EC, llvm::sys::fs::OF_Text);
+        if (EC)
+        {
+            DiagOS << "could not open " << OutputPath << ": " << EC.message()
+                   << "\n";
+            return false;
+        }
+
+        clang::CompilerInstance CI;
+        CI.setInvocation(std::move(Invocation));
+        CI.createDiagnostics(
+            new clang::TextDiagnosticPrinter(DiagOS, &CI.getDiagnosticOpts()));
+        CI.createFileManager(FS);
+
+        // The plugin's action is registered to run along with the main
+        // action, and prints to this thread's output
+        cpp2c::output() = &Out;
+        clang::SyntaxOnlyAction Action;
+        bool Succeeded = CI.ExecuteAction(Action) &&
+                         !CI.getDiagnostics().hasErrorOccurred();
+        cpp2c::output() = &llvm::outs();
+        return Succeeded;
+    }
+
+    // Preprocesses the translation unit of CC to compute its fingerprint
+    void fingerprint(const clang::tooling::CompileCommand &CC,
+                     cpp2c::SharedFileCache &Cache,
+                     Fingerprint &F)
+    {
+        auto Start = std::chrono::steady_clock::now();
+        auto FS = createFileSystem(Cache, CC.Directory);
+        if (auto Invocation = createInvocation(CC, FS, llvm::nulls()))
+        {
+            clang::CompilerInstance CI;
+            CI.setInvocation(std::move(Invocation));
+            CI.createDiagnostics(new clang::IgnoringDiagConsumer());
+            CI.createFileManager(FS);
+            cpp2c::TUFingerprintAction Action;
+            if (CI.ExecuteAction(Action) &&
+                !CI.getDiagnostics().hasErrorOccurred())
+            {
+                F.Digest = std::move(Action.Digest);
+                F.Definitions = std::move(Action.Definitions);
+            }
+        }
+        std::chrono::duration<double> Elapsed =
+            std::chrono::steady_clock::now() - Start;
+        F.Seconds = Elapsed.count();
+    }
+
+    // Returns whether the files at A and B could be read and are the same
+    bool sameContents(const std::string &A, const std::string &B)
+    {
+        auto BufferA = llvm::MemoryBuffer::getFile(A, /*IsText=*/true);
+        auto BufferB = llvm::MemoryBuffer::getFile(B, /*IsText=*/true);
+        return BufferA && BufferB &&
+               (*BufferA)->getBuffer() == (*BufferB)->getBuffer();
+    }
+
+    // Writes the facts in From to To, with the definitions replaced by
+    // Definitions
+    bool copyFacts(const std::string &From, const std::string &To,
+                   llvm::StringRef Definitions, std::string &Diagnostics)
+    {
+        llvm::raw_string_ostream DiagOS(Diagnostics);
+        auto Buffer = llvm::MemoryBuffer::getFile(From, /*IsText=*/true);
+        if (!Buffer)
+        {
+            DiagOS << "could not read " << From << ": "
+                   << Buffer.getError().message() << "\n";
+            return false;
+        }
+        std::error_code EC;
+        llvm::sys::fs::create_directories(llvm::sys::path::parent_path(To));
+        llvm::raw_fd_ostream Out(To, EC, llvm::sys::fs::OF_Text);
+        if (EC)
+        {
+            DiagOS << "could not open " << To << ": " << EC.message() << "\n";
+            return false;
+        }
+        // Unless it parses incrementally, the plugin prints the definitions
+        // before anything else
+        const std::string Prefix = std::string("Definition") + cpp2c::delim;
+        Out << Definitions;
+        llvm::StringRef Rest = (*Buffer)->getBuffer();
+        while (!Rest.empty())
+        {
+            llvm::StringRef Line;
+            std::tie(Line, Rest) = Rest.split('\n');
+            if (!Line.startswith(Prefix))
+                Out << Line << "\n";
+        }
+        return true;
+    }
+
+    // Writes the invocations of the translation unit in File whose facts
+    // differ between the configurations that it was analyzed in, or that
+    // only some of them have.
+    // Invocations are matched by name and location, and in order if
+    // several have the same.
+    void writeInvocationDiffs(llvm::raw_ostream &OS,
+                              const std::string &File,
+                              const std::vector<Configuration> &Configs,
+                              llvm::ArrayRef<std::string> OutputPaths)
+    {
+        using nlohmann::ordered_json;
+
+        const std::string Prefix = std::string("Invocation") + cpp2c::delim;
+        std::vector<std::string> Keys;
+        llvm::StringMap<std::vector<ordered_json>> Invocations;
+        std::vector<size_t> Analyzed;
+        for (size_t C = 0; C < Configs.size(); ++C)
+        {
+            if (OutputPaths[C].empty())
+                continue;
+            auto Buffer = llvm::MemoryBuffer::getFile(OutputPaths[C],
+                                                      /*IsText=*/true);
+            if (!Buffer)
+                continue;
+            Analyzed.push_back(C);
+            llvm::StringMap<unsigned> Occurrences;
+            llvm::StringRef Rest = (*Buffer)->getBuffer();
+            while (!Rest.empty())
+            {
+                llvm::StringRef Line;
+                std::tie(Line, Rest) = Rest.split('\n');
+                if (!Line.consume_front(Prefix))
+                    continue;
+                auto Invocation = ordered_json::parse(
+                    Line.begin(), Line.end(), nullptr, false);
+                if (!Invocation.is_object())
+                    continue;
+                std::string Key =
+                    Invocation.value("Name", "") + '\0' +
+                    Invocation.value("InvocationLocation", "") + '\0' +
+                    Invocation.value("InvocationLocationEnd", "");
+                Key += '\0' + std::to_string(Occurrences[Key]++);
+                auto &Values = Invocations[Key];
+                if (Values.empty())
+                {
+                    Values.resize(Configs.size());
+                    Keys.push_back(Key);
+                }
+                Values[C] = std::move(Invocation);
+            }
+        }
+        if (Analyzed.size() < 2)
+            return;
+
+        for (auto &&Key : Keys)
+        {
+            auto &Values = Invocations[Key];
+            ordered_json MissingIn = ordered_json::array();
+            const ordered_json *First = nullptr;
+            for (size_t C : Analyzed)
+                if (Values[C].is_null())
+                    MissingIn.push_back(Configs[C].Name);
+                else if (!First)
+                    First = &Values[C];
+
+            ordered_json Differences = ordered_json::object();
+            for (auto &&Property : First->items())
+            {
+                auto ValueIn = [&](size_t C)
+                {
+                    auto It = Values[C].find(Property.key());
+                    return It == Values[C].end() ? ordered_json() : *It;
+                };
+                bool Differs = false;
+                for (size_t C : Analyzed)
+                    if (!Values[C].is_null() && ValueIn(C) != Property.value())
+                        Differs = true;
+                if (!Differs)
+                    continue;
+                auto &ByConfig = Differences[Property.key()];
+                for (size_t C : Analyzed)
+                    if (!Values[C].is_null())
+                        ByConfig[Configs[C].Name] = ValueIn(C);
+            }
+            if (MissingIn.empty() && Differences.empty())
+                continue;
+
+            ordered_json Diff;
+            Diff["File"] = File;
+            Diff["Name"] = First->value("Name", "");
+            Diff["InvocationLocation"] =
+                First->value("InvocationLocation", "");
+            Diff["MissingIn"] = std::move(MissingIn);
+            Diff["Differences"] = std::move(Differences);
+            OS << "InvocationDiff" << cpp2c::delim << Diff.dump() << "\n";
+        }
+    }
+
+    // Calls Work with each index in [0, N) on up to Threads threads
+    void runOnThreads(size_t N, unsigned Threads,
+                      llvm::function_ref<void(size_t)> Work)
+    {
+        std::atomic<size_t> Next{0};
+        auto Worker = [&]()
+        {
+            for (size_t I = Next++; I < N; I = Next++)
+                Work(I);
+        };
+        std::vector<std::thread> Workers;
+        for (unsigned T = 1; T < Threads && T < N; ++T)
+            Workers.emplace_back(Worker);
+        Worker();
+        for (auto &&W : Workers)
+            W.join();
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::vector<llvm::StringRef> Positional;
+    std::vector<std::string> PluginArgs;
+    bool SharePreambles = false;
+    unsigned PreambleChecks = 0;
+    bool InvalidChecks = false;
+    llvm::StringRef ConfigurationsPath;
+    bool AfterDashes = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        llvm::StringRef Arg(argv[i]);
+        if (AfterDashes)
+            PluginArgs.push_back(Arg.str());
+        else if (Arg == "--")
+            AfterDashes = true;
+        else if (Arg == "--share-preambles")
+            SharePreambles = true;
+        else if (Arg == "--check-preambles" && i + 1 < argc)
+            InvalidChecks = llvm::StringRef(argv[++i]).getAsInteger(
+                10, PreambleChecks);
+        else if (Arg == "--configurations" && i + 1 < argc)
+            ConfigurationsPath = argv[++i];
+        else
+            Positional.push_back(Arg);
+    }
+    unsigned Threads = std::max(1u, std::thread::hardware_concurrency());
+    if (Positional.size() < 2 || Positional.size() > 3 ||
+        (Positional.size() == 3 && Positional[2].getAsInteger(10, Threads)) ||
+        InvalidChecks)
+    {
+        llvm::errs() << "usage: " << argv[0]
+                     << " [--share-preambles [--check-preambles <n>]]"
+                        " [--configurations <json>]"
+                        " <compile_commands.json> <output_dir> [<threads>]"
+                        " [-- <plugin options>...]\n";
+        return 1;
+    }
+    for (auto &&A : PluginArgs)
+    {
+        for (llvm::StringRef U : UnsupportedOptions)
+            if (llvm::StringRef(A).startswith(U))
+            {
+                llvm::errs() << "plugin option " << U.rtrim('=')
+                             << " is not supported in batches\n";
+                return 1;
+            }
+        // The declarations of a preamble are not parsed incrementally, and
+        // the definitions of shared analyses must come first
+        if (A == "incremental" && SharePreambles)
+        {
+            llvm::errs() << "plugin option incremental is not supported "
+                            "with --share-preambles\n";
+            return 1;
+        }
+        if (A == "incremental" && !ConfigurationsPath.empty())
+        {
+            llvm::errs() << "plugin option incremental is not supported "
+                            "with --configurations\n";
+            return 1;
+        }
+        // The configurations of a translation unit would claim each
+        // other's header invocations
+        if (llvm::StringRef(A).startswith("dedup_dir=") &&
+            !ConfigurationsPath.empty())
+        {
+            llvm::errs() << "plugin option dedup_dir is not supported "
+                            "with --configurations\n";
+            return 1;
+        }
+        // The second analysis of a checked translation unit would find
+        // its header invocations claimed by the first
+        if (llvm::StringRef(A).startswith("dedup_dir=") && PreambleChecks)
+        {
+            llvm::errs() << "plugin option dedup_dir is not supported "
+                            "with --check-preambles\n";
+            return 1;
+        }
+    }
+    Threads = std::max(1u, Threads);
+
+    std::string Error;
+    auto DB = clang::tooling::JSONCompilationDatabase::loadFromFile(
+        Positional[0], Error, clang::tooling::JSONCommandLineSyntax::AutoDetect);
+    if (!DB)
+    {
+        llvm::errs() << Error << "\n";
+        return 1;
+    }
+    const std::vector<clang::tooling::CompileCommand> Commands =
+        DB->getAllCompileCommands();
+    const std::string OutputDir = Positional[1].str();
+
+    // Without configurations, each translation unit is analyzed once with
+    // the options of its command, and its facts written to OutputDir
+    std::vector<Configuration> Configs;
+    std::vector<std::string> ConfigDirs;
+    if (ConfigurationsPath.empty())
+    {
+        Configs.push_back({});
+        ConfigDirs.push_back(OutputDir);
+    }
+    else
+    {
+        if (!readConfigurations(ConfigurationsPath, Configs))
+            return 1;
+        for (auto &&Config : Configs)
+        {
+            llvm::SmallString<256> Dir(OutputDir);
+            llvm::sys::path::append(Dir, Config.Name);
+            ConfigDirs.push_back(std::string(Dir));
+        }
+    }
+
+    // Job J analyzes translation unit J / Configs.size() in configuration
+    // J % Configs.size()
+    const size_t NumJobs = Commands.size() * Configs.size();
+    auto commandOf = [&](size_t J) { return J / Configs.size(); };
+    auto configOf = [&](size_t J) { return J % Configs.size(); };
+
+    cpp2c::SharedFileCache Cache;
+    std::vector<std::string> Files(Commands.size());
+    for (size_t I = 0; I < Commands.size(); ++I)
+        Files[I] = absolutePath(Commands[I]);
+    std::vector<clang::tooling::CompileCommand> JobCommands(NumJobs);
+    std::vector<std::string> OutputPaths(NumJobs);
+    for (size_t J = 0; J < NumJobs; ++J)
+    {
+        JobCommands[J] = Commands[commandOf(J)];
+        auto &Options = Configs[configOf(J)].Options;
+        JobCommands[J].CommandLine.insert(JobCommands[J].CommandLine.end(),
+                                          Options.begin(), Options.end());
+        OutputPaths[J] =
+            outputPath(ConfigDirs[configOf(J)], Files[commandOf(J)]);
+    }
+    std::vector<Result> Results(NumJobs);
+    std::mutex ErrorsMutex;
+
+    auto Start = std::chrono::steady_clock::now();
+
+    // Configurations of a translation unit whose fingerprints are the same
+    // share the analysis of the first of them
+    std::vector<Fingerprint> Fingerprints(NumJobs);
+    std::vector<size_t> Representatives(NumJobs);
+    for (size_t J = 0; J < NumJobs; ++J)
+        Representatives[J] = J;
+    if (Configs.size() > 1)
+    {
+        runOnThreads(NumJobs, Threads,
+                     [&](size_t J)
+                     { fingerprint(JobCommands[J], Cache, Fingerprints[J]); });
+        for (size_t I = 0; I < Commands.size(); ++I)
+        {
+            llvm::StringMap<size_t> FirstWithDigest;
+            for (size_t J = I * Configs.size(); J < (I + 1) * Configs.size();
+                 ++J)
+                if (!Fingerprints[J].Digest.empty())
+                    Representatives[J] =
+                        FirstWithDigest.try_emplace(Fingerprints[J].Digest, J)
+                            .first->second;
+        }
+    }
+    std::vector<size_t> Analyzed, Shared;
+    for (size_t J = 0; J < NumJobs; ++J)
+        (Representatives[J] == J ? Analyzed : Shared).push_back(J);
+
+    // Find the include blocks that several translation units share
+    std::vector<std::optional<cpp2c::IncludeBlock>> Blocks(NumJobs);
+    std::vector<std::string> PreambleKeys(NumJobs);
+    if (SharePreambles)
+    {
+        runOnThreads(Analyzed.size(), Threads,
+                     [&](size_t A)
+                     {
+                         size_t J = Analyzed[A];
+                         const auto &File = Files[commandOf(J)];
+                         Blocks[J] = findSharableBlock(JobCommands[J], File,
+                                                       Cache);
+                         if (Blocks[J])
+                             PreambleKeys[J] = preambleKey(
+                                 JobCommands[J], File, *Blocks[J]);
+                     });
+        llvm::StringMap<unsigned> Sharers;
+        for (auto &&Key : PreambleKeys)
+            if (!Key.empty())
+                ++Sharers[Key];
+        for (auto &&Key : PreambleKeys)
+            if (!Key.empty() && Sharers[Key] < 2)
+                Key.clear();
+    }
+    // The translation units that are also analyzed without their preamble,
+    // evenly spread over those that have one
+    std::vector<bool> CheckPreamble(NumJobs, false);
+    {
+        std::vector<size_t> WithKey;
+        for (size_t J = 0; J < NumJobs; ++J)
+            if (!PreambleKeys[J].empty())
+                WithKey.push_back(J);
+        size_t N = std::min<size_t>(PreambleChecks, WithKey.size());
+        for (size_t I = 0; I < N; ++I)
+            CheckPreamble[WithKey[I * WithKey.size() / N]] = true;
+    }
+    llvm::SmallString<256> PreambleDir(OutputDir);
+    llvm::sys::path::append(PreambleDir, "preambles");
+    cpp2c::PreambleCache Preambles(std::string(PreambleDir));
+    std::atomic<unsigned> WithPreamble{0}, Retried{0}, Copied{0};
+    std::atomic<unsigned> Checked{0}, CheckMismatches{0};
+
+    auto reportErrors = [&](size_t J, const std::string &Diagnostics)
+    {
+        if (Diagnostics.empty() && Results[J].Succeeded)
+            return;
+        std::lock_guard<std::mutex> Lock(ErrorsMutex);
+        llvm::errs() << Diagnostics;
+        if (!Results[J].Succeeded)
+        {
+            llvm::errs() << "cpp2c-batch: failed to analyze "
+                         << Files[commandOf(J)];
+            if (Configs.size() > 1)
+                llvm::errs() << " in configuration "
+                             << Configs[configOf(J)].Name;
+            llvm::errs() << "\n";
+        }
+    };
+
+    auto analyzeJob = [&](size_t J)
+    {
+        const auto &CC = JobCommands[J];
+        const auto &File = Files[commandOf(J)];
+        auto TUStart = std::chrono::steady_clock::now();
+        std::string Diagnostics;
+
+        const cpp2c::PreambleCache::Preamble *P = nullptr;
+        if (!PreambleKeys[J].empty())
+            P = Preambles.get(
+                PreambleKeys[J],
+                [&](const cpp2c::PreambleCache::Preamble &New)
+                {
+                    return buildPreamble(CC, File, *Blocks[J], New, Cache,
+                                         Diagnostics);
+                });
+        const cpp2c::IncludeBlock *Block = P ? &*Blocks[J] : nullptr;
+        Results[J].Succeeded = analyze(CC, PluginArgs, Cache, OutputPaths[J],
+                                       P, Block, Diagnostics);
+        if (P)
+            ++WithPreamble;
+        if (P && !Results[J].Succeeded)
+        {
+            ++Retried;
+            Diagnostics.clear();
+            Results[J].Succeeded = analyze(CC, PluginArgs, Cache,
+                                           OutputPaths[J], nullptr, nullptr,
+                                           Diagnostics);
+        }
+        std::chrono::duration<double> Elapsed =
+            std::chrono::steady_clock::now() - TUStart;
+        Results[J].Seconds = Fingerprints[J].Seconds + Elapsed.count();
+
+        // Compare with a full parse, whose facts are kept if they differ
+        if (P && Results[J].Succeeded && CheckPreamble[J])
+        {
+            std::string FullPath = OutputPaths[J] + ".full";
+            std::string FullDiagnostics;
+            if (analyze(CC, PluginArgs, Cache, FullPath, nullptr, nullptr,
+                        FullDiagnostics))
+            {
+                ++Checked;
+                if (!sameContents(OutputPaths[J], FullPath))
+                {
+                    ++CheckMismatches;
+                    Diagnostics += "cpp2c-batch: facts of " + File +
+                                   " differ with and without a preamble\n";
+                    llvm::sys::fs::rename(FullPath, OutputPaths[J]);
+                }
+            }
+            llvm::sys::fs::remove(FullPath);
+        }
+        reportErrors(J, Diagnostics);
+    };
+
+    runOnThreads(Analyzed.size(), Threads,
+                 [&](size_t A) { analyzeJob(Analyzed[A]); });
+
+    // A configuration whose shared analysis failed is analyzed on its own
+    runOnThreads(
+        Shared.size(), Threads,
+        [&](size_t S)
+        {
+            size_t J = Shared[S];
+            size_t R = Representatives[J];
+            std::string Diagnostics;
+            auto CopyStart = std::chrono::steady_clock::now();
+            if (Results[R].Succeeded &&
+                copyFacts(OutputPaths[R], OutputPaths[J],
+                          Fingerprints[J].Definitions, Diagnostics))
+            {
+                ++Copied;
+                Results[J].Succeeded = true;
+                std::chrono::duration<double> Elapsed =
+                    std::chrono::steady_clock::now() - CopyStart;
+                Results[J].Seconds = Fingerprints[J].Seconds + Elapsed.count();
+                reportErrors(J, Diagnostics);
+                return;
+            }
+            analyzeJob(J);
+        });
+    std::chrono::duration<double> Elapsed =
+        std::chrono::steady_clock::now() - Start;
+
+    size_t Failures = 0;
+    for (size_t C = 0; C < Configs.size(); ++C)
+    {
+        std::error_code EC;
+        llvm::SmallString<256> TimingsPath(ConfigDirs[C]);
+        llvm::sys::fs::create_directories(TimingsPath);
+        llvm::sys::path::append(TimingsPath, "timings.tsv");
+        llvm::raw_fd_ostream Timings(TimingsPath, EC, llvm::sys::fs::OF_Text);
+        for (size_t I = 0; I < Commands.size(); ++I)
+        {
+            size_t J = I * Configs.size() + C;
+            if (!Results[J].Succeeded)
+                ++Failures;
+            else if (!EC)
+                Timings << Files[I] << cpp2c::delim
+                        << llvm::format("%.3f", Results[J].Seconds) << "\n";
+        }
+    }
+
+    if (Configs.size() > 1)
+    {
+        std::error_code EC;
+        llvm::SmallString<256> DiffPath(OutputDir);
+        llvm::sys::path::append(DiffPath, "config_diff.cpp2c");
+        llvm::raw_fd_ostream Diffs(DiffPath, EC, llvm::sys::fs::OF_Text);
+        if (EC)
+            llvm::errs() << "could not open " << DiffPath << ": "
+                         << EC.message() << "\n";
+        else
+            for (size_t I = 0; I < Commands.size(); ++I)
+            {
+                // Configurations that failed are left out
+                std::vector<std::string> Paths(Configs.size());
+                for (size_t C = 0; C < Configs.size(); ++C)
+                    if (Results[I * Configs.size() + C].Succeeded)
+                        Paths[C] = OutputPaths[I * Configs.size() + C];
+                writeInvocationDiffs(Diffs, Files[I], Configs, Paths);
+            }
+    }
+
+    auto C = Cache.counters();
+    llvm::errs() << "analyzed " << NumJobs - Failures << " / " << NumJobs
+                 << (Configs.size() > 1 ? " configurations of translation "
+                                          "units on "
+                                        : " translation units on ")
+                 << Threads << " threads in "
+                 << llvm::format("%.1f", Elapsed.count()) << " seconds\n"
+                 << "file statuses: " << C.StatHits << " hits, "
+                 << C.StatMisses << " misses\n"
+                 << "file reads: " << C.ReadHits << " hits, " << C.ReadMisses
+                 << " misses, " << C.BytesRead << " bytes read\n";
+    if (SharePreambles)
+        llvm::errs() << "preambles: " << Preambles.built() << " built, "
+                     << Preambles.failed() << " failed, used by "
+                     << WithPreamble << " translation units, "
+                     << Retried << " of which were analyzed again without\n";
+    if (PreambleChecks)
+        llvm::errs() << "preamble checks: " << Checked
+                     << " translation units analyzed again without their "
+                        "preamble, "
+                     << CheckMismatches << " of which had different facts\n";
+    if (Configs.size() > 1)
+        llvm::errs() << "configurations: " << Copied
+                     << " shared the analysis of another with the same "
+                        "fingerprint\n";
+    return Failures ? 1 : 0;
+}
@@ -0,0 +1,80 @@
+#include "Cpp2CPPOnlyAction.hh"
+#include "DefinitionInfoCollector.hh"
+#include "IncludeCollector.hh"
+#include "PreprocessorFacts.hh"
+
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Lex/Preprocessor.h"
+
+#include "llvm/ADT/DenseSet.h"
+
+namespace cpp2c
+{
+    std::unique_ptr<clang::ASTConsumer>
+    Cpp2CPPOnlyAction::CreateASTConsumer(clang::CompilerInstance &CI,
+                                         llvm::StringRef InFile)
+    {
+        // Never called, since this action only uses the preprocessor
+        return std::make_unique<clang::ASTConsumer>();
+    }
+
+    bool Cpp2CPPOnlyAction::ParseArgs(const clang::CompilerInstance &CI,
+                                      const std::vector<std::string> &arg)
+    {
+        return true;
+    }
+
+    clang::PluginASTAction::ActionType Cpp2CPPOnlyAction::getActionType()
+    {
+        return clang::PluginASTAction::ActionType::ReplaceAction;
+    }
+
+    void Cpp2CPPOnlyAction::ExecuteAction()
+    {
+        clang::CompilerInstance &CI = getCompilerInstance();
+        clang::Preprocessor &PP = CI.getPreprocessor();
+        clang::SourceManager &SM = CI.getSourceManager();
+
+        auto IC = new cpp2c::IncludeCollector();
+        auto DC = new cpp2c::DefinitionInfoCollector();
+        PP.addPPCallbacks(std::unique_ptr<cpp2c::IncludeCollector>(IC));
+        PP.addPPCallbacks(std::unique_ptr<cpp2c::DefinitionInfoCollector>(DC));
+
+        // Without declarations, an include is approximated as being inside
+        // a declaration if it appears between braces.
+        // Include directives are handled while lexing the token after them,
+        // so the depth before that token is the depth at the directive.
+        llvm::DenseSet<clang::SourceLocation::UIntTy> IncludesInBraces;
+        size_t NumIncludes = 0;
+        unsigned Depth = 0;
+
+        // Ignore unknown pragmas
+        PP.IgnorePragmas();
+        PP.EnterMainSourceFile();
+        clang::Token Tok;
+        do
+        {
+            PP.Lex(Tok);
+            for (; NumIncludes < IC->IncludeEntriesLocs.size(); ++NumIncludes)
+                if (Depth > 0)
+                    IncludesInBraces.insert(
+                        SM.getFileLoc(IC->IncludeEntriesLocs[NumIncludes].second)
+                            .getRawEncoding());
+
+            if (Tok.is(clang::tok::l_brace))
+                ++Depth;
+            else if (Tok.is(clang::tok::r_brace) && Depth > 0)
+                --Depth;
+        } while (Tok.isNot(clang::tok::eof));
+
+        printDefinitions(SM, *DC);
+        printInspectedMacroNames(*DC);
+        printIncludes(SM, *IC,
+                      [&IncludesInBraces](clang::SourceLocation L)
+                      { return IncludesInBraces.count(L.getRawEncoding()) > 0; });
+    }
+
+    static clang::FrontendPluginRegistry::Add<Cpp2CPPOnlyAction>
+        X("cpp2c-pp-only", "Extract macro definition and include information "
+                           "without parsing");
+} // namespace cpp2c
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <clang/Frontend/FrontendPluginRegistry.h>
+
+namespace cpp2c
+{
+    // Emits the facts that only need the preprocessor (macro definitions,
+    // names inspected by the preprocessor, and includes) without parsing.
+    // Replaces the main action, e.g.:
+    //   clang -fplugin=libcpp2c.so -Xclang -plugin -Xclang cpp2c-pp-only
+    class Cpp2CPPOnlyAction : public clang::PluginASTAction
+    {
+
+    protected:
+        std::unique_ptr<clang::ASTConsumer>
+        CreateASTConsumer(clang::CompilerInstance &CI,
+                          llvm::StringRef InFile) override;
+
+        bool ParseArgs(const clang::CompilerInstance &CI,
+                  const std::vector<std::string> &arg) override;
+
+        clang::PluginASTAction::ActionType getActionType() override;
+
+        bool usesPreprocessorOnly() const override { return true; }
+
+        void ExecuteAction() override;
+    };
+
+} // namespace cpp2c
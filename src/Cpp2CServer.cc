@@ -0,0 +1,383 @@
+// Long-lived analysis server for code range queries.
+// Listens on a Unix socket and keeps the ASTs and macro forests of the most
+// recently queried translation units, so that repeated queries about a
+// translation unit are answered without parsing it again.
+// Built only when CPP2C_BUILD_SERVER is enabled.
+//
+// Each request is a line holding a JSON object with the "directory" and
+// "arguments" of a compile command, and the "tasks" to analyze in the
+// format of a code range analysis tasks file. The response holds a line
+// "Range\t<properties>" for each task, as the plugin prints them, followed
+// by a line "Done\t<statistics>" or "Error\t<message>".
+// Each client is served on its own thread; queries about the same
+// translation unit are answered one at a time.
+
+#include "Cpp2CASTConsumer.hh"
+
+#include "json.hpp"
+
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/Serialization/PCHContainerOperations.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+    // Parses a translation unit without analyzing it, so that code ranges
+    // can be analyzed as they are queried
+    class ServerAction : public clang::ASTFrontendAction
+    {
+    public:
+        // Owned by the translation unit's ASTUnit
+        cpp2c::Cpp2CASTConsumer *Consumer = nullptr;
+
+    protected:
+        std::unique_ptr<clang::ASTConsumer>
+        CreateASTConsumer(clang::CompilerInstance &CI,
+                          llvm::StringRef InFile) override
+        {
+            cpp2c::Cpp2COptions Options;
+            Options.analyzeTranslationUnit = false;
+            auto C = std::make_unique<cpp2c::Cpp2CASTConsumer>(
+                CI, std::vector<cpp2c::CodeRangeAnalysisTask>(), Options);
+            Consumer = C.get();
+            return C;
+        }
+    };
+
+    struct ParsedTU
+    {
+        std::string Key;
+        std::unique_ptr<clang::ASTUnit> AST;
+        cpp2c::Cpp2CASTConsumer *Consumer;
+        // The main file and its status when it was parsed.
+        // Code ranges are only analyzed in translation units without
+        // includes, so no other file can make the AST stale.
+        std::string MainFile;
+        llvm::sys::fs::file_status Status;
+        // Held while the translation unit is queried, since its consumer
+        // keeps state between queries
+        std::mutex Mutex;
+    };
+
+    std::optional<llvm::sys::fs::file_status> stat(const std::string &Path)
+    {
+        llvm::sys::fs::file_status Status;
+        if (llvm::sys::fs::status(Path, Status))
+            return std::nullopt;
+        return Status;
+    }
+
+    bool isFresh(const ParsedTU &TU)
+    {
+        auto Status = stat(TU.MainFile);
+        return Status &&
+               Status->getLastModificationTime() ==
+                   TU.Status.getLastModificationTime() &&
+               Status->getSize() == TU.Status.getSize();
+    }
+
+    // Parsed translation units, evicting the least recently used.
+    // Clients keep the translation units they are querying alive after
+    // they are evicted.
+    class TUCache
+    {
+    public:
+        explicit TUCache(size_t Capacity) : Capacity(Capacity) {}
+
+        // Returns the translation unit with the given key if it is cached
+        // and its main file has not changed since it was parsed
+        std::shared_ptr<ParsedTU> lookup(const std::string &Key)
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            return lookupLocked(Key);
+        }
+
+        // Caches TU, unless a client that parsed it at the same time
+        // cached it first, and returns the cached one
+        std::shared_ptr<ParsedTU> insert(std::shared_ptr<ParsedTU> TU)
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            if (auto Cached = lookupLocked(TU->Key))
+                return Cached;
+            while (!Entries.empty() && Entries.size() >= Capacity)
+            {
+                Index.erase(Entries.back()->Key);
+                Entries.pop_back();
+            }
+            Entries.push_front(std::move(TU));
+            Index[Entries.front()->Key] = Entries.begin();
+            return Entries.front();
+        }
+
+    private:
+        size_t Capacity;
+        std::mutex Mutex;
+        // Most recently used first
+        std::list<std::shared_ptr<ParsedTU>> Entries;
+        llvm::StringMap<std::list<std::shared_ptr<ParsedTU>>::iterator> Index;
+
+        std::shared_ptr<ParsedTU> lookupLocked(const std::string &Key)
+        {
+            auto It = Index.find(Key);
+            if (It == Index.end())
+                return nullptr;
+            if (!isFresh(**It->second))
+            {
+                Entries.erase(It->second);
+                Index.erase(It);
+                return nullptr;
+            }
+            Entries.splice(Entries.begin(), Entries, It->second);
+            return Entries.front();
+        }
+    };
+
+    // Parses the translation unit of the given compile command
+    std::shared_ptr<ParsedTU> parse(const std::string &Key,
+                                  const std::string &Directory,
+                                  const std::vector<std::string> &Arguments,
+                                  std::string &Error)
+    {
+        std::vector<const char *> Args;
+        for (auto &&A : Arguments)
+            Args.push_back(A.c_str());
+
+        llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS(
+            llvm::vfs::createPhysicalFileSystem().release());
+        FS->setCurrentWorkingDirectory(Directory);
+        clang::CreateInvocationOptions Opts;
+        Opts.VFS = FS;
+        std::shared_ptr<clang::CompilerInvocation> Invocation =
+            clang::createInvocation(Args, Opts);
+        if (!Invocation || Invocation->getFrontendOpts().Inputs.size() != 1)
+        {
+            Error = "could not create a compiler invocation for one file";
+            return nullptr;
+        }
+        Invocation->getFileSystemOpts().WorkingDir = Directory;
+        // Evicted translation units must be freed
+        Invocation->getFrontendOpts().DisableFree = false;
+
+        llvm::SmallString<256> MainFile(
+            Invocation->getFrontendOpts().Inputs[0].getFile());
+        llvm::sys::fs::make_absolute(Directory, MainFile);
+        auto Status = stat(std::string(MainFile));
+        if (!Status)
+        {
+            Error = "could not stat " + std::string(MainFile);
+            return nullptr;
+        }
+
+        ServerAction Action;
+        std::unique_ptr<clang::ASTUnit> AST(
+            clang::ASTUnit::LoadFromCompilerInvocationAction(
+                std::move(Invocation),
+                std::make_shared<clang::PCHContainerOperations>(),
+                clang::CompilerInstance::createDiagnostics(
+                    new clang::DiagnosticOptions()),
+                &Action));
+        if (!AST || !Action.Consumer)
+        {
+            Error = "could not parse " + std::string(MainFile);
+            return nullptr;
+        }
+        auto TU = std::make_shared<ParsedTU>();
+        TU->Key = Key;
+        TU->AST = std::move(AST);
+        TU->Consumer = Action.Consumer;
+        TU->MainFile = std::string(MainFile);
+        TU->Status = *Status;
+        return TU;
+    }
+
+    // Answers one request, and returns the response
+    std::string answer(TUCache &Cache, llvm::StringRef Request)
+    {
+        auto Start = std::chrono::steady_clock::now();
+        std::string Response;
+        llvm::raw_string_ostream OS(Response);
+
+        std::string Directory;
+        std::vector<std::string> Arguments;
+        std::vector<cpp2c::CodeRangeAnalysisTask> Tasks;
+        try
+        {
+            auto JSON = nlohmann::json::parse(Request.begin(), Request.end());
+            Directory = JSON.at("directory").get<std::string>();
+            Arguments = JSON.at("arguments").get<std::vector<std::string>>();
+            Tasks = JSON.at("tasks")
+                        .get<std::vector<cpp2c::CodeRangeAnalysisTask>>();
+        }
+        catch (const std::exception &E)
+        {
+            OS << "Error\tinvalid request: " << E.what() << "\n";
+            return Response;
+        }
+
+        std::string Key = Directory;
+        for (auto &&A : Arguments)
+            Key += '\0' + A;
+
+        bool Cached = true;
+        std::shared_ptr<ParsedTU> TU = Cache.lookup(Key);
+        if (!TU)
+        {
+            Cached = false;
+            std::string Error;
+            auto Parsed = parse(Key, Directory, Arguments, Error);
+            if (!Parsed)
+            {
+                OS << "Error\t" << Error << "\n";
+                return Response;
+            }
+            TU = Cache.insert(std::move(Parsed));
+        }
+
+        std::lock_guard<std::mutex> Lock(TU->Mutex);
+        if (!TU->Consumer->answerCodeRangeTasks(
+                Tasks,
+                [&OS](std::string Range)
+                { OS << "Range\t" << Range << "\n"; }))
+        {
+            OS << "Error\tcode ranges can only be analyzed in translation "
+                  "units without includes\n";
+            return Response;
+        }
+
+        std::chrono::duration<double> Elapsed =
+            std::chrono::steady_clock::now() - Start;
+        nlohmann::ordered_json Stats;
+        Stats["Cached"] = Cached;
+        Stats["Seconds"] = Elapsed.count();
+        OS << "Done\t" << Stats.dump() << "\n";
+        return Response;
+    }
+
+    bool writeAll(int FD, const std::string &Data)
+    {
+        size_t Written = 0;
+        while (Written < Data.size())
+        {
+            auto N = ::write(FD, Data.data() + Written, Data.size() - Written);
+            if (N < 0 && errno == EINTR)
+                continue;
+            if (N <= 0)
+                return false;
+            Written += N;
+        }
+        return true;
+    }
+
+    // Answers the requests of one client until it disconnects, and closes
+    // its socket
+    void serve(TUCache &Cache, int FD)
+    {
+        std::string Buffer;
+        char Chunk[65536];
+        while (true)
+        {
+            auto N = ::read(FD, Chunk, sizeof(Chunk));
+            if (N < 0 && errno == EINTR)
+                continue;
+            if (N <= 0)
+                break;
+            Buffer.append(Chunk, N);
+
+            size_t Begin = 0, End;
+            while ((End = Buffer.find('\n', Begin)) != std::string::npos)
+            {
+                llvm::StringRef Request(Buffer.data() + Begin, End - Begin);
+                Begin = End + 1;
+                if (Request.trim().empty())
+                    continue;
+                if (!writeAll(FD, answer(Cache, Request)))
+                {
+                    ::close(FD);
+                    return;
+                }
+            }
+            Buffer.erase(0, Begin);
+        }
+        ::close(FD);
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t CacheSize = 8;
+    if (argc < 2 || argc > 3 ||
+        (argc == 3 && (llvm::StringRef(argv[2]).getAsInteger(10, CacheSize) ||
+                       CacheSize == 0)))
+    {
+        llvm::errs() << "usage: " << argv[0]
+                     << " <socket_path> [<cached_translation_units>]\n";
+        return 1;
+    }
+    const std::string SocketPath = argv[1];
+
+    // Clients that disconnect early must not stop the server
+    std::signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un Addr{};
+    Addr.sun_family = AF_UNIX;
+    if (SocketPath.size() >= sizeof(Addr.sun_path))
+    {
+        llvm::errs() << "socket path too long: " << SocketPath << "\n";
+        return 1;
+    }
+    std::memcpy(Addr.sun_path, SocketPath.c_str(), SocketPath.size() + 1);
+
+    int Listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ::unlink(SocketPath.c_str());
+    if (Listener < 0 ||
+        ::bind(Listener, reinterpret_cast<sockaddr *>(&Addr),
+               sizeof(Addr)) != 0 ||
+        ::listen(Listener, 16) != 0)
+    {
+        std::perror("cpp2c-server");
+        return 1;
+    }
+    llvm::errs() << "cpp2c-server listening on " << SocketPath << "\n";
+
+    TUCache Cache(CacheSize);
+    while (true)
+    {
+        int FD = ::accept4(Listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (FD < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            std::perror("cpp2c-server");
+            return 1;
+        }
+        std::thread(serve, std::ref(Cache), FD).detach();
+    }
+}
@@ -0,0 +1,71 @@
+#include "DeclRangeIndex.hh"
+
+#include "clang/Lex/Lexer.h"
+
+#include <algorithm>
+
+namespace cpp2c
+{
+    DeclRangeIndex::DeclRangeIndex(
+        clang::SourceManager &SM,
+        const clang::LangOptions &LO,
+        const std::vector<const clang::Decl *> &Decls)
+    {
+        Intervals.reserve(Decls.size());
+        for (auto &&D : Decls)
+        {
+            auto B = SM.getFileLoc(D->getBeginLoc());
+            auto E = SM.getFileLoc(D->getEndLoc());
+
+            if (B.isInvalid() || E.isInvalid())
+                continue;
+
+            // Include the location just after the declaration
+            // to account for semicolons.
+            // If the decl does not have semicolon after it,
+            // that's fine since it would be a non-global
+            // location anyway
+            if (auto Tok = clang::Lexer::findNextToken(E, SM, LO))
+                if (Tok.has_value())
+                    E = SM.getFileLoc(Tok.value().getEndLoc());
+
+            if (E.isInvalid())
+                continue;
+
+            // Empty intervals can not contain anything
+            if (E < B)
+                continue;
+
+            Intervals.push_back({B.getRawEncoding(), E.getRawEncoding()});
+        }
+
+        // Merge overlapping intervals
+        std::sort(Intervals.begin(), Intervals.end());
+        size_t N = 0;
+        for (auto &&I : Intervals)
+        {
+            if (N > 0 && I.first <= Intervals[N - 1].second)
+                Intervals[N - 1].second =
+                    std::max(Intervals[N - 1].second, I.second);
+            else
+                Intervals[N++] = I;
+        }
+        Intervals.resize(N);
+    }
+
+    bool DeclRangeIndex::contains(clang::SourceLocation L) const
+    {
+        auto Raw = L.getRawEncoding();
+        // Find the last interval beginning at or before L
+        auto It = std::upper_bound(
+            Intervals.begin(), Intervals.end(), Raw,
+            [](clang::SourceLocation::UIntTy R,
+               const std::pair<clang::SourceLocation::UIntTy,
+                               clang::SourceLocation::UIntTy> &I)
+            { return R < I.first; });
+        if (It == Intervals.begin())
+            return false;
+        --It;
+        return Raw <= It->second;
+    }
+} // namespace cpp2c
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "clang/AST/Decl.h"
+#include "clang/Basic/LangOptions.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+
+#include <utility>
+#include <vector>
+
+namespace cpp2c
+{
+    // Sorted, merged file ranges of a set of declarations.
+    // Each declaration's range is extended past the token that follows it
+    // to account for semicolons, so finding whether a location is inside
+    // any declaration does not require lexing per query.
+    class DeclRangeIndex
+    {
+    private:
+        // Disjoint raw-encoded intervals, sorted by their beginnings
+        std::vector<std::pair<clang::SourceLocation::UIntTy,
+                              clang::SourceLocation::UIntTy>>
+            Intervals;
+
+    public:
+        DeclRangeIndex(clang::SourceManager &SM,
+                       const clang::LangOptions &LO,
+                       const std::vector<const clang::Decl *> &Decls);
+
+        // Returns true if the file location L is within the range of any
+        // of the declarations
+        bool contains(clang::SourceLocation L) const;
+    };
+} // namespace cpp2c
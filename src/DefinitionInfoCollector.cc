@@ -3,15 +3,18 @@
 namespace cpp2c
 {
 
-    DefinitionInfoCollector::DefinitionInfoCollector(clang::ASTContext &Ctx)
-        : SM(Ctx.getSourceManager()), LO(Ctx.getLangOpts()) {}
+    void DefinitionInfoCollector::inspect(const clang::Token &MacroNameTok)
+    {
+        if (auto II = MacroNameTok.getIdentifierInfo())
+            InspectedMacroNames.insert(II);
+    }
 
     void DefinitionInfoCollector::MacroDefined(
         const clang::Token &MacroNameTok,
         const clang::MacroDirective *MD)
     {
-        std::string Name = clang::Lexer::getSpelling(MacroNameTok, SM, LO);
-        MacroNamesDefinitions.push_back({Name, MD});
+        if (auto II = MacroNameTok.getIdentifierInfo())
+            MacroNamesDefinitions.push_back({II, MD});
     }
 
     void DefinitionInfoCollector::MacroUndefined(
@@ -19,8 +22,7 @@ namespace cpp2c
         const clang::MacroDefinition &MD,
         const clang::MacroDirective *Undef)
     {
-        auto Name = clang::Lexer::getSpelling(MacroNameTok, SM, LO);
-        InspectedMacroNames.insert(Name);
+        inspect(MacroNameTok);
     }
 
     void DefinitionInfoCollector::Defined(
@@ -28,8 +30,7 @@ namespace cpp2c
         const clang::MacroDefinition &MD,
         clang::SourceRange Range)
     {
-        auto Name = clang::Lexer::getSpelling(MacroNameTok, SM, LO);
-        InspectedMacroNames.insert(Name);
+        inspect(MacroNameTok);
     }
 
     void DefinitionInfoCollector::Ifdef(
@@ -37,8 +38,7 @@ namespace cpp2c
         const clang::Token &MacroNameTok,
         const clang::MacroDefinition &MD)
     {
-        auto Name = clang::Lexer::getSpelling(MacroNameTok, SM, LO);
-        InspectedMacroNames.insert(Name);
+        inspect(MacroNameTok);
     }
 
     void DefinitionInfoCollector::Ifndef(
@@ -46,8 +46,7 @@ namespace cpp2c
         const clang::Token &MacroNameTok,
         const clang::MacroDefinition &MD)
     {
-        auto Name = clang::Lexer::getSpelling(MacroNameTok, SM, LO);
-        InspectedMacroNames.insert(Name);
+        inspect(MacroNameTok);
     }
 
 } // namespace cpp2c
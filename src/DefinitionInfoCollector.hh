@@ -1,15 +1,14 @@
 #pragma once
 
+#include "clang/Basic/IdentifierTable.h"
 #include "clang/Basic/SourceLocation.h"
-#include "clang/Basic/SourceManager.h"
 #include "clang/Lex/PPCallbacks.h"
-#include "clang/Lex/Lexer.h"
 #include "clang/Lex/Token.h"
 #include "clang/Lex/MacroInfo.h"
-#include "clang/AST/ASTContext.h"
+
+#include "llvm/ADT/DenseSet.h"
 
 #include <vector>
-#include <set>
 #include <utility>
 
 namespace cpp2c
@@ -18,15 +17,17 @@ namespace cpp2c
     {
 
     private:
-        clang::SourceManager &SM;
-        const clang::LangOptions &LO;
+        // Records the name of the given macro name token as inspected
+        void inspect(const clang::Token &MacroNameTok);
 
     public:
-        std::vector<std::pair<std::string, const clang::MacroDirective *>>
+        // Macro names are interned by the preprocessor, so we store and
+        // compare their IdentifierInfos instead of spelling them.
+        // Use II->getName() to get a name when printing.
+        std::vector<std::pair<const clang::IdentifierInfo *,
+                              const clang::MacroDirective *>>
             MacroNamesDefinitions;
-        std::set<std::string> InspectedMacroNames;
-
-        DefinitionInfoCollector(clang::ASTContext &Ctx);
+        llvm::DenseSet<const clang::IdentifierInfo *> InspectedMacroNames;
 
         void MacroDefined(const clang::Token &MacroNameTok,
                           const clang::MacroDirective *MD) override;
@@ -47,4 +48,4 @@ namespace cpp2c
                     const clang::Token &MacroNameTok,
                     const clang::MacroDefinition &MD) override;
     };
-} // namespace cpp2c
\ No newline at end of file
+} // namespace cpp2c
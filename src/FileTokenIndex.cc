@@ -0,0 +1,102 @@
+#include "FileTokenIndex.hh"
+
+#include "clang/Lex/Lexer.h"
+
+#include <algorithm>
+
+namespace cpp2c
+{
+    FileTokenIndex::FileTokenIndex(clang::SourceManager &SM,
+                                   const clang::LangOptions &LO)
+        : SM(SM), LO(LO) {}
+
+    const FileTokenIndex::FileTokens &FileTokenIndex::get(clang::FileID FID)
+    {
+        auto Res = Files.try_emplace(FID);
+        auto &FT = Res.first->second;
+        if (!Res.second)
+            return FT;
+
+        bool Invalid = false;
+        llvm::StringRef Buffer = SM.getBufferData(FID, &Invalid);
+        if (Invalid)
+            return FT;
+        FT.Valid = true;
+
+        clang::Lexer Lex(SM.getLocForStartOfFile(FID), LO,
+                         Buffer.begin(), Buffer.begin(), Buffer.end());
+        Lex.SetCommentRetentionState(true);
+        clang::Token Tok;
+        while (true)
+        {
+            bool AtEOF = Lex.LexFromRawLexer(Tok);
+            if (Tok.is(clang::tok::eof))
+                break;
+
+            uint32_t Offset = SM.getFileOffset(Tok.getLocation());
+            FT.Tokens.push_back({Offset, Offset + Tok.getLength()});
+            if (!Tok.is(clang::tok::comment))
+            {
+                FT.Starts.push_back(Offset);
+                FT.Ends.push_back(Offset + Tok.getLength());
+            }
+            if (Tok.is(clang::tok::semi))
+                FT.Semis.push_back(Offset);
+
+            if (AtEOF)
+                break;
+        }
+        return FT;
+    }
+
+    bool FileTokenIndex::isInsideToken(const FileTokens &FT, uint32_t Offset)
+    {
+        // The last token starting before Offset
+        auto It = std::lower_bound(
+            FT.Tokens.begin(), FT.Tokens.end(), Offset,
+            [](const std::pair<uint32_t, uint32_t> &T, uint32_t O)
+            { return T.first < O; });
+        if (It == FT.Tokens.begin())
+            return false;
+        --It;
+        return It->second > Offset;
+    }
+
+    std::optional<bool> FileTokenIndex::hasTokenIn(clang::FileID FID,
+                                                   uint32_t Begin,
+                                                   uint32_t End)
+    {
+        auto &FT = get(FID);
+        if (!FT.Valid || isInsideToken(FT, Begin))
+            return std::nullopt;
+
+        auto It = std::lower_bound(FT.Starts.begin(), FT.Starts.end(), Begin);
+        if (It == FT.Starts.end() || *It >= End)
+            return false;
+        // Any token after the first one ends after the first one does
+        auto Next = std::next(It);
+        if (Next != FT.Starts.end() && *Next < End)
+            return true;
+        return FT.Ends[It - FT.Starts.begin()] != End;
+    }
+
+    std::optional<bool> FileTokenIndex::findSemicolonAt(clang::FileID FID,
+                                                        uint32_t Begin,
+                                                        uint32_t End,
+                                                        uint32_t &SemiEnd)
+    {
+        auto &FT = get(FID);
+        if (!FT.Valid || isInsideToken(FT, Begin))
+            return std::nullopt;
+
+        auto It = std::lower_bound(FT.Starts.begin(), FT.Starts.end(), Begin);
+        if (It == FT.Starts.end() || *It >= End)
+            return false;
+        if (!std::binary_search(FT.Semis.begin(), FT.Semis.end(), *It))
+            return false;
+        if (*It + 1 >= End)
+            return false;
+        SemiEnd = *It + 1;
+        return true;
+    }
+} // namespace cpp2c
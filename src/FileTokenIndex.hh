@@ -0,0 +1,68 @@
+#pragma once
+
+#include "clang/Basic/LangOptions.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+
+#include "llvm/ADT/DenseMap.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace cpp2c
+{
+    // Lazily built index of the raw tokens of each file in a translation
+    // unit.
+    // Each file is lexed once, in raw mode and retaining comments, the
+    // first time a query asks about it.
+    // Queries give the same answers as raw lexing a range of a file with
+    // LexFromRawLexer, and return nothing when the answer could differ
+    // because the range begins inside a token or comment of the whole-file
+    // lexing.
+    // Since LexFromRawLexer reports the end of the buffer along with the
+    // token that reaches it, a token ending exactly at the end of the range
+    // is not seen by such loops, and is not reported here either.
+    class FileTokenIndex
+    {
+    private:
+        struct FileTokens
+        {
+            // Whether the buffer of the file could be read
+            bool Valid = false;
+            // Ranges of all tokens, including comments, in file order
+            std::vector<std::pair<uint32_t, uint32_t>> Tokens;
+            // Start and end offsets of non-comment tokens, sorted
+            std::vector<uint32_t> Starts;
+            std::vector<uint32_t> Ends;
+            // Offsets of semicolons, sorted
+            std::vector<uint32_t> Semis;
+        };
+
+        clang::SourceManager &SM;
+        const clang::LangOptions &LO;
+        llvm::DenseMap<clang::FileID, FileTokens> Files;
+
+        const FileTokens &get(clang::FileID FID);
+
+        // Returns true if Offset is strictly inside a token or comment
+        static bool isInsideToken(const FileTokens &FT, uint32_t Offset);
+
+    public:
+        FileTokenIndex(clang::SourceManager &SM, const clang::LangOptions &LO);
+
+        // Returns whether a non-comment token starts in [Begin, End) of
+        // the given file, not counting one that ends exactly at End
+        std::optional<bool> hasTokenIn(clang::FileID FID,
+                                       uint32_t Begin,
+                                       uint32_t End);
+
+        // Returns whether the first non-comment token at or after Begin is
+        // a semicolon which ends before End, and if so, sets SemiEnd to the
+        // offset just past it
+        std::optional<bool> findSemicolonAt(clang::FileID FID,
+                                            uint32_t Begin,
+                                            uint32_t End,
+                                            uint32_t &SemiEnd);
+    };
+} // namespace cpp2c
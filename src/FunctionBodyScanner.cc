@@ -0,0 +1,217 @@
+#include "FunctionBodyScanner.hh"
+
+#include "clang/Lex/Lexer.h"
+
+namespace cpp2c
+{
+    namespace
+    {
+        // The kind of a raw-lexed token, with identifiers looked up
+        struct Token
+        {
+            clang::tok::TokenKind Kind = clang::tok::unknown;
+            bool IsKeyword = false;
+
+            template <typename... Ts>
+            bool isOneOf(Ts... Ks) const { return ((Kind == Ks) || ...); }
+        };
+
+        // Keywords after which an identifier is used rather than declared
+        bool isStatementKeyword(clang::tok::TokenKind K)
+        {
+            switch (K)
+            {
+            case clang::tok::kw_return:
+            case clang::tok::kw_case:
+            case clang::tok::kw_goto:
+            case clang::tok::kw_sizeof:
+            case clang::tok::kw_else:
+            case clang::tok::kw_do:
+            case clang::tok::kw_if:
+            case clang::tok::kw_while:
+            case clang::tok::kw_for:
+            case clang::tok::kw_switch:
+            case clang::tok::kw_throw:
+            case clang::tok::kw_new:
+            case clang::tok::kw_delete:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        bool isTagKeyword(clang::tok::TokenKind K)
+        {
+            return K == clang::tok::kw_struct || K == clang::tok::kw_union ||
+                   K == clang::tok::kw_enum || K == clang::tok::kw_class;
+        }
+
+        // Returns true if the identifier between Prev and Next may be the
+        // name of a declaration: a declarator, a tag, an enumerator, or a
+        // label. This over-approximates, e.g. the arguments of a call have
+        // the same tokens around them as the parameters of a declaration.
+        bool isDeclaredName(const Token &Prev2,
+                            const Token &Prev,
+                            const Token &Next,
+                            bool InEnum)
+        {
+            using namespace clang;
+
+            // Tag names, whether declared or referenced
+            if (isTagKeyword(Prev.Kind))
+                return true;
+
+            // Labels and bit-fields, unless the colon ends a case label or
+            // belongs to a conditional operator
+            if (Next.Kind == tok::colon &&
+                !Prev.isOneOf(tok::question, tok::kw_case))
+                return true;
+
+            // Enumerators
+            if (InEnum && Prev.isOneOf(tok::l_brace, tok::comma))
+                return true;
+
+            // A declarator name is followed by an initializer, the next
+            // declarator, array or function declarator chunks, a closing
+            // parenthesis of a nested declarator, attributes or asm labels
+            if (!Next.isOneOf(tok::equal, tok::l_brace, tok::semi, tok::comma,
+                              tok::l_square, tok::l_paren, tok::r_paren,
+                              tok::kw___attribute, tok::kw_asm))
+                return false;
+
+            // and preceded by a declaration specifier (a typedef name or a
+            // keyword), a pointer or reference declarator, the previous
+            // declarator or parameter, the opening parenthesis of a nested
+            // declarator or parameter list, or the end of a tag definition
+            if (Prev.isOneOf(tok::identifier, tok::r_brace, tok::star,
+                             tok::amp, tok::ampamp, tok::comma))
+                return true;
+            if (Prev.Kind == tok::l_paren)
+                return !(Prev2.IsKeyword && isStatementKeyword(Prev2.Kind));
+            return Prev.IsKeyword && !isStatementKeyword(Prev.Kind);
+        }
+    } // namespace
+
+    FunctionBodyScanner::FunctionBodyScanner(clang::Preprocessor &PP)
+        : PP(PP) {}
+
+    std::optional<clang::SourceRange> FunctionBodyScanner::findUnexpandedBody(
+        const clang::Decl *D,
+        Identifiers &Ids)
+    {
+        auto &SM = PP.getSourceManager();
+        auto &LO = PP.getLangOpts();
+
+        // Until the body is parsed, the declaration ends at its declarator,
+        // which must be written in a file
+        auto DeclEnd = D->getEndLoc();
+        if (DeclEnd.isInvalid() || DeclEnd.isMacroID())
+            return std::nullopt;
+        auto Start = clang::Lexer::getLocForEndOfToken(DeclEnd, 0, SM, LO);
+        if (Start.isInvalid())
+            return std::nullopt;
+
+        auto [FID, Offset] = SM.getDecomposedLoc(Start);
+        bool Invalid = false;
+        llvm::StringRef Buffer = SM.getBufferData(FID, &Invalid);
+        if (Invalid || Offset > Buffer.size())
+            return std::nullopt;
+
+        clang::Lexer Lex(SM.getLocForStartOfFile(FID), LO,
+                         Buffer.begin(), Buffer.begin() + Offset, Buffer.end());
+        size_t NumIds = Ids.size();
+        auto Fail = [&]() -> std::optional<clang::SourceRange>
+        {
+            Ids.resize(NumIds);
+            return std::nullopt;
+        };
+
+        clang::SourceLocation LBrace;
+        unsigned Depth = 0;
+        // The last three tokens, and the identifier among them that is
+        // recorded if it turns out to be declared
+        Token Prev2, Prev, Cur;
+        const clang::IdentifierInfo *CurII = nullptr;
+        clang::SourceLocation CurLoc;
+        // Depths of the braces of enum definitions
+        std::vector<unsigned> EnumDepths;
+        bool AfterEnum = false;
+        clang::Token Tok;
+        while (true)
+        {
+            bool AtEOF = Lex.LexFromRawLexer(Tok);
+            if (Tok.is(clang::tok::eof))
+                return Fail();
+
+            // Builtin macros such as _Pragma and __LINE__ are defined too.
+            // Names split by escaped newlines are looked up by their
+            // cleaned spelling.
+            clang::IdentifierInfo *II = nullptr;
+            Token Next;
+            Next.Kind = Tok.getKind();
+            if (Tok.is(clang::tok::raw_identifier))
+            {
+                II = PP.LookUpIdentifierInfo(Tok);
+                Next.Kind = II->getTokenID();
+                Next.IsKeyword = Next.Kind != clang::tok::identifier;
+            }
+            if (CurII &&
+                isDeclaredName(Prev2, Prev, Next,
+                               !EnumDepths.empty() &&
+                                   EnumDepths.back() == Depth))
+                Ids.push_back({CurII, CurLoc});
+            CurII = nullptr;
+
+            // Directives could define macros or include other files
+            if (Tok.is(clang::tok::hash) && Tok.isAtStartOfLine())
+                return Fail();
+
+            if (II)
+            {
+                if (II->hasMacroDefinition())
+                    return Fail();
+                // Function-try-blocks have handlers after the body
+                if (Depth == 0 && II->getTokenID() == clang::tok::kw_try)
+                    return Fail();
+                if (II->getTokenID() == clang::tok::identifier)
+                {
+                    CurII = II;
+                    CurLoc = Tok.getLocation();
+                }
+            }
+            else if (Tok.is(clang::tok::l_brace))
+            {
+                if (Depth++ == 0)
+                    LBrace = Tok.getLocation();
+                else if (AfterEnum)
+                    EnumDepths.push_back(Depth);
+            }
+            else if (Tok.is(clang::tok::r_brace))
+            {
+                if (Depth == 0)
+                    return Fail();
+                if (!EnumDepths.empty() && EnumDepths.back() == Depth)
+                    EnumDepths.pop_back();
+                if (--Depth == 0)
+                    return clang::SourceRange(LBrace, Tok.getLocation());
+            }
+            // Constructor initializers may contain braces of their own
+            else if (Depth == 0 && Tok.isOneOf(clang::tok::colon,
+                                               clang::tok::equal))
+                return Fail();
+
+            // An enum's braces follow the keyword, or the keyword and tag
+            if (Next.Kind == clang::tok::kw_enum)
+                AfterEnum = true;
+            else if (Next.Kind != clang::tok::identifier)
+                AfterEnum = false;
+
+            Prev2 = Prev;
+            Prev = Cur;
+            Cur = Next;
+
+            if (AtEOF)
+                return Fail();
+        }
+    }
+} // namespace cpp2c
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "clang/AST/Decl.h"
+#include "clang/Basic/IdentifierTable.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Lex/Preprocessor.h"
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace cpp2c
+{
+    // Raw-lexes the body of a function definition that the parser is about
+    // to parse, to check whether the preprocessor will expand any macro
+    // within it.
+    // Since a body without directives can not change which macros are
+    // defined, a body is unexpanded if none of its identifiers names a
+    // macro that is defined when the parser reaches it.
+    class FunctionBodyScanner
+    {
+    public:
+        using Identifiers = std::vector<
+            std::pair<const clang::IdentifierInfo *, clang::SourceLocation>>;
+
+        explicit FunctionBodyScanner(clang::Preprocessor &PP);
+
+        // Returns the range from the opening to the closing brace of the
+        // body of D, if the body is written in a single file and contains
+        // no directives and no names of defined macros.
+        // Appends the identifiers in the body that may name a declaration
+        // to Ids if so.
+        std::optional<clang::SourceRange> findUnexpandedBody(
+            const clang::Decl *D,
+            Identifiers &Ids);
+
+    private:
+        clang::Preprocessor &PP;
+    };
+} // namespace cpp2c
@@ -0,0 +1,188 @@
+#include "InvocationDedup.hh"
+
+#include "clang/Basic/FileManager.h"
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/xxhash.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <map>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+namespace cpp2c
+{
+    InvocationDedup::InvocationDedup(clang::SourceManager &SM, std::string Dir)
+        : SM(SM), Dir(std::move(Dir)) {}
+
+    std::optional<std::string> InvocationDedup::getKey(clang::FileID FID)
+    {
+        auto Res = FileKeys.try_emplace(FID);
+        if (!Res.second)
+            return Res.first->second;
+
+        // Copies of a header at different paths are different headers to
+        // the loaders, since their invocations' locations differ
+        auto FE = SM.getFileEntryForID(FID);
+        if (!FE || FE->tryGetRealPathName().empty())
+            return std::nullopt;
+        bool Invalid = false;
+        llvm::StringRef Buffer = SM.getBufferData(FID, &Invalid);
+        if (!Invalid)
+            Res.first->second =
+                llvm::utohexstr(llvm::xxHash64(FE->tryGetRealPathName()),
+                                /*LowerCase=*/true) +
+                "-" +
+                llvm::utohexstr(llvm::xxHash64(Buffer), /*LowerCase=*/true);
+        return Res.first->second;
+    }
+
+    // Reads or writes all of Size bytes, retrying after interruptions and
+    // partial transfers
+    template <typename Transfer, typename Ptr>
+    static bool transferAll(Transfer T, int FD, Ptr Data, size_t Size)
+    {
+        while (Size > 0)
+        {
+            auto N = T(FD, Data, Size);
+            if (N < 0 && errno == EINTR)
+                continue;
+            if (N <= 0)
+                return false;
+            Data += N;
+            Size -= N;
+        }
+        return true;
+    }
+
+    // Reads the offsets in the locked file FD, which is an array of the
+    // offsets claimed so far, and returns the size of its whole records
+    static std::optional<size_t> readOffsets(int FD,
+                                             std::vector<uint32_t> &Offsets)
+    {
+        off_t Size = ::lseek(FD, 0, SEEK_END);
+        if (Size < 0)
+            return std::nullopt;
+        Offsets.resize(Size / sizeof(uint32_t));
+        size_t Bytes = Offsets.size() * sizeof(uint32_t);
+        if (::lseek(FD, 0, SEEK_SET) != 0 ||
+            !transferAll(::read, FD, reinterpret_cast<char *>(Offsets.data()),
+                         Bytes))
+            return std::nullopt;
+        return Bytes;
+    }
+
+    std::optional<llvm::DenseSet<unsigned>>
+    InvocationDedup::readClaims(llvm::StringRef Key)
+    {
+        auto Path = Dir + "/" + Key.str();
+        int FD = ::open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (FD < 0)
+        {
+            // Nothing was committed for the file yet
+            if (errno == ENOENT)
+                return llvm::DenseSet<unsigned>();
+            return std::nullopt;
+        }
+
+        std::optional<llvm::DenseSet<unsigned>> Taken;
+        if (::flock(FD, LOCK_SH) == 0)
+        {
+            std::vector<uint32_t> Existing;
+            if (readOffsets(FD, Existing))
+                Taken.emplace(Existing.begin(), Existing.end());
+            ::flock(FD, LOCK_UN);
+        }
+        ::close(FD);
+        return Taken;
+    }
+
+    bool InvocationDedup::appendClaims(llvm::StringRef Key,
+                                       const std::vector<unsigned> &Offsets)
+    {
+        auto Path = Dir + "/" + Key.str();
+        int FD = ::open(Path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (FD < 0)
+            return false;
+
+        bool Appended = false;
+        if (::flock(FD, LOCK_EX) == 0)
+        {
+            std::vector<uint32_t> Existing;
+            if (auto Bytes = readOffsets(FD, Existing))
+            {
+                llvm::DenseSet<unsigned> Set(Existing.begin(), Existing.end());
+                std::vector<uint32_t> New;
+                for (auto Offset : Offsets)
+                    if (Set.insert(Offset).second)
+                        New.push_back(Offset);
+
+                // A record cut short by a failed write would misalign
+                // every later one, so append after the last whole record
+                Appended =
+                    ::lseek(FD, *Bytes, SEEK_SET) ==
+                        static_cast<off_t>(*Bytes) &&
+                    transferAll(::write, FD,
+                                reinterpret_cast<const char *>(New.data()),
+                                New.size() * sizeof(uint32_t));
+            }
+            ::flock(FD, LOCK_UN);
+        }
+        ::close(FD);
+        return Appended;
+    }
+
+    std::vector<bool> InvocationDedup::claim(
+        llvm::ArrayRef<clang::SourceLocation> Locs)
+    {
+        std::vector<bool> Result(Locs.size(), true);
+
+        // Indices and offsets of the locations, grouped by their files
+        std::map<std::string, std::vector<std::pair<size_t, unsigned>>> ByFile;
+        for (size_t I = 0; I < Locs.size(); ++I)
+        {
+            auto L = Locs[I];
+            if (L.isInvalid() || !L.isFileID() || SM.isInMainFile(L))
+                continue;
+            auto [FID, Offset] = SM.getDecomposedLoc(L);
+            if (auto Key = getKey(FID))
+                ByFile[*Key].push_back({I, Offset});
+        }
+
+        for (auto &&[Key, Entries] : ByFile)
+        {
+            // Locations this translation unit claimed before, such as in
+            // another inclusion of the same header, are still its own
+            auto &Own = Claimed[Key];
+            bool HasNew = false;
+            for (auto &&[I, Offset] : Entries)
+                HasNew |= !Own.count(Offset);
+            if (!HasNew)
+                continue;
+
+            auto Taken = readClaims(Key);
+            for (auto &&[I, Offset] : Entries)
+                if (!Own.count(Offset) && (!Taken || !Taken->count(Offset)))
+                {
+                    Own.insert(Offset);
+                    Staged[Key].push_back(Offset);
+                }
+            for (auto &&[I, Offset] : Entries)
+                Result[I] = Own.count(Offset) > 0;
+        }
+        return Result;
+    }
+
+    void InvocationDedup::commit()
+    {
+        // Claims that could not be recorded only make other translation
+        // units report the same invocations again
+        for (auto &&Entry : Staged)
+            appendClaims(Entry.getKey(), Entry.getValue());
+        Staged.clear();
+    }
+} // namespace cpp2c
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringMap.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace cpp2c
+{
+    // Set of invocation locations in header files shared by the translation
+    // units of a program, so that an invocation in a widely included header
+    // is only analyzed by one translation unit.
+    // Locations are keyed by the real path of their file, the hash of its
+    // contents, and their offset in it.
+    // The set is kept in a directory with one file of claimed offsets per
+    // header, which concurrent compiler processes lock while they access it.
+    // A translation unit only records its claims once its facts are
+    // written, so that the invocations of one that crashes or is killed
+    // are not lost; translation units analyzing the same header at the
+    // same time may both report its invocations.
+    class InvocationDedup
+    {
+    public:
+        InvocationDedup(clang::SourceManager &SM, std::string Dir);
+
+        // Returns whether each of the given file locations belongs to this
+        // translation unit, rather than to one whose claims were recorded
+        // before, and stages the ones that do.
+        // Locations in the main file, and locations that can not be keyed,
+        // always belong to this translation unit.
+        std::vector<bool> claim(llvm::ArrayRef<clang::SourceLocation> Locs);
+
+        // Records the staged claims in the shared directory.
+        // Only call once the facts of the claimed invocations are written.
+        void commit();
+
+    private:
+        clang::SourceManager &SM;
+        std::string Dir;
+        // Key of each file, if its real path and buffer could be read
+        llvm::DenseMap<clang::FileID, std::optional<std::string>> FileKeys;
+        // Offsets claimed by this translation unit, per key
+        llvm::StringMap<llvm::DenseSet<unsigned>> Claimed;
+        // Offsets claimed by this translation unit and not yet committed
+        llvm::StringMap<std::vector<unsigned>> Staged;
+
+        std::optional<std::string> getKey(clang::FileID FID);
+
+        // Returns the offsets recorded in the shared file for Key, or
+        // nothing if the file could not be read
+        std::optional<llvm::DenseSet<unsigned>> readClaims(llvm::StringRef Key);
+
+        // Adds Offsets to the shared file for Key, unless already there
+        bool appendClaims(llvm::StringRef Key,
+                          const std::vector<unsigned> &Offsets);
+    };
+} // namespace cpp2c
@@ -1,6 +1,8 @@
 #pragma once
 #include <string>
 
+#include "llvm/Support/raw_ostream.h"
+
 namespace cpp2c
 {
     static const constexpr bool Debug = false;
@@ -10,13 +12,22 @@ namespace cpp2c
     inline std::string fmt(bool b) { return b ? "T" : "F"; }
     inline std::string fmt(unsigned int i) { return std::to_string(i); }
 
+    // Stream that print writes to on this thread.
+    // Drivers that analyze translation units on several threads point it
+    // at the output of the translation unit each thread is analyzing.
+    inline llvm::raw_ostream *&output()
+    {
+        thread_local llvm::raw_ostream *OS = &llvm::outs();
+        return OS;
+    }
+
     template <typename T>
-    inline void print(T t) { llvm::outs() << fmt(t) << "\n"; }
+    inline void print(T t) { *output() << fmt(t) << "\n"; }
 
     template <typename T1, typename T2, typename... Ts>
     inline void print(T1 t1, T2 t2, Ts... ts)
     {
-        llvm::outs() << fmt(t1) << delim;
+        *output() << fmt(t1) << delim;
         print(t2, ts...);
     }
 
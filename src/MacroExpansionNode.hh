@@ -4,6 +4,7 @@
 #include "DeclStmtTypeLoc.hh"
 
 #include "clang/AST/Stmt.h"
+#include "clang/Basic/IdentifierTable.h"
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Lex/MacroInfo.h"
 
@@ -21,6 +22,8 @@ namespace cpp2c
     public:
         // Info about the macro this is an expansion of
         clang::MacroInfo *MI;
+        // The identifier of the expanded macro
+        const clang::IdentifierInfo *II = nullptr;
         // The name of the expanded macro
         llvm::StringRef Name;
         // The hash of the macro this expansion is an expansion of.
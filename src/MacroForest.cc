@@ -7,6 +7,7 @@
 #include "clang/Lex/MacroArgs.h"
 #include "clang/Lex/MacroInfo.h"
 
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/Support/raw_ostream.h"
 
 // TODO:    Check if we should treat expansions written in scratch space
@@ -40,7 +41,8 @@ namespace cpp2c
 
         auto Expansion = new MacroExpansionNode();
         Expansion->MI = MD.getMacroInfo();
-        Expansion->Name = MacroNameTok.getIdentifierInfo()->getName();
+        Expansion->II = MacroNameTok.getIdentifierInfo();
+        Expansion->Name = Expansion->II->getName();
         Expansion->MacroHash = MI->getDefinitionLoc().printToString(SM);
         Expansion->DefinitionRange = clang::SourceRange(
             MI->getDefinitionLoc(),
@@ -166,4 +168,33 @@ namespace cpp2c
         }
     }
 
+    void MacroForest::releaseExpansions(size_t Begin, size_t End)
+    {
+        llvm::SmallPtrSet<cpp2c::MacroExpansionNode *, 16> Released;
+        for (size_t I = Begin; I < End; ++I)
+            if (Expansions[I])
+                Released.insert(Expansions[I]);
+
+        // Remove the released expansions from the invocation stack, while
+        // keeping the order of the remaining ones
+        std::vector<cpp2c::MacroExpansionNode *> Kept;
+        while (!InvocationStack.empty())
+        {
+            if (!Released.count(InvocationStack.top()))
+                Kept.push_back(InvocationStack.top());
+            InvocationStack.pop();
+        }
+        for (auto It = Kept.rbegin(); It != Kept.rend(); ++It)
+            InvocationStack.push(*It);
+
+        // Only delete top level expansions since deconstructor deletes
+        // nested expansions
+        for (size_t I = Begin; I < End; ++I)
+        {
+            if (Expansions[I] && Expansions[I]->Depth == 0)
+                delete Expansions[I];
+            Expansions[I] = nullptr;
+        }
+    }
+
 } // namespace cpp2c
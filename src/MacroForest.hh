@@ -32,5 +32,10 @@ namespace cpp2c
                           const clang::MacroDefinition &MD,
                           clang::SourceRange Range,
                           const clang::MacroArgs *Args) override;
+
+        // Deletes the expansions in Expansions[Begin, End), which must
+        // include all descendants of the top-level expansions among them,
+        // and clears their entries
+        void releaseExpansions(size_t Begin, size_t End);
     };
 } // namespace cpp2c
@@ -0,0 +1,397 @@
+#include "MacroSnapshot.hh"
+
+#include "json.hpp"
+
+#include "clang/Basic/FileManager.h"
+#include "clang/Lex/MacroInfo.h"
+#include "clang/Serialization/ModuleFile.h"
+#include "clang/Serialization/ModuleManager.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+namespace cpp2c
+{
+    using nlohmann::json;
+
+    // Snapshots written by other versions of the format are not loaded
+    static const int SnapshotVersion = 1;
+
+    static std::string getRealPath(const clang::FileEntry *FE)
+    {
+        return FE ? FE->tryGetRealPathName().str() : std::string();
+    }
+
+    // Tokens are stored as arrays of their kind, location, length, flags,
+    // and identifier, if any
+    static json writeToken(const clang::Token &Tok)
+    {
+        std::string Name;
+        if (!Tok.isAnnotation() && Tok.isNot(clang::tok::raw_identifier))
+            if (auto II = Tok.getIdentifierInfo())
+                Name = II->getName().str();
+        return json::array({static_cast<unsigned>(Tok.getKind()),
+                            Tok.getLocation().getRawEncoding(),
+                            Tok.getLength(),
+                            Tok.getFlags(),
+                            Name});
+    }
+
+    static json writeTokens(llvm::ArrayRef<clang::Token> Tokens)
+    {
+        json Result = json::array();
+        for (auto &&Tok : Tokens)
+            Result.push_back(writeToken(Tok));
+        return Result;
+    }
+
+    bool writeMacroSnapshot(llvm::StringRef Path,
+                            clang::SourceManager &SM,
+                            const MacroForest &MF,
+                            const DefinitionInfoCollector &DC,
+                            const IncludeCollector &IC,
+                            std::string &Error)
+    {
+        json Macros = json::array();
+        llvm::DenseMap<const clang::MacroInfo *, int> MacroIndices;
+        auto addMacro = [&](const clang::MacroInfo *MI) -> int
+        {
+            if (!MI)
+                return -1;
+            auto Res = MacroIndices.try_emplace(MI, Macros.size());
+            if (!Res.second)
+                return Res.first->second;
+
+            json Params = json::array();
+            for (auto &&P : MI->params())
+                Params.push_back(P->getName().str());
+            Macros.push_back({
+                {"DefinitionLoc", MI->getDefinitionLoc().getRawEncoding()},
+                {"DefinitionEndLoc", MI->getDefinitionEndLoc().getRawEncoding()},
+                {"FunctionLike", MI->isFunctionLike()},
+                {"C99Varargs", MI->isC99Varargs()},
+                {"GNUVarargs", MI->isGNUVarargs()},
+                {"Params", Params},
+                {"Tokens", writeTokens(MI->tokens())},
+            });
+            return Res.first->second;
+        };
+
+        json Definitions = json::array();
+        for (auto &&[II, MD] : DC.MacroNamesDefinitions)
+            Definitions.push_back({
+                {"Name", II->getName().str()},
+                {"Macro", addMacro(MD ? MD->getMacroInfo() : nullptr)},
+                {"Loc", MD ? MD->getLocation().getRawEncoding() : 0},
+            });
+
+        json InspectedNames = json::array();
+        for (auto &&II : DC.InspectedMacroNames)
+            InspectedNames.push_back(II->getName().str());
+
+        // Files whose changes make the snapshot stale
+        std::set<std::string> Files;
+        Files.insert(getRealPath(SM.getFileEntryForID(SM.getMainFileID())));
+        json Includes = json::array();
+        for (auto &&[FE, HashLoc] : IC.IncludeEntriesLocs)
+        {
+            json File = nullptr;
+            if (FE)
+            {
+                File = getRealPath(FE);
+                Files.insert(getRealPath(FE));
+            }
+            Includes.push_back({{"File", File},
+                                {"HashLoc", HashLoc.getRawEncoding()}});
+        }
+        Files.erase(std::string());
+
+        llvm::DenseMap<const MacroExpansionNode *, int> ExpansionIndices;
+        json Expansions = json::array();
+        for (auto &&Exp : MF.Expansions)
+        {
+            ExpansionIndices[Exp] = Expansions.size();
+            if (!Exp)
+            {
+                Expansions.push_back(nullptr);
+                continue;
+            }
+
+            json Arguments = json::array();
+            int ArgDefBeginsWith = -1, ArgDefEndsWith = -1;
+            for (size_t I = 0; I < Exp->Arguments.size(); ++I)
+            {
+                auto &Arg = Exp->Arguments[I];
+                Arguments.push_back({
+                    {"Name", Arg.Name.str()},
+                    {"NumExpansions", Arg.NumExpansions},
+                    {"Tokens", writeTokens(Arg.Tokens)},
+                    {"TokensWithTail", writeTokens(Arg.TokensWithTail)},
+                });
+                if (Exp->ArgDefBeginsWith == &Arg)
+                    ArgDefBeginsWith = I;
+                if (Exp->ArgDefEndsWith == &Arg)
+                    ArgDefEndsWith = I;
+            }
+
+            Expansions.push_back({
+                {"Name", Exp->Name.str()},
+                {"Macro", addMacro(Exp->MI)},
+                {"SpellingRange",
+                 {Exp->SpellingRange.getBegin().getRawEncoding(),
+                  Exp->SpellingRange.getEnd().getRawEncoding()}},
+                {"Parent", Exp->Parent ? ExpansionIndices.lookup(Exp->Parent)
+                                       : -1},
+                {"InMacroArg", Exp->InMacroArg},
+                {"HasStringification", Exp->HasStringification},
+                {"HasTokenPasting", Exp->HasTokenPasting},
+                {"Arguments", Arguments},
+                {"ArgDefBeginsWith", ArgDefBeginsWith},
+                {"ArgDefEndsWith", ArgDefEndsWith},
+            });
+        }
+
+        nlohmann::ordered_json Snapshot;
+        Snapshot["Version"] = SnapshotVersion;
+        Snapshot["MainFile"] =
+            getRealPath(SM.getFileEntryForID(SM.getMainFileID()));
+        Snapshot["Files"] = Files;
+        Snapshot["Macros"] = std::move(Macros);
+        Snapshot["Definitions"] = std::move(Definitions);
+        Snapshot["InspectedNames"] = std::move(InspectedNames);
+        Snapshot["Includes"] = std::move(Includes);
+        Snapshot["Expansions"] = std::move(Expansions);
+
+        // Readers never see a partial snapshot
+        std::string TmpPath = Path.str() + ".tmp";
+        {
+            std::ofstream File(TmpPath);
+            File << Snapshot.dump();
+            if (!File.good())
+            {
+                Error = "could not write " + TmpPath;
+                return false;
+            }
+        }
+        if (auto EC = llvm::sys::fs::rename(TmpPath, Path))
+        {
+            Error = "could not write " + Path.str() + ": " + EC.message();
+            return false;
+        }
+        return true;
+    }
+
+    bool readMacroSnapshot(llvm::StringRef Path,
+                           clang::Preprocessor &PP,
+                           clang::ASTReader &Reader,
+                           MacroForest &MF,
+                           DefinitionInfoCollector &DC,
+                           IncludeCollector &IC,
+                           std::string &Error)
+    {
+        auto &SM = PP.getSourceManager();
+        auto &Allocator = PP.getPreprocessorAllocator();
+        auto &Module = Reader.getModuleManager().getPrimaryModule();
+
+        auto readLoc = [&](const json &J)
+        {
+            auto Raw = J.get<clang::SourceLocation::UIntTy>();
+            if (Raw == 0)
+                return clang::SourceLocation();
+            return Reader.TranslateSourceLocation(
+                Module, clang::SourceLocation::getFromRawEncoding(Raw));
+        };
+        auto readIdentifier = [&](const json &J) -> clang::IdentifierInfo *
+        {
+            auto Name = J.get<std::string>();
+            return Name.empty() ? nullptr : PP.getIdentifierInfo(Name);
+        };
+        auto readTokens = [&](const json &J)
+        {
+            std::vector<clang::Token> Tokens;
+            for (auto &&T : J)
+            {
+                clang::Token Tok;
+                Tok.startToken();
+                Tok.setKind(static_cast<clang::tok::TokenKind>(
+                    T.at(0).get<unsigned>()));
+                Tok.setLocation(readLoc(T.at(1)));
+                Tok.setLength(T.at(2).get<unsigned>());
+                Tok.setFlag(static_cast<clang::Token::TokenFlags>(
+                    T.at(3).get<unsigned>()));
+                if (auto II = readIdentifier(T.at(4)))
+                    Tok.setIdentifierInfo(II);
+                Tokens.push_back(Tok);
+            }
+            return Tokens;
+        };
+
+        try
+        {
+            std::ifstream File(Path.str());
+            if (!File)
+            {
+                Error = "could not open " + Path.str();
+                return false;
+            }
+            json Snapshot;
+            File >> Snapshot;
+
+            if (Snapshot.at("Version").get<int>() != SnapshotVersion)
+            {
+                Error = Path.str() + " was written by another version of cpp2c";
+                return false;
+            }
+            // The AST file was written from the main file of the
+            // translation unit that wrote the snapshot, which is not the
+            // main file of this one if the AST file is a preamble
+            llvm::SmallString<256> OriginalFile;
+            if (llvm::sys::fs::real_path(Module.OriginalSourceFileName,
+                                         OriginalFile) ||
+                Snapshot.at("MainFile").get<std::string>() !=
+                    OriginalFile.str())
+            {
+                Error = Path.str() + " was not written for this AST file";
+                return false;
+            }
+
+            std::vector<clang::MacroInfo *> Macros;
+            for (auto &&M : Snapshot.at("Macros"))
+            {
+                auto MI = PP.AllocateMacroInfo(readLoc(M.at("DefinitionLoc")));
+                MI->setDefinitionEndLoc(readLoc(M.at("DefinitionEndLoc")));
+                if (M.at("FunctionLike").get<bool>())
+                    MI->setIsFunctionLike();
+                if (M.at("C99Varargs").get<bool>())
+                    MI->setIsC99Varargs();
+                if (M.at("GNUVarargs").get<bool>())
+                    MI->setIsGNUVarargs();
+                std::vector<clang::IdentifierInfo *> Params;
+                for (auto &&P : M.at("Params"))
+                    Params.push_back(readIdentifier(P));
+                MI->setParameterList(Params, Allocator);
+                MI->setTokens(readTokens(M.at("Tokens")), Allocator);
+                Macros.push_back(MI);
+            }
+            auto readMacro = [&](const json &J) -> clang::MacroInfo *
+            {
+                auto I = J.get<int>();
+                return I < 0 ? nullptr : Macros.at(I);
+            };
+
+            for (auto &&D : Snapshot.at("Definitions"))
+            {
+                auto MI = readMacro(D.at("Macro"));
+                DC.MacroNamesDefinitions.push_back(
+                    {readIdentifier(D.at("Name")),
+                     MI ? PP.AllocateDefMacroDirective(MI, readLoc(D.at("Loc")))
+                        : nullptr});
+            }
+            for (auto &&Name : Snapshot.at("InspectedNames"))
+                DC.InspectedMacroNames.insert(readIdentifier(Name));
+
+            auto &FM = SM.getFileManager();
+            for (auto &&I : Snapshot.at("Includes"))
+            {
+                const clang::FileEntry *FE = nullptr;
+                if (!I.at("File").is_null())
+                    if (auto Ref = FM.getOptionalFileRef(
+                            I.at("File").get<std::string>()))
+                        FE = &Ref->getFileEntry();
+                IC.IncludeEntriesLocs.emplace_back(FE, readLoc(I.at("HashLoc")));
+            }
+
+            for (auto &&E : Snapshot.at("Expansions"))
+            {
+                if (E.is_null())
+                {
+                    MF.Expansions.push_back(nullptr);
+                    continue;
+                }
+                // Owned by the forest from here on, so that it is released
+                // even if the rest of the snapshot is malformed
+                auto Exp = new MacroExpansionNode();
+                MF.Expansions.push_back(Exp);
+
+                Exp->MI = readMacro(E.at("Macro"));
+                Exp->II = readIdentifier(E.at("Name"));
+                if (!Exp->MI || !Exp->II)
+                    throw std::runtime_error("expansion without a macro");
+                Exp->Name = Exp->II->getName();
+                Exp->MacroHash = Exp->MI->getDefinitionLoc().printToString(SM);
+                Exp->DefinitionRange = clang::SourceRange(
+                    Exp->MI->getDefinitionLoc(),
+                    Exp->MI->getDefinitionEndLoc());
+                Exp->DefinitionTokens = Exp->MI->tokens();
+                Exp->SpellingRange = clang::SourceRange(
+                    readLoc(E.at("SpellingRange").at(0)),
+                    readLoc(E.at("SpellingRange").at(1)));
+                Exp->InMacroArg = E.at("InMacroArg").get<bool>();
+                Exp->HasStringification =
+                    E.at("HasStringification").get<bool>();
+                Exp->HasTokenPasting = E.at("HasTokenPasting").get<bool>();
+
+                // Parents precede their children
+                auto Parent = E.at("Parent").get<int>();
+                if (Parent < 0)
+                    Exp->Depth = 0;
+                else
+                {
+                    if (static_cast<size_t>(Parent) + 1 >= MF.Expansions.size() ||
+                        !MF.Expansions[Parent])
+                        throw std::runtime_error("expansion without a parent");
+                    Exp->Parent = MF.Expansions[Parent];
+                    Exp->Parent->Children.push_back(Exp);
+                    Exp->Depth = Exp->Parent->Depth + 1;
+                }
+
+                for (auto &&A : E.at("Arguments"))
+                {
+                    MacroExpansionArgument Arg;
+                    if (auto II = readIdentifier(A.at("Name")))
+                        Arg.Name = II->getName();
+                    Arg.NumExpansions = A.at("NumExpansions").get<unsigned>();
+                    Arg.Tokens = readTokens(A.at("Tokens"));
+                    Arg.TokensWithTail = readTokens(A.at("TokensWithTail"));
+                    Exp->Arguments.push_back(std::move(Arg));
+                }
+                auto readArgument = [&](const json &J) -> MacroExpansionArgument *
+                {
+                    auto I = J.get<int>();
+                    return I < 0 ? nullptr : &Exp->Arguments.at(I);
+                };
+                Exp->ArgDefBeginsWith = readArgument(E.at("ArgDefBeginsWith"));
+                Exp->ArgDefEndsWith = readArgument(E.at("ArgDefEndsWith"));
+            }
+        }
+        catch (const std::exception &E)
+        {
+            Error = "malformed snapshot " + Path.str() + ": " + E.what();
+            return false;
+        }
+        return true;
+    }
+
+    void moveIncludesToMainFile(clang::SourceManager &SM,
+                                clang::ASTReader &Reader,
+                                IncludeCollector &IC)
+    {
+        auto &Module = Reader.getModuleManager().getPrimaryModule();
+        auto HeaderFID =
+            Reader.TranslateFileID(Module, Module.OriginalSourceFileID);
+        if (HeaderFID.isInvalid())
+            return;
+
+        auto Start = SM.getLocForStartOfFile(SM.getMainFileID());
+        for (auto &&IEL : IC.IncludeEntriesLocs)
+            if (IEL.second.isValid() &&
+                SM.getFileID(IEL.second) == HeaderFID)
+                IEL.second = Start;
+    }
+} // namespace cpp2c
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "DefinitionInfoCollector.hh"
+#include "IncludeCollector.hh"
+#include "MacroForest.hh"
+
+#include "clang/Basic/SourceManager.h"
+#include "clang/Lex/Preprocessor.h"
+#include "clang/Serialization/ASTReader.h"
+
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+
+namespace cpp2c
+{
+    // Macro snapshots hold what the preprocessor callbacks record about a
+    // translation unit: the macro expansions in MacroForest, and the
+    // definitions, inspected names and includes that the collectors
+    // record.
+    // Clang's serialized AST does not hold these in a form we can use, and
+    // the callbacks do not run when the AST is loaded, so a snapshot is
+    // written along with the AST, or precompiled header, and loaded with
+    // it.
+    // Source locations are stored as they are in the writing translation
+    // unit, which are the locations the AST file stores, and translated
+    // into the loading translation unit by the AST reader.
+
+    // Writes the snapshot of MF, DC and IC to Path.
+    // Returns false and sets Error on failure.
+    bool writeMacroSnapshot(llvm::StringRef Path,
+                            clang::SourceManager &SM,
+                            const MacroForest &MF,
+                            const DefinitionInfoCollector &DC,
+                            const IncludeCollector &IC,
+                            std::string &Error);
+
+    // Reads the snapshot at Path into MF, DC and IC, which must be empty.
+    // Reader must have loaded the AST file written along with the
+    // snapshot as its primary module, either as the AST of this
+    // translation unit or as the precompiled preamble it is parsed with.
+    // Returns false and sets Error on failure.
+    bool readMacroSnapshot(llvm::StringRef Path,
+                           clang::Preprocessor &PP,
+                           clang::ASTReader &Reader,
+                           MacroForest &MF,
+                           DefinitionInfoCollector &DC,
+                           IncludeCollector &IC,
+                           std::string &Error);
+
+    // Moves the includes in IC that are written in the header of the
+    // precompiled preamble that Reader loaded to the start of the main file.
+    // The header only holds the include block that the main file starts
+    // with, so the includes are then attributed as in a full parse.
+    void moveIncludesToMainFile(clang::SourceManager &SM,
+                                clang::ASTReader &Reader,
+                                IncludeCollector &IC);
+} // namespace cpp2c
@@ -0,0 +1,96 @@
+#include "NameIndex.hh"
+
+namespace cpp2c
+{
+    NameIndex::NameIndex(const TUOrder &TUO,
+                         const DefinitionInfoCollector &DC,
+                         const std::vector<const clang::Decl *> &Decls)
+        : TUO(TUO)
+    {
+        addDefinitions(DC);
+        addDecls(Decls);
+    }
+
+    void NameIndex::addDefinitions(const DefinitionInfoCollector &DC)
+    {
+        auto &SM = TUO.getSourceManager();
+        for (; NumDefinitions < DC.MacroNamesDefinitions.size();
+             ++NumDefinitions)
+        {
+            auto &Entry = DC.MacroNamesDefinitions[NumDefinitions];
+            if (Entry.first && Entry.second)
+                noteLocation(FirstMacroDefinition,
+                             Entry.first->getName(),
+                             SM.getFileLoc(Entry.second
+                                               ->getDefinition()
+                                               .getLocation()));
+        }
+    }
+
+    void NameIndex::addDecls(const std::vector<const clang::Decl *> &Decls)
+    {
+        auto &SM = TUO.getSourceManager();
+        for (auto &&D : Decls)
+            if (auto ND = clang::dyn_cast_or_null<clang::NamedDecl>(D))
+                if (auto II = ND->getIdentifier())
+                    noteLocation(FirstDeclaration,
+                                 II->getName(),
+                                 SM.getFileLoc(D->getBeginLoc()));
+    }
+
+    void NameIndex::addDeclarationName(llvm::StringRef Name,
+                                       clang::SourceLocation L)
+    {
+        noteLocation(FirstDeclaration, Name, L);
+    }
+
+    void NameIndex::noteLocation(llvm::StringMap<clang::SourceLocation> &Map,
+                                 llvm::StringRef Name,
+                                 clang::SourceLocation L)
+    {
+        if (L.isInvalid())
+            return;
+
+        auto Res = Map.try_emplace(Name, L);
+        if (!Res.second && TUO.isBefore(L, Res.first->second))
+            Res.first->second = L;
+    }
+
+    bool NameIndex::isFirstBefore(
+        const llvm::StringMap<clang::SourceLocation> &Map,
+        llvm::StringRef Name,
+        clang::SourceLocation L)
+    {
+        auto It = Map.find(Name);
+        return It != Map.end() && TUO.isBefore(It->second, L);
+    }
+
+    bool NameIndex::hasSameNameAsOtherDeclaration(const MacroExpansionNode *Exp)
+    {
+        // The result only depends on the definition of the expanded macro
+        auto Cached = SameNameCache.find(Exp->MI);
+        if (Cached != SameNameCache.end())
+            return Cached->second;
+
+        bool Result = false;
+        auto DefLoc = TUO.getSourceManager().getFileLoc(
+            Exp->MI->getDefinitionLoc());
+        if (DefLoc.isValid())
+        {
+            // First check if any macro defined before this macro has the
+            // same name as any of this macro's parameters
+            for (auto &&Arg : Exp->Arguments)
+                if (isFirstBefore(FirstMacroDefinition, Arg.Name, DefLoc))
+                {
+                    Result = true;
+                    break;
+                }
+            // Also check if any declarations declared before this macro
+            // have the same name as this macro
+            Result = Result || isFirstBefore(FirstDeclaration, Exp->Name, DefLoc);
+        }
+
+        SameNameCache[Exp->MI] = Result;
+        return Result;
+    }
+} // namespace cpp2c
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "DefinitionInfoCollector.hh"
+#include "MacroExpansionNode.hh"
+#include "TUOrder.hh"
+
+#include "clang/AST/Decl.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Lex/MacroInfo.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <vector>
+
+namespace cpp2c
+{
+    // Maps names to the earliest location in the translation unit where a
+    // macro with that name is defined, or a declaration with that name is
+    // declared.
+    // Built once per translation unit so that name clashes can be checked
+    // without scanning every definition and declaration per expansion.
+    class NameIndex
+    {
+    private:
+        const TUOrder &TUO;
+        // File location of the first definition of each macro name
+        llvm::StringMap<clang::SourceLocation> FirstMacroDefinition;
+        // File location of the first declaration of each identifier
+        llvm::StringMap<clang::SourceLocation> FirstDeclaration;
+        // Results of hasSameNameAsOtherDeclaration, per macro definition
+        llvm::DenseMap<const clang::MacroInfo *, bool> SameNameCache;
+        // Number of definitions recorded from the definition collector
+        size_t NumDefinitions = 0;
+
+        // Records L as the location of Name if it is earlier than the
+        // one recorded so far
+        void noteLocation(llvm::StringMap<clang::SourceLocation> &Map,
+                          llvm::StringRef Name,
+                          clang::SourceLocation L);
+
+        // Returns true if the first location recorded for Name in Map
+        // comes before L
+        bool isFirstBefore(const llvm::StringMap<clang::SourceLocation> &Map,
+                           llvm::StringRef Name,
+                           clang::SourceLocation L);
+
+    public:
+        NameIndex(const TUOrder &TUO,
+                  const DefinitionInfoCollector &DC,
+                  const std::vector<const clang::Decl *> &Decls);
+
+        // Records the macros defined since the last call.
+        // Results only depend on definitions and declarations which come
+        // before the expanded macro's definition, so while parsing, they
+        // can be queried as soon as the expansion has been parsed.
+        void addDefinitions(const DefinitionInfoCollector &DC);
+
+        // Records the names of the given declarations
+        void addDecls(const std::vector<const clang::Decl *> &Decls);
+
+        // Records a possible declaration of Name at the file location L,
+        // such as an identifier in a function body that was not parsed
+        void addDeclarationName(llvm::StringRef Name, clang::SourceLocation L);
+
+        // Returns true if a macro defined before the expanded macro has the
+        // same name as one of its parameters, or a declaration declared
+        // before the expanded macro has the same name as the macro itself
+        bool hasSameNameAsOtherDeclaration(const MacroExpansionNode *Exp);
+    };
+} // namespace cpp2c
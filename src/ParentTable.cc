@@ -0,0 +1,332 @@
+#include "ParentTable.hh"
+
+#include "clang/AST/RecursiveASTVisitor.h"
+
+namespace cpp2c
+{
+    // Traverses the roots of a parent table the same way clang's parent map
+    // traverses the whole translation unit, and records each node under
+    // the node on top of the stack
+    class ParentTableBuilder
+        : public clang::RecursiveASTVisitor<ParentTableBuilder>
+    {
+        using Base = clang::RecursiveASTVisitor<ParentTableBuilder>;
+
+        struct Frame
+        {
+            uint32_t ID;
+            // Whether this node or one of its ancestors on the current
+            // path requires an ICE
+            bool ICE;
+        };
+
+        ParentTable &PT;
+        llvm::SmallVector<Frame, 64> Stack;
+
+        static bool requiresICE(const clang::Decl *D)
+        {
+            if (llvm::isa<clang::EnumDecl>(D))
+                return true;
+            if (auto FD = llvm::dyn_cast<clang::FieldDecl>(D))
+                return FD->isBitField();
+            if (auto VD = llvm::dyn_cast<clang::VarDecl>(D))
+            {
+                auto QT = VD->getType();
+                if (!QT.isNull())
+                    if (auto T = QT.getTypePtrOrNull())
+                        return T->isArrayType();
+            }
+            return false;
+        }
+
+        void push(ParentTable::NodeKind Kind,
+                  const void *Ptr,
+                  const void *Data,
+                  bool RequiresICE)
+        {
+            Frame Top = Stack.back();
+            uint32_t NewID = PT.Nodes.size();
+
+            std::pair<uint32_t, bool> Res;
+            if (Kind == ParentTable::TypeLocNode ||
+                Kind == ParentTable::NNSLocNode)
+            {
+                auto It = PT.LocIDs.try_emplace({Ptr, Data}, NewID);
+                Res = {It.first->second, It.second};
+            }
+            else
+            {
+                auto It = PT.PointerIDs.try_emplace(Ptr, NewID);
+                Res = {It.first->second, It.second};
+            }
+
+            uint32_t ID = Res.first;
+            if (Res.second)
+            {
+                ParentTable::Node N;
+                N.Ptr = Ptr;
+                N.Parent = Top.ID;
+                N.Depth = PT.Nodes[Top.ID].Depth + 1;
+                N.Kind = Kind;
+                N.Flags = Top.ICE ? ParentTable::InICEContext : 0;
+                PT.Nodes.push_back(N);
+                if (Data)
+                    PT.LocData[ID] = Data;
+            }
+            else
+            {
+                // Nodes with multiple parents require an ICE if any of
+                // their ancestors do
+                auto &N = PT.Nodes[ID];
+                if (Top.ICE)
+                    N.Flags |= ParentTable::InICEContext;
+                if (N.Parent != Top.ID)
+                {
+                    auto &More = PT.MoreParents[ID];
+                    if (!llvm::is_contained(More, Top.ID))
+                        More.push_back(Top.ID);
+                }
+            }
+
+            Stack.push_back({ID, Top.ICE || RequiresICE});
+        }
+
+    public:
+        explicit ParentTableBuilder(ParentTable &PT) : PT(PT) {}
+
+        bool shouldVisitTemplateInstantiations() const { return true; }
+        bool shouldVisitImplicitCode() const { return true; }
+
+        void traverseRoot(const clang::Decl *D)
+        {
+            Stack.push_back({0, false});
+            TraverseDecl(const_cast<clang::Decl *>(D));
+            Stack.pop_back();
+        }
+
+        bool TraverseDecl(clang::Decl *D)
+        {
+            if (!D)
+                return true;
+            push(ParentTable::DeclNode, D, nullptr, requiresICE(D));
+            bool Result = Base::TraverseDecl(D);
+            Stack.pop_back();
+            return Result;
+        }
+
+        bool TraverseTypeLoc(clang::TypeLoc TL)
+        {
+            if (!TL)
+                return true;
+            push(ParentTable::TypeLocNode,
+                 TL.getType().getAsOpaquePtr(), TL.getOpaqueData(), false);
+            bool Result = Base::TraverseTypeLoc(TL);
+            Stack.pop_back();
+            return Result;
+        }
+
+        bool TraverseNestedNameSpecifierLoc(clang::NestedNameSpecifierLoc NNS)
+        {
+            if (!NNS)
+                return true;
+            push(ParentTable::NNSLocNode,
+                 NNS.getNestedNameSpecifier(), NNS.getOpaqueData(), false);
+            bool Result = Base::TraverseNestedNameSpecifierLoc(NNS);
+            Stack.pop_back();
+            return Result;
+        }
+
+        bool TraverseAttr(clang::Attr *A)
+        {
+            if (!A)
+                return true;
+            push(ParentTable::AttrNode, A, nullptr, false);
+            bool Result = Base::TraverseAttr(A);
+            Stack.pop_back();
+            return Result;
+        }
+
+        // Statements are traversed with data recursion, like in clang's
+        // parent map
+        bool dataTraverseStmtPre(clang::Stmt *ST)
+        {
+            push(ParentTable::StmtNode, ST, nullptr,
+                 llvm::isa<clang::CaseStmt>(ST));
+            return true;
+        }
+
+        bool dataTraverseStmtPost(clang::Stmt *ST)
+        {
+            Stack.pop_back();
+            return true;
+        }
+    };
+
+    ParentTable::ParentTable(clang::ASTContext &Ctx,
+                             llvm::ArrayRef<const clang::Decl *> Roots)
+    {
+        // The translation unit is the root of the table
+        auto TU = Ctx.getTranslationUnitDecl();
+        Node Root;
+        Root.Ptr = TU;
+        Root.Parent = InvalidID;
+        Root.Depth = 0;
+        Root.Kind = DeclNode;
+        Root.Flags = 0;
+        Nodes.push_back(Root);
+        PointerIDs[TU] = 0;
+
+        ParentTableBuilder Builder(*this);
+        for (auto &&D : Roots)
+            Builder.traverseRoot(D);
+    }
+
+    uint32_t ParentTable::lookup(const clang::DynTypedNode &N) const
+    {
+        const void *Ptr = nullptr;
+        if (auto ST = N.get<clang::Stmt>())
+            Ptr = ST;
+        else if (auto D = N.get<clang::Decl>())
+            Ptr = D;
+        else if (auto A = N.get<clang::Attr>())
+            Ptr = A;
+        else if (auto TL = N.get<clang::TypeLoc>())
+        {
+            auto It = LocIDs.find({TL->getType().getAsOpaquePtr(),
+                                   TL->getOpaqueData()});
+            return It != LocIDs.end() ? It->second : InvalidID;
+        }
+        else if (auto NNS = N.get<clang::NestedNameSpecifierLoc>())
+        {
+            auto It = LocIDs.find({NNS->getNestedNameSpecifier(),
+                                   NNS->getOpaqueData()});
+            return It != LocIDs.end() ? It->second : InvalidID;
+        }
+
+        if (!Ptr)
+            return InvalidID;
+        auto It = PointerIDs.find(Ptr);
+        return It != PointerIDs.end() ? It->second : InvalidID;
+    }
+
+    clang::DynTypedNode ParentTable::getNode(uint32_t ID) const
+    {
+        auto &N = Nodes[ID];
+        switch (N.Kind)
+        {
+        case StmtNode:
+            return clang::DynTypedNode::create(
+                *static_cast<const clang::Stmt *>(N.Ptr));
+        case DeclNode:
+            return clang::DynTypedNode::create(
+                *static_cast<const clang::Decl *>(N.Ptr));
+        case AttrNode:
+            return clang::DynTypedNode::create(
+                *static_cast<const clang::Attr *>(N.Ptr));
+        case TypeLocNode:
+            return clang::DynTypedNode::create(clang::TypeLoc(
+                clang::QualType::getFromOpaquePtr(N.Ptr),
+                const_cast<void *>(LocData.lookup(ID))));
+        case NNSLocNode:
+            return clang::DynTypedNode::create(clang::NestedNameSpecifierLoc(
+                static_cast<clang::NestedNameSpecifier *>(
+                    const_cast<void *>(N.Ptr)),
+                const_cast<void *>(LocData.lookup(ID))));
+        }
+        return clang::DynTypedNode();
+    }
+
+    llvm::SmallVector<clang::DynTypedNode, 1>
+    ParentTable::getParents(const clang::DynTypedNode &N) const
+    {
+        llvm::SmallVector<clang::DynTypedNode, 1> Result;
+
+        auto ID = lookup(N);
+        if (ID == InvalidID || Nodes[ID].Parent == InvalidID)
+            return Result;
+        Result.push_back(getNode(Nodes[ID].Parent));
+        auto It = MoreParents.find(ID);
+        if (It != MoreParents.end())
+            for (auto &&P : It->second)
+                Result.push_back(getNode(P));
+        return Result;
+    }
+
+    clang::DynTypedNode
+    ParentTable::getParent(const clang::DynTypedNode &N) const
+    {
+        auto ID = lookup(N);
+        if (ID == InvalidID || Nodes[ID].Parent == InvalidID)
+            return clang::DynTypedNode();
+        return getNode(Nodes[ID].Parent);
+    }
+
+    bool ParentTable::isAncestor(const clang::DynTypedNode &A,
+                                 const clang::DynTypedNode &N) const
+    {
+        // Every first ancestor of a node in the table is in the table
+        auto NID = lookup(N);
+        auto AID = lookup(A);
+        if (NID == InvalidID || AID == InvalidID)
+            return false;
+
+        // Depths strictly decrease along a chain of first parents
+        uint32_t Cur = NID;
+        while (Cur != InvalidID && Nodes[Cur].Depth > Nodes[AID].Depth)
+            Cur = Nodes[Cur].Parent;
+        return Cur == AID && Cur != NID;
+    }
+
+    bool ParentTable::isInICEContext(const clang::Stmt *ST) const
+    {
+        if (!ST)
+            return false;
+
+        auto ID = lookup(clang::DynTypedNode::create(*ST));
+        return ID != InvalidID && (Nodes[ID].Flags & InICEContext);
+    }
+
+    template <typename... Skipped>
+    const clang::Stmt *ParentTable::resolveParent(const clang::Stmt *ST) const
+    {
+        auto P = getParent(clang::DynTypedNode::create(*ST))
+                     .get<clang::Stmt>();
+        while (P && llvm::isa<Skipped...>(P))
+            P = getParent(clang::DynTypedNode::create(*P))
+                    .get<clang::Stmt>();
+        return P;
+    }
+
+    bool ParentTable::isExprUsedAsStmt(const clang::Expr *E) const
+    {
+        if (!E)
+            return false;
+        auto P = resolveParent<clang::ExprWithCleanups>(E);
+        return P && llvm::isa<clang::CompoundStmt,
+                              clang::LabelStmt,
+                              clang::AttributedStmt>(P);
+    }
+
+    bool ParentTable::isInStmtBlock(const clang::Stmt *ST) const
+    {
+        if (!ST)
+            return false;
+        auto P = resolveParent<clang::ExprWithCleanups,
+                               clang::AttributedStmt,
+                               clang::LabelStmt>(ST);
+        return P && llvm::isa<clang::CompoundStmt>(P);
+    }
+
+    size_t ParentTable::getMemorySize() const
+    {
+        size_t Size = Nodes.capacity() * sizeof(Node) +
+                      PointerIDs.getMemorySize() +
+                      LocIDs.getMemorySize() +
+                      LocData.getMemorySize() +
+                      MoreParents.getMemorySize();
+        for (auto &&Entry : MoreParents)
+            if (!Entry.second.isSmall())
+                Size += Entry.second.capacity() * sizeof(uint32_t);
+        return Size;
+    }
+} // namespace cpp2c
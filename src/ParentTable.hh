@@ -0,0 +1,123 @@
+#pragma once
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/ASTTypeTraits.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cpp2c
+{
+    // Compact parent table for the parts of a translation unit that we
+    // analyze.
+    // Only the given top-level declarations are traversed, and every node
+    // is stored as a fixed-size record holding its first parent's index
+    // and its depth, instead of clang's map of parent vectors over the
+    // entire translation unit.
+    // Nodes are traversed in the same way and order as clang's parent map,
+    // so the first parent of a node is the same one clang would report.
+    // Nodes outside of the table have no parents, rather than falling back
+    // to clang's parent map, which would be built for the entire
+    // translation unit; the roots must include every top-level declaration
+    // whose nodes are queried.
+    class ParentTable
+    {
+    public:
+        ParentTable(clang::ASTContext &Ctx,
+                    llvm::ArrayRef<const clang::Decl *> Roots);
+
+        // Returns all parents of N
+        llvm::SmallVector<clang::DynTypedNode, 1>
+        getParents(const clang::DynTypedNode &N) const;
+
+        // Returns the first parent of N, or an empty node if N has no
+        // parents
+        clang::DynTypedNode getParent(const clang::DynTypedNode &N) const;
+
+        // Returns true if A is a proper ancestor of N along N's chain of
+        // first parents
+        bool isAncestor(const clang::DynTypedNode &A,
+                        const clang::DynTypedNode &N) const;
+
+        // Returns true if ST is a descendant of a node which can only have
+        // subexpressions that are integral constant expressions
+        bool isInICEContext(const clang::Stmt *ST) const;
+
+        // Returns true if E is used as a standalone statement (e.g., "x++;")
+        // rather than as an operand (e.g., "return x;")
+        bool isExprUsedAsStmt(const clang::Expr *E) const;
+
+        // Returns true if ST is a statement directly inside a compound
+        // statement
+        bool isInStmtBlock(const clang::Stmt *ST) const;
+
+        // Number of nodes in the table
+        size_t size() const { return Nodes.size(); }
+
+        // Number of bytes allocated by the table
+        size_t getMemorySize() const;
+
+    private:
+        friend class ParentTableBuilder;
+
+        static constexpr uint32_t InvalidID = ~0u;
+
+        enum NodeKind : uint8_t
+        {
+            StmtNode,
+            DeclNode,
+            AttrNode,
+            TypeLocNode,
+            NNSLocNode,
+        };
+
+        enum : uint8_t
+        {
+            // A case label, enum, bit-field or array declaration is an
+            // ancestor of the node
+            InICEContext = 1 << 0,
+        };
+
+        struct Node
+        {
+            // The Stmt, Decl or Attr, or the type or qualifier pointer of a
+            // TypeLoc or NestedNameSpecifierLoc
+            const void *Ptr;
+            uint32_t Parent;
+            uint32_t Depth : 24;
+            uint32_t Kind : 3;
+            uint32_t Flags : 5;
+        };
+
+        std::vector<Node> Nodes;
+        // Index of each Stmt, Decl and Attr
+        llvm::DenseMap<const void *, uint32_t> PointerIDs;
+        // Index of each TypeLoc and NestedNameSpecifierLoc, keyed by its
+        // two pointers
+        llvm::DenseMap<std::pair<const void *, const void *>, uint32_t>
+            LocIDs;
+        // Data pointers of TypeLoc and NestedNameSpecifierLoc nodes
+        llvm::DenseMap<uint32_t, const void *> LocData;
+        // Parents after the first of the few nodes which have several
+        llvm::DenseMap<uint32_t, llvm::SmallVector<uint32_t, 1>> MoreParents;
+
+        // Returns the index of N, or InvalidID if N is not in the table
+        uint32_t lookup(const clang::DynTypedNode &N) const;
+
+        clang::DynTypedNode getNode(uint32_t ID) const;
+
+        // Returns the first statement above ST along its chain of first
+        // parents which is not one of the skipped kinds, or null if a
+        // non-statement comes first
+        template <typename... Skipped>
+        const clang::Stmt *resolveParent(const clang::Stmt *ST) const;
+    };
+} // namespace cpp2c
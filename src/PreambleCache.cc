@@ -0,0 +1,123 @@
+#include "PreambleCache.hh"
+
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/Token.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+#include <vector>
+
+namespace cpp2c
+{
+    // Returns whether Line holds the tokens of an #include directive after
+    // its hash, naming the included file without macros
+    static bool isInclude(llvm::ArrayRef<clang::Token> Line)
+    {
+        if (Line.size() < 2 || Line[0].isNot(clang::tok::raw_identifier) ||
+            Line[0].getRawIdentifier() != "include")
+            return false;
+        if (Line.size() == 2 && Line[1].is(clang::tok::string_literal))
+            return true;
+        // The raw lexer does not lex header names, so <stdio.h> is several
+        // tokens
+        return Line.size() >= 3 && Line[1].is(clang::tok::less) &&
+               Line.back().is(clang::tok::greater);
+    }
+
+    std::optional<IncludeBlock> findIncludeBlock(llvm::StringRef Buffer,
+                                                 const clang::LangOptions &LO)
+    {
+        // As in clang::Lexer::ComputePreamble, the offsets of tokens are
+        // their locations' encodings less that of the start of the buffer
+        const clang::SourceLocation::UIntTy StartOffset = 1;
+        clang::Lexer Lex(clang::SourceLocation::getFromRawEncoding(StartOffset),
+                         LO, Buffer.begin(), Buffer.begin(), Buffer.end());
+        auto offset = [&](const clang::Token &Tok)
+        { return Tok.getLocation().getRawEncoding() - StartOffset; };
+
+        IncludeBlock Block;
+        clang::Token Tok;
+        Lex.LexFromRawLexer(Tok);
+        while (Tok.is(clang::tok::hash) && Tok.isAtStartOfLine())
+        {
+            unsigned Begin = offset(Tok);
+            std::vector<clang::Token> Line;
+            while (true)
+            {
+                Lex.LexFromRawLexer(Tok);
+                if (Tok.is(clang::tok::eof) || Tok.isAtStartOfLine())
+                    break;
+                Line.push_back(Tok);
+            }
+            if (!isInclude(Line))
+            {
+                Block.Size = Begin;
+                return Block.Directives.empty()
+                           ? std::nullopt
+                           : std::optional<IncludeBlock>(Block);
+            }
+            unsigned End = offset(Line.back()) + Line.back().getLength();
+            Block.Directives += Buffer.slice(Begin, End);
+            Block.Directives += '\n';
+        }
+        if (Block.Directives.empty())
+            return std::nullopt;
+        Block.Size = Tok.is(clang::tok::eof) ? Buffer.size() : offset(Tok);
+        return Block;
+    }
+
+    PreambleCache::PreambleCache(std::string Dir) : Dir(std::move(Dir)) {}
+
+    PreambleCache::~PreambleCache()
+    {
+        for (auto &&E : Entries)
+        {
+            auto &P = E.second->P;
+            for (auto &&Path : {P.PCHPath, P.SnapshotPath})
+                if (!Path.empty())
+                    llvm::sys::fs::remove(Path);
+        }
+        // Only removed if no other files were put there
+        llvm::sys::fs::remove(Dir);
+    }
+
+    const PreambleCache::Preamble *
+    PreambleCache::get(llvm::StringRef Key,
+                       llvm::function_ref<bool(const Preamble &)> Build)
+    {
+        Entry *E;
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            auto &Slot = Entries[Key];
+            if (!Slot)
+            {
+                // Preambles are named by the order they were first needed
+                // in, since keys are long
+                Slot = std::make_unique<Entry>();
+                std::string Name = "preamble" + std::to_string(Entries.size());
+                llvm::SmallString<256> Base(Dir);
+                llvm::sys::path::append(Base, Name);
+                // Named so as not to hide a file of the main file's
+                // directory
+                Slot->P.HeaderName = ".cpp2c-" + Name + ".h";
+                Slot->P.PCHPath = Base.str().str() + ".pch";
+                Slot->P.SnapshotPath = Base.str().str() + ".macros";
+            }
+            E = Slot.get();
+        }
+        std::call_once(E->Once,
+                       [&]()
+                       {
+                           llvm::sys::fs::create_directories(Dir);
+                           E->Succeeded = Build(E->P);
+                           if (E->Succeeded)
+                               ++NumBuilt;
+                           else
+                               ++NumFailed;
+                       });
+        return E->Succeeded ? &E->P : nullptr;
+    }
+} // namespace cpp2c
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "clang/Basic/LangOptions.h"
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace cpp2c
+{
+    // Block of #include directives that a main file starts with
+    struct IncludeBlock
+    {
+        // Number of bytes of the main file that the block spans, including
+        // the comments and whitespace around its directives.
+        // The block always ends at the start of a line.
+        unsigned Size = 0;
+        // The directives, one per line
+        std::string Directives;
+    };
+
+    // Returns the block of #include directives at the start of Buffer,
+    // which ends at the first token that is not part of one, or nothing if
+    // Buffer does not start with an #include directive.
+    // Directives that name the included file with a macro end the block.
+    std::optional<IncludeBlock> findIncludeBlock(llvm::StringRef Buffer,
+                                                 const clang::LangOptions &LO);
+
+    // Precompiled preambles of the include blocks that translation units
+    // share, each built once, by the first thread that needs it.
+    // The files of the preambles are kept in a directory, and removed along
+    // with it when the cache is destroyed.
+    class PreambleCache
+    {
+    public:
+        struct Preamble
+        {
+            // Name of the header holding the directives of the include
+            // block, which is not written to disk, but added to the file
+            // systems of the translation units in their main file's
+            // directory
+            std::string HeaderName;
+            // Precompiled header of the header
+            std::string PCHPath;
+            // Macro snapshot written along with the precompiled header
+            std::string SnapshotPath;
+        };
+
+        explicit PreambleCache(std::string Dir);
+        ~PreambleCache();
+
+        PreambleCache(const PreambleCache &) = delete;
+        PreambleCache &operator=(const PreambleCache &) = delete;
+
+        // Returns the preamble with the given key, which Build writes to
+        // its paths the first time it is requested.
+        // Returns null if Build failed; other threads requesting the
+        // preamble meanwhile wait for it.
+        const Preamble *get(llvm::StringRef Key,
+                            llvm::function_ref<bool(const Preamble &)> Build);
+
+        // Number of preambles built, and that failed to build
+        unsigned built() const { return NumBuilt; }
+        unsigned failed() const { return NumFailed; }
+
+    private:
+        struct Entry
+        {
+            std::once_flag Once;
+            Preamble P;
+            bool Succeeded = false;
+        };
+
+        std::string Dir;
+        std::mutex Mutex;
+        llvm::StringMap<std::unique_ptr<Entry>> Entries;
+        std::atomic<unsigned> NumBuilt{0};
+        std::atomic<unsigned> NumFailed{0};
+    };
+} // namespace cpp2c
@@ -0,0 +1,175 @@
+#include "PreprocessorFacts.hh"
+
+#include "clang/Basic/FileManager.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "Logging.hh"
+
+#include <algorithm>
+#include <set>
+
+#include "assert.h"
+
+namespace cpp2c
+{
+    std::pair<bool, std::string> tryGetFullSourceLoc(
+        clang::SourceManager &SM,
+        clang::SourceLocation L)
+    {
+        if (L.isValid())
+        {
+            auto FID = SM.getFileID(L);
+            if (FID.isValid())
+            {
+                if (auto FE = SM.getFileEntryForID(FID))
+                {
+                    auto Name = FE->tryGetRealPathName();
+                    if (!Name.empty())
+                    {
+                        auto FLoc = SM.getFileLoc(L);
+                        if (FLoc.isValid())
+                        {
+                            auto s = FLoc.printToString(SM);
+                            // Find second-to-last colon
+                            auto i = s.rfind(':', s.rfind(':') - 1);
+                            return {true, Name.str() + ":" + s.substr(i + 1)};
+                        }
+                        return {false, "Invalid File SLoc"};
+                    }
+                    return {false, "Nameless file"};
+                }
+                return {false, "File without FileEntry"};
+            }
+            return {false, "Invalid file ID"};
+        }
+        return {false, "Invalid SLoc"};
+    }
+
+    // Checks if the included file is a globally included file.
+    // The first element of the return result if false if not;
+    // true otherwise.
+    // The second element is the name of the included file.
+    static std::pair<bool, llvm::StringRef> isGlobalInclude(
+        clang::SourceManager &SM,
+        const std::pair<const clang::FileEntry *, clang::SourceLocation> &IEL,
+        std::set<llvm::StringRef> &LocalIncludes,
+        llvm::function_ref<bool(clang::SourceLocation)> IsInDeclaration)
+    {
+        auto FE = IEL.first;
+        auto HashLoc = IEL.second;
+
+        // Check that the included file is not null
+        if (!FE)
+            return {false, "<null>"};
+
+        // Check that the included file actually has a name
+        auto IncludedFileRealpath = FE->tryGetRealPathName();
+        if (IncludedFileRealpath.empty())
+            return {false, IncludedFileRealpath};
+
+        // Check that the hash location is valid
+        if (HashLoc.isInvalid())
+            return {false, IncludedFileRealpath};
+
+        // Check that the file the file is included in is valid
+        auto IncludedInFID = SM.getFileID(HashLoc);
+        if (IncludedInFID.isInvalid())
+            return {false, IncludedFileRealpath};
+
+        // Check that a file entry exists for the  file the file is included in
+        auto IncludedInFE = SM.getFileEntryForID(IncludedInFID);
+        if (!IncludedInFE)
+            return {false, IncludedFileRealpath};
+
+        // Check that a real path exists for the file the file is included in
+        auto IncludedInRealpath = IncludedInFE->tryGetRealPathName();
+        if (IncludedInRealpath.empty())
+            return {false, IncludedFileRealpath};
+
+        // Check that the file the file is included in is not in turn included
+        // in a file included in a non-global scope
+        if (LocalIncludes.find(IncludedInRealpath) != LocalIncludes.end())
+            return {false, IncludedFileRealpath};
+
+        auto HashFLoc = SM.getFileLoc(HashLoc);
+        // Check that the file location is valid
+        if (HashFLoc.isInvalid())
+            return {false, IncludedFileRealpath};
+
+        // Check that the include does not appear within the range of any
+        // declaration in the file
+        if (IsInDeclaration(HashFLoc))
+            return {false, IncludedFileRealpath};
+
+        // Success
+        return {true, IncludedFileRealpath};
+    }
+
+    size_t printDefinitions(clang::SourceManager &SM,
+                            const DefinitionInfoCollector &DC,
+                            size_t Begin)
+    {
+        for (; Begin < DC.MacroNamesDefinitions.size(); ++Begin)
+        {
+            auto &Entry = DC.MacroNamesDefinitions[Begin];
+            std::string Name = Entry.first->getName().str(),
+                        DefLocOrError;
+            bool Valid;
+
+            auto MD = Entry.second;
+            auto DefLoc = MD ? SM.getFileLoc(MD->getDefinition().getLocation())
+                             : clang::SourceLocation();
+            Valid = DefLoc.isValid();
+
+            // Try to get the full path to the DefLoc
+            auto Res = tryGetFullSourceLoc(SM, DefLoc);
+            Valid &= Res.first;
+            DefLocOrError = Res.second;
+
+            auto MI = MD->getMacroInfo();
+            assert(MI);
+
+            print("Definition", Name, MI->isObjectLike(), Valid, DefLocOrError);
+        }
+        return Begin;
+    }
+
+    void printInspectedMacroNames(const DefinitionInfoCollector &DC)
+    {
+        // Names are sorted so that the output does not depend on the
+        // order of the hash set
+        std::vector<llvm::StringRef> InspectedNames;
+        InspectedNames.reserve(DC.InspectedMacroNames.size());
+        for (auto &&II : DC.InspectedMacroNames)
+            InspectedNames.push_back(II->getName());
+        std::sort(InspectedNames.begin(), InspectedNames.end());
+        for (auto &&Name : InspectedNames)
+            print("InspectedByCPP", Name.str());
+    }
+
+    void printIncludes(
+        clang::SourceManager &SM,
+        const IncludeCollector &IC,
+        llvm::function_ref<bool(clang::SourceLocation)> IsInDeclaration)
+    {
+        std::set<llvm::StringRef> LocalIncludes;
+        for (auto &&IEL : IC.IncludeEntriesLocs)
+        {
+            // Facts for includes
+            bool Valid = false;
+            std::string IncludeName = "";
+
+            // Check if included at global scope or not
+            auto Res = isGlobalInclude(SM, IEL, LocalIncludes,
+                                       IsInDeclaration);
+            if (!Res.first)
+                LocalIncludes.insert(Res.second);
+
+            Valid = Res.first;
+            IncludeName = Res.second.empty() ? "" : Res.second.str();
+
+            print("Include", Valid, IncludeName);
+        }
+    }
+} // namespace cpp2c
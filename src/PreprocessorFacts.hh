@@ -0,0 +1,43 @@
+#pragma once
+
+#include "DefinitionInfoCollector.hh"
+#include "IncludeCollector.hh"
+
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+namespace cpp2c
+{
+    // Tries to get the full real path and line + column number for a given
+    // source location.
+    // First element is whether the operation was successful, the second
+    // is the error if not and the full path if successful.
+    std::pair<bool, std::string> tryGetFullSourceLoc(
+        clang::SourceManager &SM,
+        clang::SourceLocation L);
+
+    // Prints the macro definitions collected by DC, starting from the
+    // definition at index Begin, and returns the number of definitions
+    // printed in total
+    size_t printDefinitions(clang::SourceManager &SM,
+                            const DefinitionInfoCollector &DC,
+                            size_t Begin = 0);
+
+    // Prints the names of the macros inspected by the preprocessor
+    void printInspectedMacroNames(const DefinitionInfoCollector &DC);
+
+    // Prints whether each file collected by IC was included at global
+    // scope.
+    // IsInDeclaration tells whether the file location of an include
+    // directive is within a declaration.
+    void printIncludes(
+        clang::SourceManager &SM,
+        const IncludeCollector &IC,
+        llvm::function_ref<bool(clang::SourceLocation)> IsInDeclaration);
+} // namespace cpp2c
@@ -0,0 +1,36 @@
+#include "ProgressFile.hh"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cpp2c
+{
+    ProgressFile::ProgressFile(const std::string &Path)
+    {
+        reopen(Path);
+    }
+
+    ProgressFile::~ProgressFile()
+    {
+        if (FD >= 0)
+            ::close(FD);
+    }
+
+    void ProgressFile::update(llvm::StringRef Text)
+    {
+        if (FD < 0)
+            return;
+        // Progress is best-effort, so failures are ignored
+        auto Written = ::pwrite(FD, Text.data(), Text.size(), 0);
+        if (Written >= 0)
+            (void)::ftruncate(FD, Written);
+    }
+
+    void ProgressFile::reopen(const std::string &Path)
+    {
+        if (FD >= 0)
+            ::close(FD);
+        FD = ::open(Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    }
+} // namespace cpp2c
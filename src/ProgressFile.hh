@@ -0,0 +1,32 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+
+namespace cpp2c
+{
+    // File holding a short description of what the plugin is working on,
+    // such as the macro invocation being analyzed.
+    // Each update replaces the file's contents without buffering, so a
+    // driver can report the last one if the compiler crashes or is killed.
+    class ProgressFile
+    {
+    public:
+        explicit ProgressFile(const std::string &Path);
+        ~ProgressFile();
+
+        ProgressFile(const ProgressFile &) = delete;
+        ProgressFile &operator=(const ProgressFile &) = delete;
+
+        // Replaces the contents of the file with Text
+        void update(llvm::StringRef Text);
+
+        // Writes to the file at Path from now on, such as in a forked
+        // process that must not overwrite the updates of its parent
+        void reopen(const std::string &Path);
+
+    private:
+        int FD = -1;
+    };
+} // namespace cpp2c
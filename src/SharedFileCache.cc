@@ -0,0 +1,149 @@
+#include "SharedFileCache.hh"
+
+#include "llvm/Support/Path.h"
+
+#include <string>
+#include <system_error>
+
+namespace cpp2c
+{
+    namespace
+    {
+        // File whose contents are owned by a shared cache
+        class CachedFile : public llvm::vfs::File
+        {
+        public:
+            CachedFile(llvm::vfs::Status S, llvm::StringRef Contents)
+                : S(std::move(S)), Contents(Contents) {}
+
+            llvm::ErrorOr<llvm::vfs::Status> status() override { return S; }
+
+            llvm::ErrorOr<std::string> getName() override
+            {
+                return S.getName().str();
+            }
+
+            llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
+            getBuffer(const llvm::Twine &Name, int64_t FileSize,
+                      bool RequiresNullTerminator, bool IsVolatile) override
+            {
+                // The cached buffer is null-terminated, so it can be
+                // referred to either way
+                return llvm::MemoryBuffer::getMemBuffer(
+                    Contents, Name.str(), RequiresNullTerminator);
+            }
+
+            std::error_code close() override { return {}; }
+
+        private:
+            llvm::vfs::Status S;
+            llvm::StringRef Contents;
+        };
+    } // namespace
+
+    llvm::ErrorOr<llvm::vfs::Status>
+    SharedFileCache::status(llvm::StringRef Path, llvm::vfs::FileSystem &FS)
+    {
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            auto It = Statuses.find(Path);
+            if (It != Statuses.end())
+            {
+                ++StatHits;
+                return It->second;
+            }
+        }
+        ++StatMisses;
+        auto S = FS.status(Path);
+        // Other errors, such as running out of file descriptors, may not
+        // happen again
+        if (!S && S.getError() != std::errc::no_such_file_or_directory)
+            return S;
+        std::lock_guard<std::mutex> Lock(Mutex);
+        return Statuses.try_emplace(Path, S).first->second;
+    }
+
+    llvm::ErrorOr<const SharedFileCache::Entry *>
+    SharedFileCache::read(llvm::StringRef Path, llvm::vfs::FileSystem &FS)
+    {
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            auto It = Entries.find(Path);
+            if (It != Entries.end())
+            {
+                ++ReadHits;
+                return It->second.get();
+            }
+        }
+        ++ReadMisses;
+        auto File = FS.openFileForRead(Path);
+        if (!File)
+            return File.getError();
+        auto S = (*File)->status();
+        if (!S)
+            return S.getError();
+        auto Buffer = (*File)->getBuffer(Path, S->getSize(),
+                                         /*RequiresNullTerminator=*/true,
+                                         /*IsVolatile=*/false);
+        if (!Buffer)
+            return Buffer.getError();
+        BytesRead += (*Buffer)->getBufferSize();
+
+        std::lock_guard<std::mutex> Lock(Mutex);
+        // Another thread may have read the file meanwhile, in which case
+        // its entry is kept, since translation units may already refer to
+        // its buffer
+        auto &Slot = Entries[Path];
+        if (!Slot)
+            Slot.reset(new Entry{*S, std::move(*Buffer)});
+        Statuses.try_emplace(Path, Slot->Status);
+        return Slot.get();
+    }
+
+    SharedFileCache::Counters SharedFileCache::counters() const
+    {
+        Counters C;
+        C.StatHits = StatHits;
+        C.StatMisses = StatMisses;
+        C.ReadHits = ReadHits;
+        C.ReadMisses = ReadMisses;
+        C.BytesRead = BytesRead;
+        return C;
+    }
+
+    CachingFileSystem::CachingFileSystem(
+        SharedFileCache &Cache,
+        llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS)
+        : ProxyFileSystem(std::move(FS)), Cache(Cache) {}
+
+    llvm::SmallString<256>
+    CachingFileSystem::cacheKey(const llvm::Twine &Path) const
+    {
+        llvm::SmallString<256> Key;
+        Path.toVector(Key);
+        makeAbsolute(Key);
+        llvm::sys::path::remove_dots(Key);
+        return Key;
+    }
+
+    llvm::ErrorOr<llvm::vfs::Status>
+    CachingFileSystem::status(const llvm::Twine &Path)
+    {
+        auto S = Cache.status(cacheKey(Path), getUnderlyingFS());
+        if (!S)
+            return S;
+        // Clang expects the name it asked for
+        return llvm::vfs::Status::copyWithNewName(*S, Path);
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+    CachingFileSystem::openFileForRead(const llvm::Twine &Path)
+    {
+        auto E = Cache.read(cacheKey(Path), getUnderlyingFS());
+        if (!E)
+            return E.getError();
+        return std::make_unique<CachedFile>(
+            llvm::vfs::Status::copyWithNewName((*E)->Status, Path),
+            (*E)->Buffer->getBuffer());
+    }
+} // namespace cpp2c
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/ErrorOr.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace cpp2c
+{
+    // Statuses and contents of files, shared by the translation units that
+    // one process parses, possibly on several threads, so that each header
+    // is looked up and read once rather than once per translation unit.
+    // Files are assumed not to change while the cache is in use, and their
+    // contents are kept, mapped into memory when they are large enough,
+    // until the cache is destroyed.
+    class SharedFileCache
+    {
+    public:
+        struct Counters
+        {
+            uint64_t StatHits = 0;
+            uint64_t StatMisses = 0;
+            uint64_t ReadHits = 0;
+            uint64_t ReadMisses = 0;
+            // Bytes read from the underlying file system
+            uint64_t BytesRead = 0;
+        };
+
+        struct Entry
+        {
+            llvm::vfs::Status Status;
+            std::unique_ptr<llvm::MemoryBuffer> Buffer;
+        };
+
+        // Returns the status of the file at the absolute path Path, looking
+        // it up in FS if it is not cached.
+        // Files that do not exist are cached as well, since header search
+        // looks for most headers in several directories.
+        llvm::ErrorOr<llvm::vfs::Status> status(llvm::StringRef Path,
+                                                llvm::vfs::FileSystem &FS);
+
+        // Returns the status and contents of the file at the absolute path
+        // Path, reading it from FS if it is not cached
+        llvm::ErrorOr<const Entry *> read(llvm::StringRef Path,
+                                          llvm::vfs::FileSystem &FS);
+
+        Counters counters() const;
+
+    private:
+        mutable std::mutex Mutex;
+        llvm::StringMap<llvm::ErrorOr<llvm::vfs::Status>> Statuses;
+        llvm::StringMap<std::unique_ptr<Entry>> Entries;
+
+        std::atomic<uint64_t> StatHits{0};
+        std::atomic<uint64_t> StatMisses{0};
+        std::atomic<uint64_t> ReadHits{0};
+        std::atomic<uint64_t> ReadMisses{0};
+        std::atomic<uint64_t> BytesRead{0};
+    };
+
+    // File system of one translation unit that looks files up in a shared
+    // cache before its underlying file system, which resolves relative
+    // paths against the translation unit's working directory
+    class CachingFileSystem : public llvm::vfs::ProxyFileSystem
+    {
+    public:
+        CachingFileSystem(SharedFileCache &Cache,
+                          llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS);
+
+        llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &Path) override;
+
+        llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+        openFileForRead(const llvm::Twine &Path) override;
+
+    private:
+        SharedFileCache &Cache;
+
+        // Returns the absolute path that Path is cached under
+        llvm::SmallString<256> cacheKey(const llvm::Twine &Path) const;
+    };
+} // namespace cpp2c
@@ -0,0 +1,254 @@
+#include "TUFingerprint.hh"
+#include "DefinitionInfoCollector.hh"
+#include "IncludeCollector.hh"
+#include "Logging.hh"
+#include "PreprocessorFacts.hh"
+
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Lex/MacroInfo.h"
+#include "clang/Lex/PPCallbacks.h"
+#include "clang/Lex/Pragma.h"
+#include "clang/Lex/Preprocessor.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace cpp2c
+{
+    namespace
+    {
+        class DigestBuilder
+        {
+        private:
+            clang::Preprocessor &PP;
+            clang::SourceManager &SM;
+            llvm::MD5 Hash;
+            // Number of each buffer and expansion, in order of first use
+            llvm::DenseMap<clang::FileID, uint64_t> Indices;
+
+            // Returns the number of FID, adding what it is the first time
+            uint64_t index(clang::FileID FID)
+            {
+                auto It = Indices.find(FID);
+                if (It != Indices.end())
+                    return It->second;
+                uint64_t Index = Indices.size() + 1;
+                Indices[FID] = Index;
+
+                bool Invalid = false;
+                const auto &Entry = SM.getSLocEntry(FID, &Invalid);
+                if (Invalid)
+                    add("<invalid>");
+                else if (Entry.isFile())
+                    add(SM.getBufferName(SM.getLocForStartOfFile(FID)));
+                else
+                {
+                    const auto &Expansion = Entry.getExpansion();
+                    add(Expansion.isMacroArgExpansion());
+                    add(Expansion.getSpellingLoc());
+                    add(Expansion.getExpansionLocStart());
+                    add(Expansion.getExpansionLocEnd());
+                }
+                return Index;
+            }
+
+        public:
+            explicit DigestBuilder(clang::Preprocessor &PP)
+                : PP(PP), SM(PP.getSourceManager()) {}
+
+            void add(uint64_t V)
+            {
+                uint8_t Bytes[sizeof(V)];
+                std::memcpy(Bytes, &V, sizeof(V));
+                Hash.update(Bytes);
+            }
+
+            // Strings are prefixed with their sizes so that consecutive
+            // ones can not run together
+            void add(llvm::StringRef S)
+            {
+                add(uint64_t(S.size()));
+                Hash.update(S);
+            }
+
+            void add(clang::SourceLocation L)
+            {
+                if (L.isInvalid())
+                {
+                    add(uint64_t(0));
+                    return;
+                }
+                auto Decomposed = SM.getDecomposedLoc(L);
+                add(index(Decomposed.first));
+                add(uint64_t(Decomposed.second));
+            }
+
+            void add(const clang::Token &Tok)
+            {
+                add(uint64_t(Tok.getKind()));
+                add(uint64_t(Tok.getFlags()));
+                add(Tok.getLocation());
+                if (Tok.isAnnotation())
+                    return;
+                llvm::SmallString<64> Buffer;
+                add(PP.getSpelling(Tok, Buffer));
+            }
+
+            std::string finish()
+            {
+                llvm::MD5::MD5Result Result;
+                Hash.final(Result);
+                return Result.digest().str().str();
+            }
+        };
+
+        class ExpansionHasher : public clang::PPCallbacks
+        {
+        private:
+            DigestBuilder &D;
+
+        public:
+            // Names of the parameters of the expanded macros
+            llvm::StringSet<> ParamNames;
+
+            explicit ExpansionHasher(DigestBuilder &D) : D(D) {}
+
+            void MacroExpands(const clang::Token &MacroNameTok,
+                              const clang::MacroDefinition &MD,
+                              clang::SourceRange Range,
+                              const clang::MacroArgs *Args) override
+            {
+                D.add("expansion");
+                D.add(MacroNameTok);
+                D.add(Range.getBegin());
+                D.add(Range.getEnd());
+                D.add(Args != nullptr);
+                auto MI = MD.getMacroInfo();
+                if (!MI)
+                    return;
+                D.add(MI->getDefinitionLoc());
+                for (auto &&Param : MI->params())
+                {
+                    D.add(Param->getName());
+                    ParamNames.insert(Param->getName());
+                }
+                for (auto &&Tok : MI->tokens())
+                    D.add(Tok);
+            }
+        };
+
+        // Adds the pragmas of a namespace that the parser would otherwise
+        // handle
+        class PragmaHasher : public clang::PragmaHandler
+        {
+        private:
+            DigestBuilder &D;
+            llvm::StringRef Namespace;
+
+        public:
+            PragmaHasher(DigestBuilder &D, llvm::StringRef Namespace)
+                : D(D), Namespace(Namespace) {}
+
+            void HandlePragma(clang::Preprocessor &PP,
+                              clang::PragmaIntroducer Introducer,
+                              clang::Token &FirstToken) override
+            {
+                D.add("pragma");
+                D.add(Namespace);
+                D.add(Introducer.Loc);
+                D.add(FirstToken);
+                clang::Token Tok = FirstToken;
+                while (Tok.isNot(clang::tok::eod))
+                {
+                    PP.LexUnexpandedToken(Tok);
+                    D.add(Tok);
+                }
+            }
+        };
+    } // namespace
+
+    void TUFingerprintAction::ExecuteAction()
+    {
+        clang::CompilerInstance &CI = getCompilerInstance();
+        clang::Preprocessor &PP = CI.getPreprocessor();
+        clang::SourceManager &SM = CI.getSourceManager();
+
+        DigestBuilder D(PP);
+        auto IC = new cpp2c::IncludeCollector();
+        auto DC = new cpp2c::DefinitionInfoCollector();
+        auto EH = new ExpansionHasher(D);
+        PP.addPPCallbacks(std::unique_ptr<cpp2c::IncludeCollector>(IC));
+        PP.addPPCallbacks(std::unique_ptr<cpp2c::DefinitionInfoCollector>(DC));
+        PP.addPPCallbacks(std::unique_ptr<ExpansionHasher>(EH));
+
+        // The same namespaces as Preprocessor::IgnorePragmas
+        const char *Namespaces[] = {"", "GCC", "clang"};
+        std::vector<std::unique_ptr<PragmaHasher>> Pragmas;
+        for (auto &&NS : Namespaces)
+        {
+            Pragmas.push_back(std::make_unique<PragmaHasher>(D, NS));
+            PP.AddPragmaHandler(NS, Pragmas.back().get());
+        }
+
+        PP.EnterMainSourceFile();
+        clang::Token Tok;
+        do
+        {
+            PP.Lex(Tok);
+            D.add(Tok);
+        } while (Tok.isNot(clang::tok::eof));
+
+        for (size_t I = 0; I < Pragmas.size(); ++I)
+            PP.RemovePragmaHandler(Namespaces[I], Pragmas[I].get());
+
+        D.add("definitions");
+        for (auto &&[II, MD] : DC->MacroNamesDefinitions)
+        {
+            auto Res = tryGetFullSourceLoc(
+                SM, MD ? SM.getFileLoc(MD->getDefinition().getLocation())
+                       : clang::SourceLocation());
+            // Only the name clash check looks at definitions outside of
+            // files
+            if (!Res.first && !EH->ParamNames.count(II->getName()))
+                continue;
+            D.add(II->getName());
+            D.add(Res.second);
+            D.add(MD && MD->getMacroInfo() &&
+                  MD->getMacroInfo()->isObjectLike());
+        }
+
+        D.add("inspected");
+        std::vector<llvm::StringRef> InspectedNames;
+        for (auto &&II : DC->InspectedMacroNames)
+            InspectedNames.push_back(II->getName());
+        std::sort(InspectedNames.begin(), InspectedNames.end());
+        for (auto &&Name : InspectedNames)
+            D.add(Name);
+
+        D.add("includes");
+        for (auto &&[FE, HashLoc] : IC->IncludeEntriesLocs)
+        {
+            D.add(FE ? FE->tryGetRealPathName() : llvm::StringRef("<null>"));
+            D.add(HashLoc);
+        }
+
+        Digest = D.finish();
+
+        llvm::raw_string_ostream OS(Definitions);
+        llvm::raw_ostream *Previous = output();
+        output() = &OS;
+        printDefinitions(SM, *DC);
+        output() = Previous;
+        OS.flush();
+    }
+} // namespace cpp2c
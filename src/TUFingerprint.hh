@@ -0,0 +1,33 @@
+#pragma once
+
+#include "clang/Frontend/FrontendAction.h"
+
+#include <string>
+
+namespace cpp2c
+{
+    // Preprocesses a translation unit and computes a digest of what the
+    // analysis depends on: each token the parser would see, with its
+    // spelling and expansion locations, each macro expansion and pragma,
+    // and the definitions, inspected names and includes that the plugin
+    // prints.
+    // Locations are encoded as offsets in buffers and expansions numbered
+    // by first use, rather than as source locations, which the sizes of
+    // unrelated buffers shift.
+    // Definitions from outside of files, such as those of -D options, only
+    // count if an expanded macro has a parameter of the same name, so
+    // translation units that are compiled with -D options which they do not
+    // test have the same digest, and the same facts but for definitions.
+    class TUFingerprintAction : public clang::PreprocessorFrontendAction
+    {
+    public:
+        // Hex digest, set once the action has run
+        std::string Digest;
+        // Definition facts of the translation unit, as the plugin prints
+        // them
+        std::string Definitions;
+
+    protected:
+        void ExecuteAction() override;
+    };
+} // namespace cpp2c
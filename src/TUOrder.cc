@@ -0,0 +1,130 @@
+#include "TUOrder.hh"
+
+#include "llvm/ADT/StringRef.h"
+
+#include <algorithm>
+
+namespace cpp2c
+{
+    TUOrder::TUOrder(clang::SourceManager &SM) : SM(SM)
+    {
+        rank();
+    }
+
+    bool TUOrder::update()
+    {
+        unsigned N = SM.local_sloc_entry_size();
+        for (unsigned ID = NumEntries; ID < N; ++ID)
+            if (SM.getLocalSLocEntry(ID).isFile())
+            {
+                rank();
+                return true;
+            }
+        NumEntries = N;
+        return false;
+    }
+
+    void TUOrder::rank()
+    {
+        unsigned N = SM.local_sloc_entry_size();
+        NumEntries = N;
+        Files.clear();
+        Files.resize(N);
+
+        // Files included by each file, as pairs of (include offset, FileID)
+        std::vector<std::vector<std::pair<unsigned, unsigned>>> Children(N);
+        std::vector<unsigned> Builtins, Roots;
+
+        for (unsigned ID = 0; ID < N; ++ID)
+        {
+            const clang::SrcMgr::SLocEntry &Entry = SM.getLocalSLocEntry(ID);
+            if (!Entry.isFile())
+                continue;
+
+            auto IncludeLoc = Entry.getFile().getIncludeLoc();
+            if (IncludeLoc.isValid())
+            {
+                // Files included from outside the local table are not ranked
+                auto Decomposed = SM.getDecomposedLoc(SM.getFileLoc(IncludeLoc));
+                if (Decomposed.first.isValid() &&
+                    !SM.isLoadedFileID(Decomposed.first) &&
+                    Decomposed.first.getHashValue() < N)
+                    Children[Decomposed.first.getHashValue()]
+                        .emplace_back(Decomposed.second, ID);
+                continue;
+            }
+
+            // Clang orders unrelated files by sorting built-ins first.
+            // Scratch space and inline assembly are compared by rules that
+            // do not fit a single order, so they are left unranked.
+            auto FID = SM.getFileID(
+                clang::SourceLocation::getFromRawEncoding(Entry.getOffset()));
+            llvm::StringRef Name = SM.getBufferOrFake(FID).getBufferIdentifier();
+            if (Name == "<built-in>")
+                Builtins.push_back(ID);
+            else if (Name != "<scratch space>" && Name != "<inline asm>")
+                Roots.push_back(ID);
+        }
+
+        uint32_t NextRank = 0;
+        for (auto ID : Builtins)
+            rankFile(ID, Children, NextRank);
+        for (auto ID : Roots)
+            rankFile(ID, Children, NextRank);
+    }
+
+    void TUOrder::rankFile(
+        unsigned ID,
+        std::vector<std::vector<std::pair<unsigned, unsigned>>> &Children,
+        uint32_t &NextRank)
+    {
+        auto &C = Children[ID];
+        std::stable_sort(C.begin(), C.end(),
+                         [](const std::pair<unsigned, unsigned> &A,
+                            const std::pair<unsigned, unsigned> &B)
+                         { return A.first < B.first; });
+
+        // Included files come after the part of the including file that
+        // precedes the include, and before the part that follows it
+        Files[ID].IncludeOffsets.reserve(C.size());
+        Files[ID].SegmentRanks.reserve(C.size() + 1);
+        Files[ID].SegmentRanks.push_back(NextRank++);
+        for (auto &&Child : C)
+        {
+            Files[ID].IncludeOffsets.push_back(Child.first);
+            rankFile(Child.second, Children, NextRank);
+            Files[ID].SegmentRanks.push_back(NextRank++);
+        }
+    }
+
+    std::optional<uint64_t> TUOrder::getKey(clang::SourceLocation L) const
+    {
+        if (L.isInvalid() || !L.isFileID())
+            return std::nullopt;
+
+        auto Decomposed = SM.getDecomposedLoc(L);
+        auto FID = Decomposed.first;
+        if (FID.isInvalid() || SM.isLoadedFileID(FID))
+            return std::nullopt;
+
+        unsigned ID = FID.getHashValue();
+        if (ID >= Files.size() || Files[ID].SegmentRanks.empty())
+            return std::nullopt;
+
+        const FileOrder &F = Files[ID];
+        unsigned Offset = Decomposed.second;
+        auto Segment = std::lower_bound(F.IncludeOffsets.begin(),
+                                        F.IncludeOffsets.end(),
+                                        Offset) -
+                       F.IncludeOffsets.begin();
+        return (uint64_t(F.SegmentRanks[Segment]) << 32) | Offset;
+    }
+
+    bool TUOrder::isBefore(clang::SourceLocation L, clang::SourceLocation R) const
+    {
+        auto LKey = getKey(L), RKey = getKey(R);
+        if (LKey && RKey)
+            return *LKey < *RKey;
+        return SM.isBeforeInTranslationUnit(L, R);
+    }
+} // namespace cpp2c
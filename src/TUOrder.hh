@@ -0,0 +1,62 @@
+#pragma once
+
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace cpp2c
+{
+    // Precomputed translation-unit order of file locations.
+    // Each local file is split into segments at the offsets where it
+    // includes other files, and the segments of all files are numbered in
+    // the order the preprocessor visits them.
+    // A file location then maps to a 64-bit key (segment rank, offset) that
+    // orders the same way as SourceManager::isBeforeInTranslationUnit.
+    class TUOrder
+    {
+    private:
+        struct FileOrder
+        {
+            // Offsets in this file at which other files are included, sorted
+            std::vector<unsigned> IncludeOffsets;
+            // Rank of each segment between two consecutive includes.
+            // Empty if this file was not ranked.
+            std::vector<uint32_t> SegmentRanks;
+        };
+
+        clang::SourceManager &SM;
+        // Indexed by local FileID
+        std::vector<FileOrder> Files;
+        // Number of local SLocEntries when the files were last ranked
+        unsigned NumEntries = 0;
+
+        // Ranks all files entered so far
+        void rank();
+
+        void rankFile(unsigned ID,
+                      std::vector<std::vector<std::pair<unsigned, unsigned>>> &Children,
+                      uint32_t &NextRank);
+
+    public:
+        explicit TUOrder(clang::SourceManager &SM);
+
+        // Ranks the files entered since the files were last ranked, while
+        // the translation unit is still being parsed.
+        // Returns true if keys may have changed.
+        bool update();
+
+        // Returns the key of the given file location, or nothing if the
+        // location is not a file location in a ranked local file
+        std::optional<uint64_t> getKey(clang::SourceLocation L) const;
+
+        // Returns true if L comes before R in the translation unit.
+        // Falls back to SourceManager::isBeforeInTranslationUnit for
+        // locations without a key.
+        bool isBefore(clang::SourceLocation L, clang::SourceLocation R) const;
+
+        clang::SourceManager &getSourceManager() const { return SM; }
+    };
+} // namespace cpp2c
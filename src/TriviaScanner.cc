@@ -0,0 +1,223 @@
+#include "TriviaScanner.hh"
+
+#include <cstddef>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <immintrin.h>
+#define CPP2C_TRIVIA_SIMD 1
+#endif
+
+namespace cpp2c
+{
+    namespace
+    {
+        // Characters that end or complicate a block comment
+        const llvm::StringRef BlockCommentSpecials("*\\?\0", 4);
+        // Characters that end or complicate a line comment
+        const llvm::StringRef LineCommentSpecials("\n\r\\?\0", 5);
+
+        inline bool isWhitespace(unsigned char C)
+        {
+            return C == ' ' || (C >= '\t' && C <= '\r');
+        }
+
+        size_t firstNonWhitespaceScalar(const char *P, size_t I, size_t N)
+        {
+            while (I < N && isWhitespace(P[I]))
+                I++;
+            return I;
+        }
+
+        size_t firstOfScalar(const char *P, size_t I, size_t N,
+                             llvm::StringRef Set)
+        {
+            while (I < N && Set.find(P[I]) == llvm::StringRef::npos)
+                I++;
+            return I;
+        }
+
+#ifdef CPP2C_TRIVIA_SIMD
+        size_t firstNonWhitespaceSSE2(const char *P, size_t I, size_t N)
+        {
+            const __m128i Space = _mm_set1_epi8(' ');
+            const __m128i Lo = _mm_set1_epi8('\t' - 1);
+            const __m128i Hi = _mm_set1_epi8('\r' + 1);
+            for (; I + 16 <= N; I += 16)
+            {
+                __m128i V = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(P + I));
+                __m128i WS = _mm_or_si128(
+                    _mm_cmpeq_epi8(V, Space),
+                    _mm_and_si128(_mm_cmpgt_epi8(V, Lo),
+                                  _mm_cmplt_epi8(V, Hi)));
+                unsigned Mask = ~_mm_movemask_epi8(WS) & 0xFFFFu;
+                if (Mask)
+                    return I + __builtin_ctz(Mask);
+            }
+            return firstNonWhitespaceScalar(P, I, N);
+        }
+
+        size_t firstOfSSE2(const char *P, size_t I, size_t N,
+                           llvm::StringRef Set)
+        {
+            for (; I + 16 <= N; I += 16)
+            {
+                __m128i V = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(P + I));
+                __m128i M = _mm_setzero_si128();
+                for (char C : Set)
+                    M = _mm_or_si128(M, _mm_cmpeq_epi8(V, _mm_set1_epi8(C)));
+                unsigned Mask = _mm_movemask_epi8(M);
+                if (Mask)
+                    return I + __builtin_ctz(Mask);
+            }
+            return firstOfScalar(P, I, N, Set);
+        }
+
+        __attribute__((target("avx2")))
+        size_t firstNonWhitespaceAVX2(const char *P, size_t I, size_t N)
+        {
+            const __m256i Space = _mm256_set1_epi8(' ');
+            const __m256i Lo = _mm256_set1_epi8('\t' - 1);
+            const __m256i Hi = _mm256_set1_epi8('\r' + 1);
+            for (; I + 32 <= N; I += 32)
+            {
+                __m256i V = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i *>(P + I));
+                __m256i WS = _mm256_or_si256(
+                    _mm256_cmpeq_epi8(V, Space),
+                    _mm256_and_si256(_mm256_cmpgt_epi8(V, Lo),
+                                     _mm256_cmpgt_epi8(Hi, V)));
+                unsigned Mask = ~static_cast<unsigned>(
+                    _mm256_movemask_epi8(WS));
+                if (Mask)
+                    return I + __builtin_ctz(Mask);
+            }
+            // Legacy SSE instructions after AVX ones are slow until the
+            // upper halves of the registers are cleared
+            _mm256_zeroupper();
+            return firstNonWhitespaceSSE2(P, I, N);
+        }
+
+        __attribute__((target("avx2")))
+        size_t firstOfAVX2(const char *P, size_t I, size_t N,
+                           llvm::StringRef Set)
+        {
+            for (; I + 32 <= N; I += 32)
+            {
+                __m256i V = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i *>(P + I));
+                __m256i M = _mm256_setzero_si256();
+                for (char C : Set)
+                    M = _mm256_or_si256(
+                        M, _mm256_cmpeq_epi8(V, _mm256_set1_epi8(C)));
+                unsigned Mask = static_cast<unsigned>(
+                    _mm256_movemask_epi8(M));
+                if (Mask)
+                    return I + __builtin_ctz(Mask);
+            }
+            _mm256_zeroupper();
+            return firstOfSSE2(P, I, N, Set);
+        }
+#endif
+
+        struct Kernels
+        {
+            size_t (*FirstNonWhitespace)(const char *, size_t, size_t);
+            size_t (*FirstOf)(const char *, size_t, size_t, llvm::StringRef);
+        };
+
+        const Kernels ScalarKernels = {firstNonWhitespaceScalar,
+                                       firstOfScalar};
+
+        const Kernels &getKernels()
+        {
+            static const Kernels K = []() -> Kernels
+            {
+#ifdef CPP2C_TRIVIA_SIMD
+                if (__builtin_cpu_supports("avx2"))
+                    return {firstNonWhitespaceAVX2, firstOfAVX2};
+                return {firstNonWhitespaceSSE2, firstOfSSE2};
+#else
+                return ScalarKernels;
+#endif
+            }();
+            return K;
+        }
+
+        TriviaScanResult scan(const Kernels &K, llvm::StringRef Bytes,
+                              bool LineComments)
+        {
+            const char *P = Bytes.data();
+            size_t N = Bytes.size();
+            size_t I = 0;
+            while (true)
+            {
+                I = K.FirstNonWhitespace(P, I, N);
+                if (I == N)
+                    return TriviaScanResult::OnlyTrivia;
+
+                unsigned char C = P[I];
+                if (C == '/')
+                {
+                    // Whether this slash starts a comment depends on the
+                    // next character, which may be past the bytes
+                    if (I + 1 == N)
+                        return TriviaScanResult::Inconclusive;
+
+                    if (P[I + 1] == '*')
+                    {
+                        // The block comment must end within the bytes
+                        size_t J = I + 2;
+                        while (true)
+                        {
+                            J = K.FirstOf(P, J, N, BlockCommentSpecials);
+                            if (J + 1 >= N || P[J] != '*')
+                                return TriviaScanResult::Inconclusive;
+                            if (P[J + 1] == '/')
+                                break;
+                            J++;
+                        }
+                        I = J + 2;
+                        continue;
+                    }
+
+                    if (P[I + 1] == '/' && LineComments)
+                    {
+                        // The line comment must end within the bytes
+                        size_t J =
+                            K.FirstOf(P, I + 2, N, LineCommentSpecials);
+                        if (J == N || (P[J] != '\n' && P[J] != '\r'))
+                            return TriviaScanResult::Inconclusive;
+                        I = J;
+                        continue;
+                    }
+
+                    // A splice or trigraph may join the slash with a star
+                    if (P[I + 1] == '\\' || P[I + 1] == '?' ||
+                        P[I + 1] == '/')
+                        return TriviaScanResult::Inconclusive;
+                    return TriviaScanResult::HasToken;
+                }
+
+                // Printable ASCII characters other than these always start
+                // a token
+                if (C > ' ' && C < 0x7F && C != '\\' && C != '?')
+                    return TriviaScanResult::HasToken;
+
+                return TriviaScanResult::Inconclusive;
+            }
+        }
+    } // namespace
+
+    TriviaScanResult scanTrivia(llvm::StringRef Bytes, bool LineComments)
+    {
+        return scan(getKernels(), Bytes, LineComments);
+    }
+
+    TriviaScanResult scanTriviaScalar(llvm::StringRef Bytes,
+                                      bool LineComments)
+    {
+        return scan(ScalarKernels, Bytes, LineComments);
+    }
+} // namespace cpp2c
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+
+namespace cpp2c
+{
+    enum class TriviaScanResult
+    {
+        // The bytes are only whitespace and comments
+        OnlyTrivia,
+        // A token starts within the bytes
+        HasToken,
+        // The bytes contain something only a lexer can classify (e.g.,
+        // line splices, trigraphs, non-ASCII characters, or comments which
+        // do not end within the bytes)
+        Inconclusive,
+    };
+
+    // Classifies the given bytes the way a raw lexer starting at their
+    // first byte would, without lexing.
+    // Uses SSE2 or AVX2 to skip whitespace and comment bodies when
+    // available.
+    TriviaScanResult scanTrivia(llvm::StringRef Bytes, bool LineComments);
+
+    // Same as scanTrivia, but always without SIMD, to measure what SIMD
+    // gains
+    TriviaScanResult scanTriviaScalar(llvm::StringRef Bytes,
+                                      bool LineComments);
+} // namespace cpp2c
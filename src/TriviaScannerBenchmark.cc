@@ -0,0 +1,146 @@
+// Compares scanTrivia, with and without SIMD, against raw lexing on the
+// kinds of gaps that alignment edge checks ask about.
+// Usage: trivia-scanner-benchmark [<gaps> [<max pieces per gap>]]
+// Built only when CPP2C_BUILD_BENCHMARKS is enabled.
+
+#include "TriviaScanner.hh"
+
+#include "clang/Basic/LangOptions.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Lex/Lexer.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // The lexing loop that edge checks used before the fast path
+    bool hasTokenByLexing(const clang::LangOptions &LO,
+                          const std::string &Buffer,
+                          size_t B,
+                          size_t E)
+    {
+        auto FileLoc = clang::SourceLocation::getFromRawEncoding(1);
+        const char *BufBegin = Buffer.c_str();
+        clang::Lexer Lex(FileLoc, LO, BufBegin, BufBegin + B, BufBegin + E);
+        clang::Token Tok;
+        while (!Lex.LexFromRawLexer(Tok))
+        {
+            if (Tok.is(clang::tok::eof))
+                break;
+            auto Off = Tok.getLocation().getRawEncoding() -
+                       FileLoc.getRawEncoding();
+            if (Off >= E)
+                break;
+            if (!Tok.is(clang::tok::comment))
+                return true;
+        }
+        return false;
+    }
+
+    std::string randomGap(std::mt19937 &Gen, size_t MaxPieces)
+    {
+        static const char *Pieces[] = {" ", "  ", "\t", "\n", "    ",
+                                       "/* comment */", "// comment\n",
+                                       "/* a longer comment spanning "
+                                       "several words */"};
+        std::uniform_int_distribution<size_t> NumPieces(0, MaxPieces);
+        std::uniform_int_distribution<size_t> Piece(
+            0, sizeof(Pieces) / sizeof(*Pieces) - 1);
+        std::string Gap;
+        for (size_t I = NumPieces(Gen); I > 0; I--)
+            Gap += Pieces[Piece(Gen)];
+        return Gap;
+    }
+
+    struct ScanCounts
+    {
+        size_t Trivia = 0, Tokens = 0, Inconclusive = 0;
+    };
+
+    template <typename Scan>
+    ScanCounts scanGaps(llvm::StringRef Bytes,
+                        const std::vector<std::pair<size_t, size_t>> &Gaps,
+                        bool LineComments,
+                        Scan S)
+    {
+        ScanCounts C;
+        for (auto &&G : Gaps)
+            switch (S(Bytes.slice(G.first, G.second), LineComments))
+            {
+            case cpp2c::TriviaScanResult::OnlyTrivia:
+                C.Trivia++;
+                break;
+            case cpp2c::TriviaScanResult::HasToken:
+                C.Tokens++;
+                break;
+            case cpp2c::TriviaScanResult::Inconclusive:
+                C.Inconclusive++;
+                break;
+            }
+        return C;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const size_t NumGaps = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    const size_t MaxPieces = argc > 2 ? std::stoul(argv[2]) : 6;
+
+    clang::LangOptions LO;
+    LO.LineComment = true;
+
+    // Gaps separated by tokens, as between the edges of a macro
+    // definition and its aligned nodes
+    std::mt19937 Gen(0);
+    std::string Buffer;
+    std::vector<std::pair<size_t, size_t>> Gaps;
+    Gaps.reserve(NumGaps);
+    for (size_t I = 0; I < NumGaps; I++)
+    {
+        Buffer += "x";
+        auto Gap = randomGap(Gen, MaxPieces);
+        Gaps.push_back({Buffer.size(), Buffer.size() + Gap.size()});
+        Buffer += Gap;
+    }
+    Buffer += "x";
+
+    using Clock = std::chrono::steady_clock;
+
+    size_t LexTokens = 0;
+    auto T0 = Clock::now();
+    for (auto &&G : Gaps)
+        LexTokens += hasTokenByLexing(LO, Buffer, G.first, G.second);
+    auto T1 = Clock::now();
+
+    llvm::StringRef Bytes(Buffer);
+    auto Scalar = scanGaps(Bytes, Gaps, LO.LineComment,
+                           cpp2c::scanTriviaScalar);
+    auto T2 = Clock::now();
+
+    auto SIMD = scanGaps(Bytes, Gaps, LO.LineComment, cpp2c::scanTrivia);
+    auto T3 = Clock::now();
+
+    auto NS = [&](Clock::duration D)
+    {
+        return std::chrono::duration<double, std::nano>(D).count() / NumGaps;
+    };
+    auto report = [&](const char *Name, Clock::duration D, ScanCounts C)
+    {
+        llvm::outs() << Name << ": " << NS(D) << " ns/gap, "
+                     << C.Trivia << " trivia, "
+                     << C.Tokens << " with tokens, "
+                     << C.Inconclusive << " inconclusive\n";
+    };
+    llvm::outs() << "gaps: " << NumGaps << ", "
+                 << (Buffer.size() - NumGaps - 1) / NumGaps << " bytes/gap\n"
+                 << "lexer: " << NS(T1 - T0) << " ns/gap, "
+                 << LexTokens << " with tokens\n";
+    report("scalar scanner", T2 - T1, Scalar);
+    report("simd scanner", T3 - T2, SIMD);
+    return 0;
+}
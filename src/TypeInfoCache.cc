@@ -0,0 +1,83 @@
+#include "TypeInfoCache.hh"
+
+namespace cpp2c
+{
+    static const clang::Decl *getTypeDeclOrNull(const clang::Type *T)
+    {
+        if (!T)
+            return nullptr;
+
+        if (auto TD = clang::dyn_cast<clang::TypedefType>(T))
+            return TD->getDecl();
+        else if (auto TD = clang::dyn_cast<clang::TagType>(T))
+            return TD->getDecl();
+        else if (auto ET = clang::dyn_cast<clang::ElaboratedType>(T))
+            return getTypeDeclOrNull(ET->desugar().getTypePtrOrNull());
+        else
+            return nullptr;
+    }
+
+    TypeInfoCache::TypeInfoCache(const TUOrder &TUO) : TUO(TUO) {}
+
+    TypeInfoCache::TypeInfo TypeInfoCache::lookup(const clang::Type *T)
+    {
+        auto It = Cache.find(T);
+        if (It != Cache.end())
+            return It->second;
+
+        TypeInfo Info;
+
+        // Find the innermost type
+        const clang::Type *Inner = T;
+        while (Inner && (Inner->isAnyPointerType() || Inner->isArrayType()))
+            if (Inner->isAnyPointerType())
+                Inner = Inner->getPointeeType().getTypePtrOrNull();
+            else if (Inner->isArrayType())
+                Inner = Inner->getBaseElementTypeUnsafe();
+
+        if ((Info.D = getTypeDeclOrNull(Inner)))
+        {
+            Info.IsLocal = !Info.D->getDeclContext()->isTranslationUnit();
+
+            if (auto ND = clang::dyn_cast<clang::NamedDecl>(Info.D))
+                Info.IsAnonymous = ND->getIdentifier() == nullptr ||
+                                   ND->getName().empty();
+
+            auto DLoc = Info.D->getLocation();
+            if (DLoc.isValid())
+                Info.DeclFileLoc = TUO.getSourceManager().getFileLoc(DLoc);
+
+            if (auto TD = clang::dyn_cast<clang::TagDecl>(Info.D))
+                Info.IsIncompleteTag = !TD->getDefinition();
+        }
+
+        if (Info.IsIncompleteTag)
+            return Info;
+        return Cache[T] = Info;
+    }
+
+    bool TypeInfoCache::hasLocalType(const clang::Type *T)
+    {
+        return T && lookup(T).IsLocal;
+    }
+
+    bool TypeInfoCache::hasAnonymousType(const clang::Type *T)
+    {
+        return T && lookup(T).IsAnonymous;
+    }
+
+    bool TypeInfoCache::hasTypeDefinedAfter(const clang::Type *T,
+                                            clang::SourceLocation L)
+    {
+        if (!T)
+            return false;
+
+        auto Info = lookup(T);
+        return Info.DeclFileLoc.isValid() && TUO.isBefore(L, Info.DeclFileLoc);
+    }
+
+    bool TypeInfoCache::hasIncompleteTagType(const clang::Type *T)
+    {
+        return T && lookup(T).IsIncompleteTag;
+    }
+} // namespace cpp2c
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "TUOrder.hh"
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Type.h"
+#include "clang/Basic/SourceLocation.h"
+
+#include "llvm/ADT/DenseMap.h"
+
+namespace cpp2c
+{
+    // Memoizes the type predicates used by the consumer.
+    // Each predicate looks through pointer and array types to the
+    // innermost type, and checks the declaration of that type (if any).
+    // Entries are keyed by the (possibly sugared) Type pointer since
+    // typedefs have declarations of their own.
+    // Types whose innermost type is a tag type without a definition are
+    // not cached: once the definition is parsed, the tag type's
+    // declaration becomes the definition.
+    class TypeInfoCache
+    {
+    private:
+        struct TypeInfo
+        {
+            // Declaration of the innermost type, if any
+            const clang::Decl *D = nullptr;
+            // Whether D is declared at a local scope
+            bool IsLocal = false;
+            // Whether D is declared without a name
+            bool IsAnonymous = false;
+            // File location of D, if valid
+            clang::SourceLocation DeclFileLoc;
+            // Whether D is a tag declaration without a definition yet
+            bool IsIncompleteTag = false;
+        };
+
+        const TUOrder &TUO;
+        llvm::DenseMap<const clang::Type *, TypeInfo> Cache;
+
+        TypeInfo lookup(const clang::Type *T);
+
+    public:
+        explicit TypeInfoCache(const TUOrder &TUO);
+
+        // Returns true if any type in T is a local type
+        bool hasLocalType(const clang::Type *T);
+
+        // Returns true if any type in T is an anonymous type
+        bool hasAnonymousType(const clang::Type *T);
+
+        // Returns true if any type in T was defined after L
+        bool hasTypeDefinedAfter(const clang::Type *T, clang::SourceLocation L);
+
+        // Returns true if the innermost type of T is a tag type that is not
+        // defined yet, so that its definition may still follow
+        bool hasIncompleteTagType(const clang::Type *T);
+    };
+} // namespace cpp2c
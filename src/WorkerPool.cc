@@ -0,0 +1,114 @@
+#include "WorkerPool.hh"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <optional>
+#include <utility>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace cpp2c
+{
+    static_assert(std::atomic<size_t>::is_always_lock_free,
+                  "the work counter is shared between processes");
+
+    // Appends a record of an item's index, the length of its result, and
+    // its result to File
+    static bool writeRecord(std::FILE *File,
+                            uint64_t Index,
+                            const std::string &Result)
+    {
+        uint64_t Length = Result.size();
+        return std::fwrite(&Index, sizeof(Index), 1, File) == 1 &&
+               std::fwrite(&Length, sizeof(Length), 1, File) == 1 &&
+               std::fwrite(Result.data(), 1, Length, File) == Length;
+    }
+
+    // Reads the complete records in File into Results
+    static void readRecords(std::FILE *File,
+                            std::vector<std::optional<std::string>> &Results)
+    {
+        std::rewind(File);
+        uint64_t Index, Length;
+        while (std::fread(&Index, sizeof(Index), 1, File) == 1 &&
+               std::fread(&Length, sizeof(Length), 1, File) == 1)
+        {
+            std::string Result(Length, '\0');
+            if (std::fread(Result.data(), 1, Length, File) != Length)
+                break;
+            if (Index < Results.size())
+                Results[Index] = std::move(Result);
+        }
+    }
+
+    std::vector<std::optional<std::string>> runInWorkers(
+        size_t N,
+        unsigned Jobs,
+        llvm::function_ref<std::string(size_t)> Work,
+        llvm::function_ref<void(unsigned)> Forked)
+    {
+        std::vector<std::optional<std::string>> Results(N);
+
+        void *Shared = MAP_FAILED;
+        if (Jobs > 1 && N > 1)
+            Shared = mmap(nullptr, sizeof(std::atomic<size_t>),
+                          PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (Shared != MAP_FAILED)
+        {
+            auto Next = new (Shared) std::atomic<size_t>(0);
+
+            // Don't let the workers inherit buffered output
+            llvm::outs().flush();
+            llvm::errs().flush();
+            std::fflush(nullptr);
+
+            std::vector<std::pair<pid_t, std::FILE *>> Workers;
+            for (unsigned W = 1; W <= Jobs && W <= N; ++W)
+            {
+                std::FILE *File = std::tmpfile();
+                if (!File)
+                    break;
+                pid_t Pid = fork();
+                if (Pid < 0)
+                {
+                    std::fclose(File);
+                    break;
+                }
+                if (Pid == 0)
+                {
+                    if (Forked)
+                        Forked(W);
+                    // Exit without running destructors or atexit handlers,
+                    // which belong to the parent
+                    for (size_t I; (I = Next->fetch_add(1)) < N;)
+                        if (!writeRecord(File, I, Work(I)))
+                            _exit(1);
+                    _exit(std::fflush(File) == 0 ? 0 : 1);
+                }
+                Workers.push_back({Pid, File});
+            }
+
+            for (auto &&[Pid, File] : Workers)
+            {
+                int Status;
+                while (waitpid(Pid, &Status, 0) < 0 && errno == EINTR)
+                    ;
+                readRecords(File, Results);
+                std::fclose(File);
+            }
+
+            Next->~atomic();
+            munmap(Shared, sizeof(std::atomic<size_t>));
+        }
+
+        return Results;
+    }
+} // namespace cpp2c
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace cpp2c
+{
+    // Computes Work(I) for each I in [0, N) with up to Jobs forked copies
+    // of this process, and returns the results in order.
+    // Each process claims the next unclaimed index whenever it finishes
+    // one, so a few slow items do not hold up the others.
+    // Work runs on a copy-on-write snapshot of this process, so anything it
+    // changes outside of its result is only visible in the process that
+    // computed the item, and only to the items it computes later.
+    // The results of items whose process failed, or of all items if no
+    // process could be forked, are empty and left to the caller.
+    // If given, Forked runs in each forked process before it computes any
+    // item, with the number of the process, from 1 to Jobs.
+    std::vector<std::optional<std::string>> runInWorkers(
+        size_t N,
+        unsigned Jobs,
+        llvm::function_ref<std::string(size_t)> Work,
+        llvm::function_ref<void(unsigned)> Forked = nullptr);
+} // namespace cpp2c
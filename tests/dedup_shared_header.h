@@ -0,0 +1,6 @@
+#define SQUARE(x) ((x) * (x))
+
+static inline int area(int side)
+{
+    return SQUARE(side);
+}
@@ -0,0 +1,9 @@
+struct point
+{
+    int x;
+    int y;
+};
+
+static int origin_x = 0;
+
+#define HEADER_ORIGIN (origin_x)
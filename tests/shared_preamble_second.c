@@ -0,0 +1,22 @@
+// Analyzed by cpp2c-batch with --share-preambles --check-preambles 2, along
+// with shared_preamble_first.c, both translation units are parsed with the
+// precompiled preamble of the include block they start with, and then again
+// without it. The check must not report any difference: the includes of the
+// block are attributed to the main file, as in a normal run, rather than to
+// the header of the preamble, which only exists in memory.
+
+#include "h1.h"
+#include "h2.h"
+
+int second(void)
+{
+    return 0;
+}
+
+
+// No expected invocation properties
+
+// Expected includes (the same with and without a preamble):
+// Include	T	/maki/tests/h1.h
+// Include	T	/maki/tests/h2.h
+// Include	T	/maki/tests/h4.h